@@ -0,0 +1,212 @@
+#ifndef ANALYSIS_H_
+#define ANALYSIS_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "repre.h"
+#include "struct.h"
+
+using std::vector;
+using std::pair;
+
+// marks a missing block or loop, e.g. the immediate dominator of entry
+const size_t noBlock = std::numeric_limits<size_t>::max();
+
+// control flow graph indexed by block number instead of label name
+// block 0 is the entry, blocks are kept in the order of buildCFG
+struct FlowGraph {
+    // the #line where each block begins and ends
+    vector <size_t> lead, last;
+
+    // successors and predecessors of each block, without duplicates
+    vector <vector <size_t>> succ, pred;
+
+    // default construction and destruction function
+    FlowGraph () {}
+    ~FlowGraph () {}
+
+    // construct from built CFG
+    FlowGraph (const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges);
+
+    size_t size () const { return lead.size (); }
+
+    // get the block which contains #line
+    size_t blockOf (size_t line) const;
+
+    // append an edge unless it exists already
+    void addEdge (size_t from, size_t to);
+};
+
+// dominator tree built by the Cooper-Harvey-Kennedy iterative algorithm
+// works on any graph given as successor and predecessor lists, so that
+// the post-dominator tree is obtained by swapping the two lists
+struct DominatorTree {
+    size_t entry;
+
+    // immediate dominator of each block, noBlock when unreachable
+    // the entry is its own immediate dominator
+    vector <size_t> idom;
+
+    // children of each block in dominator tree
+    vector <vector <size_t>> children;
+
+    // reachable blocks in reverse post order of a depth first search
+    vector <size_t> order;
+
+    // dominance frontier of each block
+    vector <vector <size_t>> frontier;
+
+    // default construction and destruction function
+    DominatorTree () {}
+    ~DominatorTree () {}
+
+    // dominators of the flow graph, rooted at block 0
+    DominatorTree (const FlowGraph &graph);
+
+    DominatorTree (const vector <vector <size_t>> &succ,
+    const vector <vector <size_t>> &pred, size_t entry);
+
+    bool reachable (size_t block) const { return idom[block] != noBlock; }
+
+    // whether block 'a' dominates block 'b', in constant time
+    bool dominates (size_t a, size_t b) const;
+
+    // depth of block in dominator tree, entry has depth 0
+    size_t level (size_t block) const { return levels[block]; }
+
+private:
+    // pre-order and post-order number of dominator tree walk
+    vector <size_t> preNum, postNum, levels;
+
+    void build (const vector <vector <size_t>> &succ,
+    const vector <vector <size_t>> &pred);
+};
+
+// a loop in the loop nesting forest
+struct LoopNest {
+    // the first block of loop visited by depth first search
+    size_t header;
+
+    // false when the loop can be entered somewhere other than header
+    bool reducible;
+
+    // all blocks in the loop including nested ones, header comes first
+    vector <size_t> blocks;
+
+    // blocks in the loop that branch back to header
+    vector <size_t> latches;
+
+    // blocks in the loop with predecessors outside, only header if reducible
+    vector <size_t> entries;
+
+    // edges leaving the loop, from a block inside to a block outside
+    vector <pair <size_t, size_t>> exits;
+
+    // the only block outside that leads to header, and only to header
+    // noBlock if the loop has no such block
+    size_t preheader;
+
+    // enclosing loop and directly nested loops
+    size_t parent;
+    vector <size_t> children;
+
+    // nesting depth, outermost loops have depth 1
+    size_t depth;
+
+    LoopNest (size_t h) : header (h), reducible (true),
+        preheader (noBlock), parent (noBlock), depth (1) {}
+};
+
+// loop nesting forest built by Havlak's algorithm, which handles
+// irreducible loops and runs in almost linear time
+struct LoopForest {
+    // inner loops always come before the loops enclosing them
+    vector <LoopNest> loops;
+
+    // the innermost loop of each block, noBlock if not in loop
+    vector <size_t> loopOf;
+
+    // loops that are not nested in any other loop
+    vector <size_t> roots;
+
+    // default construction and destruction function
+    LoopForest () {}
+    ~LoopForest () {}
+
+    LoopForest (const FlowGraph &graph);
+
+    // whether the block is inside loop 'loop', or any loop nested in it
+    bool contains (size_t loop, size_t block) const;
+
+    // loop nesting depth of block, 0 if not in loop
+    size_t depth (size_t block) const;
+
+    // whether the loop contains no other loop
+    bool innermost (size_t loop) const { return loops[loop].children.empty (); }
+};
+
+// set of small integers, used by bit-vector data flow problems
+struct BitVector {
+    vector <uint64_t> words;
+    size_t bits;
+
+    BitVector (size_t n=0) : words ((n + 63) / 64, 0), bits (n) {}
+
+    bool test (size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    void set (size_t i) { words[i >> 6] |= uint64_t (1) << (i & 63); }
+    void reset (size_t i) { words[i >> 6] &= ~(uint64_t (1) << (i & 63)); }
+
+    // make every bit one
+    void fill ();
+
+    bool any () const;
+    size_t count () const;
+
+    bool operator== (const BitVector &other) const { return words == other.words; }
+    bool operator!= (const BitVector &other) const { return words != other.words; }
+
+    BitVector& operator|= (const BitVector &other);
+    BitVector& operator&= (const BitVector &other);
+
+    // remove every bit which is set in 'other'
+    BitVector& subtract (const BitVector &other);
+
+    // call 'visit' on each bit that is set, in increasing order
+    template <typename Visit>
+    void forEach (Visit visit) const {
+        for (size_t w = 0; w < words.size (); w++) {
+            uint64_t word = words[w];
+            while (word) {
+                size_t bit = __builtin_ctzll (word);
+                visit ((w << 6) + bit);
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+// registers live on entry to and exit from each block
+struct Liveness {
+    vector <BitVector> liveIn, liveOut;
+
+    // default construction and destruction function
+    Liveness () {}
+    ~Liveness () {}
+
+    // every register in blocks must be smaller than 'numRegs'
+    Liveness (const vector <vector <const Instruction*>> &blocks,
+    const vector <vector <size_t>> &succ, size_t numRegs);
+};
+
+// help to copy instructions of each block into its own vector
+void splitBlocks (const vector <const Instruction*> &fromMe, const FlowGraph &graph,
+    vector <vector <const Instruction*>> *toMe);
+
+// help to move instructions of blocks back in the order of 'layout'
+void joinBlocks (vector <vector <const Instruction*>> &fromMe,
+    const vector <size_t> &layout, vector <const Instruction*> *toMe);
+
+#endif   // ANALYSIS_H_
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "repre.h"
@@ -11,6 +12,7 @@ using std::vector;
 using std::string;
 using std::pair;
 using std::unordered_map;
+using std::unordered_set;
 
 void buildCFG (const vector <const Instruction*> &fromMe, vector <size_t> *lead, 
     vector <size_t> *last, vector <pair <size_t, size_t>> *edges=nullptr);
@@ -20,10 +22,186 @@ void valueNumbering (const vector <const Instruction*> &fromMe,
     const vector <size_t> &lead, const vector <size_t> &last, 
     const vector <pair <size_t, size_t>> edges);
 
+// value numbering over the dominator tree, values computed in any
+// dominating block are reused when a register still holds them
+void dominatorValueNumbering (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// sparse conditional constant propagation on SSA form, folds constants,
+// turns constant conditional branches into jumps and drops dead blocks
+void constantPropagation (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// aggressive dead code elimination on SSA form, only operations that lead
+// to memory, input or output are kept, useless conditional branches jump to
+// the nearest useful post-dominator, then the control flow is cleaned
+void deadCodeElimination (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// dead store elimination on SSA form, by liveness of the bytes of memory
+// backward over the flow graph, where addresses are told apart as a name
+// plus a constant offset, a store no byte of which is read before it is
+// overwritten or the code halts is removed
+void deadStoreElimination (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// widening of byte loads and stores on SSA form, names holding a multiple
+// of four are found as a greatest fixed point, then in each block the byte
+// loads of one word at such a name plus a constant become a word load with
+// shifts and masks, and byte stores writing a whole word become one word
+// store; byte k of a word is bits 8k to 8k + 7, the least significant first
+void byteWidening (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// partial redundancy elimination by lazy code motion, expressions are moved
+// to the latest place on edges where they are still computed at most once on
+// every path, so fully and partially redundant computations become copies
+void partialRedundancyElimination (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// reassociation on SSA form, chains of additions, multiplications, ands and
+// ors are flattened and rebuilt with constants and the terms of the lowest
+// loop depth and earliest definition combined first, so that value numbering
+// and loop-invariant code motion find more to reuse and to hoist
+void reassociation (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// the 'Clean' pass, folds redundant branches, removes empty blocks, combines
+// blocks and hoists branches until nothing changes, unused labels are dropped
+void cleanControlFlow (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// give each reducible loop without one a preheader, a new block right before
+// header which falls into it, the labels of new blocks are put in 'created'
+void insertPreheaders (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges, unordered_set <string> *created=nullptr);
+
+// hoist operations computing the same value in every iteration into the
+// preheader, loads are hoisted when no store in loop may change them
+void loopInvariantCodeMotion (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// operator strength reduction on SSA form, multiplies and adds of an induction
+// variable and a region constant become induction variables of their own, and
+// comparisons of an induction variable use its reduced multiple when there is one
+void strengthReduction (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// unroll innermost loops stepping an induction variable towards a bound
+// by 'unrollBy', the trip count is computed before the loop, and the
+// original loop runs the iterations left over by the unrolled one
+// when 'unrollBy' is 0 a cost model chooses the factor of each loop,
+// and the factor of every loop is reported to the standard error
 void loopUnrolling (const vector <const Instruction*> &fromMe, 
     vector <const Instruction*> *toMe, 
     const vector <size_t> &lead, const vector <size_t> &last, 
-    const vector <pair <size_t, size_t>> edges, size_t unrollBy=4);
+    const vector <pair <size_t, size_t>> &edges, size_t unrollBy=0);
+
+// unroll an outer loop with a single inner loop by 'factor' and fuse the
+// copies of the inner loop into one, when both are counted loops with the
+// same inner trip count in every copy, and no dependence through memory
+// between the copies is reversed, the factor of each loop is reported
+void unrollAndJam (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges, size_t factor=2);
+
+// turn loops tested at the top into loops tested at the bottom, the header
+// is copied over the branch back to it at the end of each latch, and is left
+// in front of the loop as a guard, so each iteration ends in a single branch
+void loopRotation (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// copy a loop with a conditional branch on a register it never writes, so
+// one copy runs each outcome with the branch turned into a jump, and the
+// preheader tests the condition once, loops are copied within a size limit
+void loopUnswitching (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// software pipelining of innermost counted loops made of one block, by
+// iterative modulo scheduling for the machine in util.h, the interval
+// between iterations of each loop is reported with its lower bounds
+void softwarePipelining (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// map registers onto 'k' physical registers r0 to r(k-1) by graph coloring
+// in the way of Chaitin and Briggs, registers left without a color are
+// spilled to memory from address 32768 with storeAI and loadAI through the
+// last register, or loaded again when they only ever hold one constant
+void registerAllocation (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges, size_t k);
+
+// replace the uses of each copy's destination by its source wherever the
+// copy reaches them unchanged, remove copies left dead, then coalesce the
+// source and destination of the remaining copies which do not interfere, when
+// the Briggs or George test shows 'k' registers still suffice, 'k' being by
+// default the most registers live at once, the counts are reported
+void copyPropagation (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges, size_t k=0);
+
+// reorder the operations of each block by list scheduling for the machine in
+// util.h, an operation whose operands are ready goes first when it has the
+// longest path of latencies to the end of the block, with 'superblocks' a
+// block reached only from the one before it is scheduled with it, the cycles
+// estimated before and after are reported for each block that got faster
+void listScheduling (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges, bool superblocks=false);
+
+// pack the operations of each block into groups issued together, of at most
+// the width of the machine in util.h and within its units, by list scheduling
+// where operations issued in one cycle make a group, the groups are reported
+void bundlePacking (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// rewrite operations by a table of patterns looking through the definitions
+// of operands in SSA form, as x + 0 into a copy or an operand loaded with a
+// constant into the immediate form, visiting again through def-use chains
+// what a rewrite may affect until nothing matches, then remove copies onto
+// themselves and jumps to the next instruction, the patterns fired are reported
+void peepholeOptimization (const vector <const Instruction*> &fromMe, 
+    vector <const Instruction*> *toMe, 
+    const vector <size_t> &lead, const vector <size_t> &last, 
+    const vector <pair <size_t, size_t>> &edges);
+
+// turn each group of operations issued together into a sequence of
+// instructions with the same effect
+void ungroupInstructions (vector <const Instruction*> &fromMe);
 
 void generateCode (const vector <const Instruction*> fromMe, FILE *writeToMe);
 
@@ -35,8 +35,17 @@ struct Operation*  makeBranch (enum OpCode code, size_t reg0, char* label1, char
 struct Instruction*  makeInstruction (char* label, struct Operation* op);
 struct Instructions* makeInstructions (struct Instruction* inst);
 
+// an instruction issued in one group with the one before it
+struct Instruction*  makeBundled (struct Operation* op);
+
 void appendInstruction (struct Instructions* toMe, struct Instruction* inst);
 
+// move the instructions of 'fromMe' to the end of 'toMe' and free it
+void appendInstructions (struct Instructions* toMe, struct Instructions* fromMe);
+
+// put label on the first instruction
+void labelInstructions (struct Instructions* toMe, char* label);
+
 #ifdef __cplusplus
 }
 #endif  // __cplusplus
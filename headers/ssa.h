@@ -0,0 +1,78 @@
+#ifndef SSA_H_
+#define SSA_H_
+
+#include <vector>
+
+#include "analysis.h"
+#include "struct.h"
+
+using std::vector;
+using std::pair;
+
+// a phi function at the top of block, 'args[k]' is the name flowing
+// in along the edge from the k-th predecessor of the block
+struct Phi {
+    size_t dst;
+    vector <size_t> args;
+};
+
+// a place where a name is defined or used, 'index' is the position of
+// instruction in block, or the position of phi function if 'phi' is set
+struct SSASite {
+    size_t block, index;
+    bool phi;
+};
+
+// a procedure in pruned static single assignment form, where registers
+// are renamed so that each name is written exactly once
+struct SSAForm {
+    // instructions of each block, owned by the form
+    // the first instruction carries the label, except for the entry block
+    vector <vector <const Instruction*>> blocks;
+
+    // the order to write blocks back, block 0 is the entry and comes first
+    vector <size_t> layout;
+
+    vector <vector <size_t>> succ, pred;
+    vector <vector <Phi>> phis;
+
+    // the original register of each name
+    vector <size_t> origReg;
+
+    // names holding the values registers have before the procedure starts
+    vector <size_t> entryNames;
+
+    // the first register not used by the original code
+    size_t nextReg;
+
+    // sparse def-use chains, built by buildDefUse
+    // names in 'entryNames' are defined at block noBlock
+    vector <SSASite> defSite;
+    vector <vector <SSASite>> useSites;
+
+    SSAForm () : nextReg (0) {}
+    ~SSAForm ();
+
+    size_t numNames () const { return origReg.size (); }
+
+    // label of block, nullptr for the entry block without label
+    const char* label (size_t block) const { return blocks[block][0]->label; }
+
+    void buildDefUse ();
+
+    // help to remove an edge together with the phi arguments along it
+    void removeEdge (size_t from, size_t to);
+};
+
+// rename registers into SSA form, a phi function is placed at the dominance
+// frontier only where the register is live, unreachable blocks are dropped
+void buildSSA (const vector <const Instruction*> &fromMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, SSAForm *toMe);
+
+// translate out of SSA form, names connected by phi functions or copies
+// are coalesced unless they interfere, and the remaining phi functions
+// become sequentialized parallel copies on the incoming edges
+void destroySSA (SSAForm &fromMe, vector <const Instruction*> *toMe);
+
+#endif   // SSA_H_
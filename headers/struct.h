@@ -53,21 +53,28 @@ struct Instruction {
     char* label;
     Operation* op;
 
+    // issued in one group with the instruction before it, the operations
+    // of a group read their operands before any of them writes
+    bool bundled;
+
     Instruction () {
         label = nullptr;
         op = nullptr;
+        bundled = false;
     }
 
     // for nop in label case
     Instruction (const char* labelIn) {
         label = strdup (labelIn);
         op = new Operation ();
+        bundled = false;
     }
 
     Instruction (char* labelIn, Operation* opIn) : 
-        label (labelIn), op (opIn) {}
+        label (labelIn), op (opIn), bundled (false) {}
 
     Instruction (const Instruction* inst) {
+        bundled = false;
         if (inst->label != nullptr)
             label = strdup (inst->label);
         else label = nullptr;
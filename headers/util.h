@@ -1,6 +1,7 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
+#include <limits>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -12,12 +13,17 @@
 using std::vector;
 using std::string;
 using std::pair;
+using std::make_pair;
 using std::to_string;
 using std::unordered_set;
 using std::unordered_map;
 
 typedef pair <size_t, vector <size_t>> RewriteInfo;
 
+// an operation simplified in value numbering, either 'loadI' of a constant
+// or 'i2i' of the register holding the value
+typedef pair <OpCode, size_t> FoldInfo;
+
 /*  Opcode Map
     0 - add, sub, mult, div, lshift, rshift, and, or, cmp_LT, cmp_LE, cmp_GT, cmp_GE, cmp_EQ, cmp_NE
     1 - addI, subI, multI, divI, lshiftI, rshiftI, andI, orI
@@ -32,22 +38,89 @@ extern const vector <size_t> opcodeMap;
 // dict maps opcode index to opcode name in ILOC code
 extern const vector <string> dict;
 
+// get the register written by operation, return false if there is none
+bool definedReg (const Operation *op, size_t *reg);
+
+// append the registers read by operation to 'regs'
+void usedRegs (const Operation *op, vector <size_t> *regs);
+
+// append the fields of operation holding registers it reads, used to rename
+void useFields (Operation *op, vector <size_t*> *fields);
+
+// help to replace the target 'oldLabel' of a branch by 'newLabel'
+void retarget (const Instruction *inst, const string &oldLabel, const string &newLabel);
+
+// help to move 'label', if any, of an instruction dropped to the next one
+// kept in its block, which has none as labels only start blocks
+const Instruction* withLabel (const Instruction *inst, char *label);
+
+// evaluate operation on constants with 32-bit wrap around, where 'rhs' is the
+// second register or the constant, return false when the result is undefined
+bool evaluate (OpCode code, long long lhs, long long rhs, long long *res);
+
+// whether the value can be written as a constant in ILOC code
+inline bool isEncodable (long long value) {
+    return value >= 0 && value <= std::numeric_limits<int>::max();
+}
+
+// whether number is a power of two
+bool isPowerOfTwo (size_t num);
+
+// the exponent of a power of two
+size_t getPower (size_t num);
+
 // construct label map from parse result
 void buildLabelMap (const vector <const Instruction*> &fromMe, unordered_map <string, size_t> &toMe);
 
+// whether the operands of opcode can be swapped
+inline bool isCommutative (OpCode code) {
+    return code == OpCode::add_ || code == OpCode::mult_ || code == OpCode::and_ || 
+        code == OpCode::or_ || code == OpCode::cmp_EQ_ || code == OpCode::cmp_NE_;
+}
+
+// cycles before the result of operation can be used, following the
+// classic ILOC model where memory operations and multiplies are slow,
+// unless changed with setLatency
+size_t latency (OpCode code);
+
+// help to change the latency of the opcode called 'name', returns false
+// if there is no such opcode or 'cycles' is zero
+bool setLatency (const string &name, size_t cycles);
+
+// the resources of the machine schedulers aim at, every operation takes one
+// of 'width' issue slots in its cycle, memory accesses and input or output
+// also take one of 'memory' units, and multiplies and divides one of 'multiply'
+struct Machine {
+    size_t width, memory, multiply;
+
+    // two issue slots, one memory unit and one multiplier, unless changed
+    // with setMachine
+    Machine ();
+};
+
+// help to change the number of 'width', 'memory' or 'multiply' units of
+// the machine, returns false if there is no such unit or 'count' is zero
+bool setMachine (const string &unit, size_t count);
+
+
+// whether operation takes a memory unit
+inline bool usesMemory (OpCode code) {
+    return (code >= OpCode::load_ && code <= OpCode::cstoreAO_) || code >= OpCode::read_;
+}
+
+// whether operation takes a multiplier
+inline bool usesMultiplier (OpCode code) {
+    return code == OpCode::mult_ || code == OpCode::multI_ || 
+        code == OpCode::div_ || code == OpCode::divI_;
+}
+
 // make hash tag of right hand side expression
 inline string makeHashTag (OpCode code, size_t lhs, size_t rhs, size_t constant) {
-    if (lhs > rhs) std::swap (lhs, rhs);
+    if (isCommutative (code) && lhs > rhs) std::swap (lhs, rhs);
     return to_string (code - OpCode::nop_) + "$" + to_string (lhs) 
         + "$" + to_string (rhs) + "$" + to_string (constant);
 }
 
-struct Loop {
-    string parent, head, tail;
-    Loop (const string &p, const string &h, const string &t) :
-        parent (p), head (h), tail (t) {}
-};
-
 struct Graph {
     // first is the head of block, second is the tail of block
     // use label name as vertex identifier
@@ -63,13 +136,6 @@ struct Graph {
     Graph (const vector <const Instruction*> &insts, const vector <size_t> &lead, 
     const vector <size_t> &last, const vector <pair <size_t, size_t>> &edges);
 
-    void dfs (const string &idx, unordered_map <string, int> &onStack, 
-    unordered_map <string, unordered_set <string>> *body) const;
-
-    // each entry in loops has the first element as the index of loop begin block
-    // and the second element as the index of loop end block in graph
-    void findLoop (vector <Loop> *loops) const;
-
     // help to reverse edges in a directed graph
     void reverseGraph (Graph *toMe) const;
 };
@@ -78,6 +144,20 @@ struct Graph {
 void sortVertexEBB (const Graph &graph, const Graph &revGraph, 
     vector <string> *toMe);
 
+// a value known to be in memory, 'width' bytes at 'offset' from the address
+// with value number 'base', where 'base' is 0 for an absolute address, and
+// 'offset' is the value number of the offset register when it is not known
+struct MemoryValue {
+    size_t base;
+    bool known;
+    long long offset;
+    size_t width;
+
+    // value number of what memory holds, and the register it was loaded
+    // into or stored from
+    size_t value, holder;
+};
+
 struct HashMaps {
     // maps variable or constant or expression to value number
     unordered_map <string, size_t> valDict;
@@ -88,6 +168,62 @@ struct HashMaps {
 
     // maps old variable name to new variable name
     unordered_map <string, string> renameMap;
+
+    // maps value number to the constant it is known to be
+    unordered_map <size_t, long long> constVal;
+
+    // values known to be in memory, dropped by the stores which may overlap them
+    vector <MemoryValue> memory;
+};
+
+// hash map whose changes can be rolled back, used for scoped tables
+// when walking a tree of blocks, e.g. the dominator tree
+template <typename Key>
+struct ScopedMap {
+    unordered_map <Key, size_t> table;
+
+    // each change remembers the key and whether and what it held before
+    vector <pair <Key, pair <bool, size_t>>> undo;
+
+    bool find (const Key &key, size_t *val) const {
+        auto it = table.find (key);
+        if (it == table.end ())
+            return false;
+        *val = it->second;
+        return true;
+    }
+
+    void set (const Key &key, size_t val) {
+        auto it = table.find (key);
+        if (it == table.end ())
+            undo.push_back (make_pair (key, make_pair (false, 0)));
+        else undo.push_back (make_pair (key, make_pair (true, it->second)));
+        table[key] = val;
+    }
+
+    // the mark to roll back to when leaving the current scope
+    size_t mark () const { return undo.size (); }
+
+    void rollBack (size_t mark) {
+        while (undo.size () > mark) {
+            const auto &change = undo.back ();
+            if (change.second.first)
+                table[change.first] = change.second.second;
+            else table.erase (change.first);
+            undo.pop_back ();
+        }
+    }
+};
+
+// make labels that do not clash with any label in the code
+struct LabelMaker {
+    unordered_set <string> used;
+    size_t next;
+
+    LabelMaker (const vector <const Instruction*> &insts);
+
+    // the label is 'prefix' followed by a number
+    string make (const string &prefix);
 };
 
 // convert the result derived from buildCFG to Graph
@@ -95,30 +231,10 @@ void toGraph (const vector <const Instruction*> &insts, const vector <size_t> &l
     const vector <size_t> &last, const vector <pair <size_t, size_t>> &edges, 
     Graph *graph);
 
-// help to copy instructions from 'fromMe' to 'toMe'
-void copyInstructions (const vector <const Instruction*> &fromMe, 
-    vector <const Instruction*> *toMe, size_t fromLine, size_t numLines);
-
-// help to modify branch when copy blocks in loop unrolling
-void modifyBranch (const vector <const Instruction*> fromMe, 
-    vector <const Instruction*> *toMe, Graph *graph, 
-    unordered_map <string, string> *dependency, 
-    const unordered_set <string> &involvedLabels, const string &oldLabel, 
-    const string &newLabel, const string &suffix);
-
-// help to finalize the branch-related instructions in the tail block
-void finalizeTail (const vector <const Instruction*> &block, 
-    vector <const Instruction*> *newBlock, size_t reg, size_t step, 
-    const string &label1, const string &label2);
-
 void writeInstsBack (const vector <const Instruction*> &fromMe, 
     vector <const Instruction*> *toMe, const unordered_set <size_t> &removal, 
-    const unordered_map <size_t, RewriteInfo> &rewrite, size_t tempReg);
-
-// re-write the map of blocks to the destination vector of instructions
-void writeInstsBack (const unordered_map <string, vector <const Instruction*>> &instMap, 
-    vector <const Instruction*> *toMe, const vector <string> &order, 
-    const unordered_map <string, string> &dependency);
+    const unordered_map <size_t, RewriteInfo> &rewrite, 
+    const unordered_map <size_t, FoldInfo> &folded, size_t tempReg);
 
 // get the # of next unused register
 size_t nextUnusedReg (const vector <const Instruction*> &fromMe);
@@ -126,4 +242,7 @@ size_t nextUnusedReg (const vector <const Instruction*> &fromMe);
 // translate encapsulated structure to ILOC code
 string translate (const Instruction* me);
 
+// translate a group of operations issued together, labeled by the first
+string translate (const vector <const Instruction*> &group);
+
 #endif  // UTIL_H_
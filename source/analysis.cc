@@ -0,0 +1,490 @@
+#include <algorithm>
+
+#include "../headers/analysis.h"
+#include "../headers/optim.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+FlowGraph :: FlowGraph (const vector <size_t> &leadIn, const vector <size_t> &lastIn,
+    const vector <pair <size_t, size_t>> &edges) : lead (leadIn), last (lastIn) {
+
+    succ.resize (lead.size ());
+    pred.resize (lead.size ());
+
+    for (const auto &e : edges)
+        addEdge (blockOf (e.first), blockOf (e.second));
+}
+
+size_t FlowGraph :: blockOf (size_t line) const {
+    // the leads are sorted, so find the last lead not after #line
+    auto it = upper_bound (lead.begin (), lead.end (), line);
+    return (it - lead.begin ()) - 1;
+}
+
+void FlowGraph :: addEdge (size_t from, size_t to) {
+    if (find (succ[from].begin (), succ[from].end (), to) != succ[from].end ())
+        return;
+    succ[from].push_back (to);
+    pred[to].push_back (from);
+}
+
+DominatorTree :: DominatorTree (const FlowGraph &graph) : entry (0) {
+    build (graph.succ, graph.pred);
+}
+
+DominatorTree :: DominatorTree (const vector <vector <size_t>> &succ,
+    const vector <vector <size_t>> &pred, size_t entryIn) : entry (entryIn) {
+    build (succ, pred);
+}
+
+void DominatorTree :: build (const vector <vector <size_t>> &succ,
+    const vector <vector <size_t>> &pred) {
+
+    size_t num = succ.size ();
+    idom.assign (num, noBlock);
+    children.assign (num, vector <size_t> ());
+    frontier.assign (num, vector <size_t> ());
+
+    // iterative depth first search to get the post order
+    vector <size_t> postOrder;
+    vector <size_t> visited (num, 0);
+    vector <pair <size_t, size_t>> stack {make_pair (entry, 0)};
+    visited[entry] = 1;
+
+    while (stack.size ()) {
+        auto &top = stack.back ();
+        if (top.second < succ[top.first].size ()) {
+            size_t next = succ[top.first][top.second++];
+            if (!visited[next]) {
+                visited[next] = 1;
+                stack.push_back (make_pair (next, 0));
+            }
+        }
+        else {
+            postOrder.push_back (top.first);
+            stack.pop_back ();
+        }
+    }
+
+    order.assign (postOrder.rbegin (), postOrder.rend ());
+
+    // maps block to its position in post order, used to intersect
+    vector <size_t> postPos (num, noBlock);
+    for (size_t i = 0; i < postOrder.size (); i++)
+        postPos[postOrder[i]] = i;
+
+    // walk up from both fingers until they meet
+    auto intersect = [&] (size_t a, size_t b) {
+        while (a != b) {
+            while (postPos[a] < postPos[b])
+                a = idom[a];
+            while (postPos[b] < postPos[a])
+                b = idom[b];
+        }
+        return a;
+    };
+
+    idom[entry] = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b : order) {
+            if (b == entry)
+                continue;
+
+            size_t newIdom = noBlock;
+            for (size_t p : pred[b]) {
+                // skip the predecessors not processed yet
+                if (idom[p] == noBlock)
+                    continue;
+                newIdom = (newIdom == noBlock) ? p : intersect (p, newIdom);
+            }
+
+            if (idom[b] != newIdom) {
+                idom[b] = newIdom;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t b : order) {
+        if (b != entry)
+            children[idom[b]].push_back (b);
+    }
+
+    // number the dominator tree, so that dominance is an interval test
+    preNum.assign (num, 0);
+    postNum.assign (num, 0);
+    levels.assign (num, 0);
+
+    size_t counter = 0;
+    stack.assign (1, make_pair (entry, 0));
+    preNum[entry] = counter++;
+
+    while (stack.size ()) {
+        auto &top = stack.back ();
+        if (top.second < children[top.first].size ()) {
+            size_t next = children[top.first][top.second++];
+            preNum[next] = counter++;
+            levels[next] = levels[top.first] + 1;
+            stack.push_back (make_pair (next, 0));
+        }
+        else {
+            postNum[top.first] = counter++;
+            stack.pop_back ();
+        }
+    }
+
+    // dominance frontiers, walk up from each predecessor of a join point
+    for (size_t b : order) {
+        if (pred[b].size () < 2)
+            continue;
+
+        for (size_t p : pred[b]) {
+            if (idom[p] == noBlock)
+                continue;
+
+            size_t runner = p;
+            while (runner != idom[b]) {
+                // 'b' is the last block added, so this avoids duplicates
+                if (frontier[runner].empty () || frontier[runner].back () != b)
+                    frontier[runner].push_back (b);
+
+                if (runner == entry)
+                    break;
+                runner = idom[runner];
+            }
+        }
+    }
+}
+
+bool DominatorTree :: dominates (size_t a, size_t b) const {
+    if (idom[a] == noBlock || idom[b] == noBlock)
+        return false;
+    return preNum[a] <= preNum[b] && postNum[b] <= postNum[a];
+}
+
+LoopForest :: LoopForest (const FlowGraph &graph) {
+    size_t num = graph.size ();
+    loopOf.assign (num, noBlock);
+
+    // depth first search to number blocks in pre-order
+    // 'last' is the largest number in the subtree of each block
+    vector <size_t> number (num, noBlock), nodes, last;
+    vector <pair <size_t, size_t>> stack {make_pair (0, 0)};
+    number[0] = 0;
+    nodes.push_back (0);
+    last.push_back (0);
+
+    while (stack.size ()) {
+        auto &top = stack.back ();
+        const auto &succ = graph.succ[top.first];
+        if (top.second < succ.size ()) {
+            size_t next = succ[top.second++];
+            if (number[next] == noBlock) {
+                number[next] = nodes.size ();
+                nodes.push_back (next);
+                last.push_back (0);
+                stack.push_back (make_pair (next, 0));
+            }
+        }
+        else {
+            last[number[top.first]] = nodes.size () - 1;
+            stack.pop_back ();
+        }
+    }
+
+    size_t size = nodes.size ();
+    auto isAncestor = [&] (size_t w, size_t v) {
+        return w <= v && v <= last[w];
+    };
+
+    // split predecessors into back edges and the others
+    vector <vector <size_t>> backPreds (size), nonBackPreds (size);
+    for (size_t w = 0; w < size; w++) {
+        for (size_t p : graph.pred[nodes[w]]) {
+            size_t v = number[p];
+            if (v == noBlock)
+                continue;
+            if (isAncestor (w, v))
+                backPreds[w].push_back (v);
+            else nonBackPreds[w].push_back (v);
+        }
+    }
+
+    // union find, where each set is named after its loop header
+    vector <size_t> unionFind (size);
+    for (size_t i = 0; i < size; i++)
+        unionFind[i] = i;
+
+    auto findSet = [&] (size_t x) {
+        size_t root = x;
+        while (unionFind[root] != root)
+            root = unionFind[root];
+        while (unionFind[x] != root) {
+            size_t next = unionFind[x];
+            unionFind[x] = root;
+            x = next;
+        }
+        return root;
+    };
+
+    // maps the pre-order number of header to its loop
+    vector <size_t> headerLoop (size, noBlock);
+
+    // blocks directly in each loop, i.e. not in a nested loop
+    vector <vector <size_t>> direct;
+
+    // whether a block is in the loop being built, cleared after each header
+    vector <char> inPool (size, 0);
+
+    // visit headers from inner to outer
+    for (size_t w = size; w-- > 0; ) {
+        vector <size_t> nodePool;
+        bool self = false, reducible = true;
+
+        for (size_t v : backPreds[w]) {
+            if (v == w) {
+                self = true;
+                continue;
+            }
+            size_t x = findSet (v);
+            if (!inPool[x]) {
+                inPool[x] = 1;
+                nodePool.push_back (x);
+            }
+        }
+
+        // grow the loop body backward along the other edges
+        vector <size_t> workList (nodePool);
+        while (workList.size ()) {
+            size_t x = workList.back ();
+            workList.pop_back ();
+
+            for (size_t y : nonBackPreds[x]) {
+                size_t ydash = findSet (y);
+
+                // entering the loop without passing the header
+                if (!isAncestor (w, ydash)) {
+                    reducible = false;
+                    nonBackPreds[w].push_back (ydash);
+                }
+
+                else if (ydash != w && !inPool[ydash]) {
+                    inPool[ydash] = 1;
+                    nodePool.push_back (ydash);
+                    workList.push_back (ydash);
+                }
+            }
+        }
+        for (size_t x : nodePool)
+            inPool[x] = 0;
+
+        if (nodePool.empty () && !self)
+            continue;
+
+        size_t index = loops.size ();
+        loops.push_back (LoopNest (nodes[w]));
+        loops.back ().reducible = reducible;
+        direct.push_back (vector <size_t> ());
+        headerLoop[w] = index;
+
+        for (size_t x : nodePool) {
+            unionFind[x] = w;
+
+            // a nested header stands for its whole loop
+            if (headerLoop[x] != noBlock)
+                loops[headerLoop[x]].parent = index;
+            else direct[index].push_back (nodes[x]);
+        }
+    }
+
+    // collect blocks, nested loops are finished before their parents
+    for (size_t i = 0; i < loops.size (); i++) {
+        LoopNest &loop = loops[i];
+        loop.blocks.push_back (loop.header);
+        loopOf[loop.header] = i;
+
+        for (size_t b : direct[i]) {
+            loop.blocks.push_back (b);
+            loopOf[b] = i;
+        }
+
+        for (size_t j = 0; j < i; j++) {
+            if (loops[j].parent != i)
+                continue;
+            loop.children.push_back (j);
+            loop.blocks.insert (loop.blocks.end (),
+                loops[j].blocks.begin (), loops[j].blocks.end ());
+        }
+
+        if (loop.parent == noBlock)
+            roots.push_back (i);
+    }
+
+    // depth goes from outer to inner loops
+    for (size_t i = loops.size (); i-- > 0; ) {
+        if (loops[i].parent != noBlock)
+            loops[i].depth = loops[loops[i].parent].depth + 1;
+    }
+
+    // find latches, entries, exits and preheader of each loop
+    for (size_t i = 0; i < loops.size (); i++) {
+        LoopNest &loop = loops[i];
+        vector <size_t> outside;
+
+        for (size_t b : loop.blocks) {
+            bool entry = false;
+            for (size_t p : graph.pred[b]) {
+                if (number[p] == noBlock)
+                    continue;
+                if (!contains (i, p)) {
+                    entry = true;
+                    if (b == loop.header)
+                        outside.push_back (p);
+                }
+                else if (b == loop.header)
+                    loop.latches.push_back (p);
+            }
+            if (entry)
+                loop.entries.push_back (b);
+
+            for (size_t s : graph.succ[b]) {
+                if (!contains (i, s))
+                    loop.exits.push_back (make_pair (b, s));
+            }
+        }
+
+        if (loop.reducible && outside.size () == 1 &&
+            graph.succ[outside[0]].size () == 1)
+            loop.preheader = outside[0];
+    }
+}
+
+bool LoopForest :: contains (size_t loop, size_t block) const {
+    for (size_t l = loopOf[block]; l != noBlock; l = loops[l].parent) {
+        if (l == loop)
+            return true;
+    }
+    return false;
+}
+
+size_t LoopForest :: depth (size_t block) const {
+    size_t loop = loopOf[block];
+    return (loop == noBlock) ? 0 : loops[loop].depth;
+}
+
+void BitVector :: fill () {
+    for (uint64_t &word : words)
+        word = ~uint64_t (0);
+    if (bits & 63)
+        words.back () &= (uint64_t (1) << (bits & 63)) - 1;
+}
+
+bool BitVector :: any () const {
+    for (uint64_t word : words) {
+        if (word)
+            return true;
+    }
+    return false;
+}
+
+size_t BitVector :: count () const {
+    size_t res = 0;
+    for (uint64_t word : words)
+        res += __builtin_popcountll (word);
+    return res;
+}
+
+BitVector& BitVector :: operator|= (const BitVector &other) {
+    for (size_t i = 0; i < words.size (); i++)
+        words[i] |= other.words[i];
+    return *this;
+}
+
+BitVector& BitVector :: operator&= (const BitVector &other) {
+    for (size_t i = 0; i < words.size (); i++)
+        words[i] &= other.words[i];
+    return *this;
+}
+
+BitVector& BitVector :: subtract (const BitVector &other) {
+    for (size_t i = 0; i < words.size (); i++)
+        words[i] &= ~other.words[i];
+    return *this;
+}
+
+Liveness :: Liveness (const vector <vector <const Instruction*>> &blocks,
+    const vector <vector <size_t>> &succ, size_t numRegs) {
+
+    size_t num = blocks.size ();
+    liveIn.assign (num, BitVector (numRegs));
+    liveOut.assign (num, BitVector (numRegs));
+
+    // upward exposed uses and definitions of each block
+    vector <BitVector> upward (num, BitVector (numRegs)), killed (num, BitVector (numRegs));
+    for (size_t b = 0; b < num; b++) {
+        for (const Instruction *inst : blocks[b]) {
+            vector <size_t> uses;
+            usedRegs (inst->op, &uses);
+            for (size_t reg : uses) {
+                if (!killed[b].test (reg))
+                    upward[b].set (reg);
+            }
+
+            size_t reg;
+            if (definedReg (inst->op, &reg))
+                killed[b].set (reg);
+        }
+    }
+
+    // iterate backward until nothing changes
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = num; b-- > 0; ) {
+            BitVector out (numRegs);
+            for (size_t s : succ[b])
+                out |= liveIn[s];
+
+            BitVector in = out;
+            in.subtract (killed[b]);
+            in |= upward[b];
+
+            if (in != liveIn[b] || out != liveOut[b]) {
+                liveIn[b] = std::move (in);
+                liveOut[b] = std::move (out);
+                changed = true;
+            }
+        }
+    }
+}
+
+void splitBlocks (const vector <const Instruction*> &fromMe, const FlowGraph &graph,
+    vector <vector <const Instruction*>> *toMe) {
+
+    toMe->assign (graph.size (), vector <const Instruction*> ());
+    for (size_t b = 0; b < graph.size (); b++) {
+        for (size_t i = graph.lead[b]; i <= graph.last[b]; i++)
+            (*toMe)[b].push_back (new Instruction (fromMe[i]));
+    }
+}
+
+void joinBlocks (vector <vector <const Instruction*>> &fromMe,
+    const vector <size_t> &layout, vector <const Instruction*> *toMe) {
+
+    vector <char> written (fromMe.size (), 0);
+    for (size_t b : layout) {
+        toMe->insert (toMe->end (), fromMe[b].begin (), fromMe[b].end ());
+        fromMe[b].clear ();
+        written[b] = 1;
+    }
+
+    // blocks left out of layout are dropped
+    for (size_t b = 0; b < fromMe.size (); b++) {
+        if (!written[b])
+            freeMemory (fromMe[b]);
+        fromMe[b].clear ();
+    }
+}
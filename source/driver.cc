@@ -1,7 +1,10 @@
+#include <cstring>
 #include <iostream>
 
 #include "../headers/struct.h"
 #include "../headers/optim.h"
+#include "../headers/ssa.h"
+#include "../headers/util.h"
 
 using namespace std;
 
@@ -12,37 +15,96 @@ extern "C" int yyparse (Instructions **);
 
 int main (int argc, char** argv) {
 
-    string error = "Incorrect input format.\n./opt [-v][-u][-i] file.i\n";
+    string error = "Incorrect input format.\n./opt [-v][-V][-s][-c][-d][-D][-g][-p][-a][-u [N]][-i][-o][-j [N]][-r][-w][-m][-k N][-y [N]][-l][-L][-e][-b][-t op=N,...][-f unit=N,...] file.i\n";
     string number = "-v: value numbering\n";
-    string unroll = "-u: loop unrolling\n";
+    string global = "-V: dominator-based value numbering\n";
+    string ssa = "-s: SSA construction and destruction\n";
+    string constant = "-c: sparse conditional constant propagation\n";
+    string dead = "-d: aggressive dead code elimination\n";
+    string stores = "-D: dead store elimination\n";
+    string widening = "-g: widening of byte loads and stores into word operations\n";
+    string partial = "-p: partial redundancy elimination\n";
+    string reassociate = "-a: reassociation\n";
+    string unroll = "-u N: loop unrolling by a factor of N, chosen for each loop by default\n";
     string motion = "-i: loop-invariant code motion\n";
+    string reduction = "-o: operator strength reduction\n";
+    string jam = "-j N: unroll-and-jam by a factor of N, 2 by default\n";
+    string rotation = "-r: loop rotation\n";
+    string unswitching = "-w: loop unswitching\n";
+    string pipelining = "-m: software pipelining by modulo scheduling\n";
+    string allocation = "-k N: register allocation to N registers\n";
+    string copies = "-y N: copy propagation and coalescing for N registers, as many as are live at once by default\n";
+    string scheduling = "-l: list scheduling of blocks\n";
+    string superblocks = "-L: list scheduling of superblocks\n";
+    string peephole = "-e: peephole optimization\n";
+    string bundles = "-b: packing of operations into groups issued together\n";
+    string latencies = "-t op=N,...: set the latency of opcodes for every pass\n";
+    string machine = "-f unit=N,...: set the width, memory and multiply units of the machine for every pass\n";
+    string usage = error + number + global + ssa + constant + dead + stores + widening + partial + reassociate +
+        unroll + motion + reduction + jam + rotation + unswitching + pipelining + allocation + copies +
+        scheduling + superblocks + peephole + bundles + latencies + machine;
 
-    if (argc < 3 || argc > 5) {
-        cout << (error + number + unroll + motion);
+    if (argc < 3) {
+        cout << usage;
         exit (0);
     }
 
-    vector <string> options;
+    vector <pair <string, size_t>> options;
     for (size_t i = 1; i < argc - 1; i++) {
         string option = string (argv[i]);
         
-        if (option != "-v" && option != "-u" && option != "-i") {
-            cout << (error + number + unroll + motion);
+        if (option != "-v" && option != "-V" && option != "-s" && option != "-c" && 
+            option != "-d" && option != "-D" && option != "-g" && option != "-p" &&
+            option != "-a" && option != "-u" && option != "-i" && option != "-o" && option != "-j" && option != "-r" &&
+            option != "-w" && option != "-m" && option != "-k" && option != "-y" &&
+            option != "-l" && option != "-L" && option != "-t" && option != "-b" && option != "-e" &&
+            option != "-f") {
+            cout << usage;
             exit (0);
         }
 
-        if (option == "-i") {
-            cout << "-i: code motion not implemented\n";
-            exit (0);
+        // '-t' is followed by the latencies, and '-f' by the units of the
+        // machine, which hold for every pass
+        if (option == "-t" || option == "-f") {
+            bool valid = i + 1 < (size_t) argc - 1;
+            string spec = valid ? string (argv[++i]) : "";
+            for (size_t start = 0; valid && start < spec.size ();) {
+                size_t end = spec.find (',', start), equal = spec.find ('=', start);
+                if (end == string::npos)
+                    end = spec.size ();
+                string value = equal < end ? spec.substr (equal + 1, end - equal - 1) : "";
+                string name = spec.substr (start, equal - start);
+                valid = value.size () && value.find_first_not_of ("0123456789") == string::npos &&
+                    (option == "-t" ? setLatency (name, stoul (value)) : setMachine (name, stoul (value)));
+                start = end + 1;
+            }
+            if (!valid) {
+                cout << usage;
+                exit (0);
+            }
+            continue;
         }
-        
-        else options.push_back (option);
+
+        // '-u' and '-j' may be followed by the unrolling factor, '-k' must
+        // and '-y' may be followed by the number of registers
+        size_t arg = option == "-j" ? 2 : 0;
+        if (option == "-u" || option == "-j" || option == "-k" || option == "-y") {
+            if (i + 1 < (size_t) argc - 1 && strlen (argv[i + 1]) > 0 &&
+                strspn (argv[i + 1], "0123456789") == strlen (argv[i + 1]))
+                arg = stoul (string (argv[++i]));
+            else if (option == "-k") {
+                cout << usage;
+                exit (0);
+            }
+        }
+
+        options.push_back (make_pair (option, arg));
     }
 
     char* filename = argv[argc - 1];
 
     if (strlen (filename) == 2 && filename[0] == '-') {
-        cout << (error + number + unroll + motion);
+        cout << usage;
         exit (0);
     }
 
@@ -66,10 +128,17 @@ int main (int argc, char** argv) {
     vector <const Instruction*> insts = final->insts;
 
     vector <const Instruction*> src, dst;
-    for (const Instruction* inst : insts)
-        src.push_back (new Instruction (inst));
+    for (const Instruction* inst : insts) {
+        Instruction *copy = new Instruction (inst);
+        copy->bundled = inst->bundled;
+        src.push_back (copy);
+    }
+
+    for (const auto &entry : options) {
+        const string &option = entry.first;
 
-    for (const auto &option : options) {
+        // passes work on one operation at a time, groups are packed again by '-b'
+        ungroupInstructions (src);
         
         if (option == "-v") {
             vector <size_t> lead, last;
@@ -81,17 +150,208 @@ int main (int argc, char** argv) {
             src = std::move (dst);
         }
 
+        else if (option == "-V") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            dominatorValueNumbering (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-s") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+
+            SSAForm form;
+            buildSSA (src, lead, last, edges, &form);
+            destroySSA (form, &dst);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-c") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            constantPropagation (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-d") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            deadCodeElimination (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-D") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            deadStoreElimination (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-g") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            byteWidening (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-p") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            partialRedundancyElimination (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-a") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            reassociation (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
         else if (option == "-u") {
             vector <size_t> lead, last;
             vector <pair <size_t, size_t>> edges;
             buildCFG (src, &lead, &last, &edges);
-            loopUnrolling (src, &dst, lead, last, edges);
+            loopUnrolling (src, &dst, lead, last, edges, entry.second);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-i") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            loopInvariantCodeMotion (src, &dst, lead, last, edges);
 
             freeMemory (src);
             src = std::move (dst);
         }
 
-        else if (option == "-i") {}
+        else if (option == "-o") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            strengthReduction (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-j") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            unrollAndJam (src, &dst, lead, last, edges, entry.second);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-r") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            loopRotation (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-w") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            loopUnswitching (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-m") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            softwarePipelining (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-k") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            registerAllocation (src, &dst, lead, last, edges, entry.second);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-y") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            copyPropagation (src, &dst, lead, last, edges, entry.second);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-l" || option == "-L") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            listScheduling (src, &dst, lead, last, edges, option == "-L");
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-e") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            peepholeOptimization (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
+
+        else if (option == "-b") {
+            vector <size_t> lead, last;
+            vector <pair <size_t, size_t>> edges;
+            buildCFG (src, &lead, &last, &edges);
+            bundlePacking (src, &dst, lead, last, edges);
+
+            freeMemory (src);
+            src = std::move (dst);
+        }
     }
 
     generateCode (src, yyout);
@@ -86,6 +86,8 @@
 %type <myStmts> Procedure
 %type <myStmts> Instructions
 %type <myStmt> Instruction
+%type <myStmts> Group
+%type <myStmts> Operations
 %type <myOp> Operation
 
 %%
@@ -107,6 +109,39 @@ Instructions
         {
             $$ = makeInstructions ($1);
         }
+    | Instructions Group
+        {
+            $$ = $1;
+            appendInstructions ($$, $2);
+        }
+    | Group
+        {
+            $$ = $1;
+        }
+    ;
+
+Group
+    : LABEL ':' '[' Operations ']'
+        {
+            $$ = $4;
+            labelInstructions ($$, $1);
+        }
+    | '[' Operations ']'
+        {
+            $$ = $2;
+        }
+    ;
+
+Operations
+    : Operations ';' Operation
+        {
+            $$ = $1;
+            appendInstruction ($$, makeBundled ($3));
+        }
+    | Operation
+        {
+            $$ = makeInstructions (makeInstruction (NULL, $1));
+        }
     ;
 
 Instruction
@@ -0,0 +1,2964 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../headers/analysis.h"
+#include "../headers/optim.h"
+#include "../headers/ssa.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+void insertPreheaders (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, unordered_set <string> *created) {
+
+    FlowGraph graph (lead, last, edges);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+
+    LabelMaker maker (fromMe);
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+
+    for (size_t l = 0; l < forest.loops.size (); l++) {
+        const LoopNest &loop = forest.loops[l];
+        if (!loop.reducible || loop.preheader != noBlock)
+            continue;
+
+        size_t h = loop.header;
+        string header (blocks[h][0]->label);
+        string label = maker.make ("PH");
+        if (created != nullptr)
+            created->insert (label);
+
+        // branches from outside now lead to the preheader
+        for (size_t p : graph.pred[h]) {
+            OpCode code = blocks[p].back ()->op->code;
+            if (!forest.contains (l, p) &&
+                (code == OpCode::br_ || code == OpCode::cbr_))
+                retarget (blocks[p].back (), header, label);
+        }
+
+        // the preheader falls into header, so the block falling
+        // into header from inside the loop has to jump instead
+        size_t pos = find (layout.begin (), layout.end (), h) - layout.begin ();
+        if (pos > 0) {
+            size_t p = layout[pos - 1];
+            OpCode code = blocks[p].back ()->op->code;
+            if (forest.contains (l, p) &&
+                code != OpCode::br_ && code != OpCode::cbr_)
+                blocks[p].push_back (new Instruction (nullptr, new Operation (
+                    OpCode::br_, 0, 0, 0, 0, header.c_str ())));
+        }
+
+        blocks.push_back (vector <const Instruction*> {new Instruction (label.c_str ())});
+        layout.insert (layout.begin () + pos, blocks.size () - 1);
+    }
+
+    joinBlocks (blocks, layout, toMe);
+}
+
+// a memory access at constant offset from a base register
+struct Access {
+    size_t base, offset, width;
+    bool known;
+};
+
+static Access accessOf (const Operation *op) {
+    switch (op->code) {
+        case OpCode::load_: return Access {op->reg0, 0, 4, true};
+        case OpCode::loadAI_: return Access {op->reg0, op->constant, 4, true};
+        case OpCode::cload_: return Access {op->reg0, 0, 1, true};
+        case OpCode::cloadAI_: return Access {op->reg0, op->constant, 1, true};
+        case OpCode::store_: return Access {op->reg1, 0, 4, true};
+        case OpCode::storeAI_: return Access {op->reg1, op->constant, 4, true};
+        case OpCode::cstore_: return Access {op->reg1, 0, 1, true};
+        case OpCode::cstoreAI_: return Access {op->reg1, op->constant, 1, true};
+        default: return Access {0, 0, 0, false};
+    }
+}
+
+// whether two accesses cannot touch the same byte, it is only
+// known when both use the same base register which is not changed
+static bool disjoint (const Access &a, const Access &b) {
+    if (!a.known || !b.known || a.base != b.base)
+        return false;
+    return a.offset + a.width <= b.offset || b.offset + b.width <= a.offset;
+}
+
+// help to drop the preheaders created in vain, which still only fall into
+// the next block of layout, branches to them go to that block instead
+static void dropPreheaders (vector <vector <const Instruction*>> &blocks,
+    vector <size_t> *layout, const unordered_set <string> &created) {
+
+    vector <size_t> newLayout;
+    for (size_t pos = 0; pos < layout->size (); pos++) {
+        size_t b = (*layout)[pos];
+        if (blocks[b].size () > 1 || blocks[b][0]->label == nullptr || pos + 1 == layout->size () ||
+            created.find (string (blocks[b][0]->label)) == created.end ()) {
+            newLayout.push_back (b);
+            continue;
+        }
+
+        string label (blocks[b][0]->label);
+        string next (blocks[(*layout)[pos + 1]][0]->label);
+        for (auto &block : blocks) {
+            if (block.empty ())
+                continue;
+            OpCode code = block.back ()->op->code;
+            if (code == OpCode::br_ || code == OpCode::cbr_)
+                retarget (block.back (), label, next);
+        }
+
+        // a jump added before the preheader now goes to the next block
+        if (newLayout.size ()) {
+            auto &prev = blocks[newLayout.back ()];
+            const Operation *op = prev.back ()->op;
+            if (op->code == OpCode::br_ && next == op->label1 && prev.size () > 1) {
+                delete prev.back ();
+                prev.pop_back ();
+            }
+        }
+    }
+    *layout = std::move (newLayout);
+}
+
+void loopInvariantCodeMotion (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    // every reducible loop gets a preheader first
+    vector <const Instruction*> code;
+    unordered_set <string> created;
+    insertPreheaders (fromMe, &code, lead, last, edges, &created);
+
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (code, &newLead, &newLast, &newEdges);
+
+    FlowGraph graph (newLead, newLast, newEdges);
+    DominatorTree dom (graph);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (code, graph, &blocks);
+    freeMemory (code);
+
+    size_t numRegs = nextUnusedReg (fromMe);
+
+    // loops are visited inner first, so that what is hoisted into the
+    // preheader of inner loop may be hoisted again out of outer loop
+    for (size_t l = 0; l < forest.loops.size (); l++) {
+        const LoopNest &loop = forest.loops[l];
+        if (!loop.reducible || loop.preheader == noBlock)
+            continue;
+
+        size_t h = loop.header, ph = loop.preheader;
+        Liveness live (blocks, graph.succ, numRegs);
+
+        // registers live after the loop
+        BitVector liveOut (numRegs);
+        for (const auto &e : loop.exits)
+            liveOut |= live.liveIn[e.second];
+
+        vector <size_t> defCount (numRegs, 0);
+        vector <Access> stores;
+        for (size_t b : loop.blocks) {
+            for (const Instruction *inst : blocks[b]) {
+                size_t reg;
+                if (definedReg (inst->op, &reg))
+                    defCount[reg]++;
+
+                OpCode code = inst->op->code;
+                if (code >= OpCode::store_ && code <= OpCode::cstoreAO_)
+                    stores.push_back (accessOf (inst->op));
+            }
+        }
+
+        // whether the operation is executed before leaving the loop
+        auto guaranteed = [&] (size_t b) {
+            if (loop.exits.empty ())
+                return false;
+            for (const auto &e : loop.exits) {
+                if (!dom.dominates (b, e.first))
+                    return false;
+            }
+            return true;
+        };
+
+        // visit blocks in reverse post order so that definitions come first
+        vector <size_t> order;
+        for (size_t b : dom.order) {
+            if (forest.contains (l, b))
+                order.push_back (b);
+        }
+
+        vector <const Instruction*> hoisted;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+
+            for (size_t b : order) {
+                for (size_t i = 0; i < blocks[b].size (); i++) {
+                    const Operation *op = blocks[b][i]->op;
+                    size_t key = opcodeMap[op->code - OpCode::nop_];
+
+                    // 'read' has side effect, others do not write register
+                    if (key == 9 || op->code == OpCode::read_ || op->code == OpCode::cread_)
+                        continue;
+
+                    // the only definition in loop, with no value flowing in
+                    size_t dst = op->reg2;
+                    if (defCount[dst] != 1 || live.liveIn[h].test (dst))
+                        continue;
+
+                    vector <size_t> uses;
+                    usedRegs (op, &uses);
+                    bool invariant = true;
+                    for (size_t reg : uses)
+                        invariant = invariant && defCount[reg] == 0;
+                    if (!invariant)
+                        continue;
+
+                    // loads must not be changed by any store in loop
+                    bool load = key == 3;
+                    if (load) {
+                        Access access = accessOf (op);
+                        for (const Access &store : stores)
+                            invariant = invariant && disjoint (access, store);
+                        if (!invariant)
+                            continue;
+                    }
+
+                    // an operation that may not execute is hoisted only when it
+                    // cannot fault and its result is not used after the loop
+                    bool fault = load || op->code == OpCode::div_ ||
+                        (op->code == OpCode::divI_ && op->constant == 0);
+                    if (!guaranteed (b) && (fault || liveOut.test (dst)))
+                        continue;
+
+                    const Instruction *inst = blocks[b][i];
+                    hoisted.push_back (new Instruction (nullptr, new Operation (
+                        op->code, op->reg0, op->reg1, op->reg2, op->constant)));
+
+                    // keep the label with a 'nop'
+                    if (inst->label != nullptr)
+                        blocks[b][i] = new Instruction (inst->label);
+                    else blocks[b].erase (blocks[b].begin () + i--);
+                    delete inst;
+
+                    defCount[dst] = 0;
+                    changed = true;
+                }
+            }
+        }
+
+        // put the hoisted operations before the jump of preheader
+        auto &preheader = blocks[ph];
+        OpCode code = preheader.back ()->op->code;
+        auto at = preheader.end ();
+        if (code == OpCode::br_ || code == OpCode::cbr_)
+            at--;
+        preheader.insert (at, hoisted.begin (), hoisted.end ());
+    }
+
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+    dropPreheaders (blocks, &layout, created);
+
+    joinBlocks (blocks, layout, toMe);
+}
+
+static OpCode swapTest (OpCode code) {
+    switch (code) {
+        case OpCode::cmp_LT_: return OpCode::cmp_GT_;
+        case OpCode::cmp_LE_: return OpCode::cmp_GE_;
+        case OpCode::cmp_GT_: return OpCode::cmp_LT_;
+        case OpCode::cmp_GE_: return OpCode::cmp_LE_;
+        default: return code;
+    }
+}
+
+static OpCode negateTest (OpCode code) {
+    switch (code) {
+        case OpCode::cmp_LT_: return OpCode::cmp_GE_;
+        case OpCode::cmp_LE_: return OpCode::cmp_GT_;
+        case OpCode::cmp_GT_: return OpCode::cmp_LE_;
+        case OpCode::cmp_GE_: return OpCode::cmp_LT_;
+        case OpCode::cmp_EQ_: return OpCode::cmp_NE_;
+        default: return OpCode::cmp_EQ_;
+    }
+}
+
+// an operand of strength reduction, either a name or a constant
+struct Operand {
+    bool constant;
+    size_t value;
+};
+
+// operator strength reduction by Cooper, Simpson and Vick on SSA form,
+// names are visited as strongly connected components of the SSA graph
+// so that operands are classified before the names computed from them
+struct StrengthReduction {
+    SSAForm &form;
+    DominatorTree dom;
+
+    // the block of phi function where induction variable of each name
+    // starts, or noBlock if the name is not an induction variable
+    vector <size_t> header;
+
+    // where each name is defined, the instruction or the phi function
+    vector <size_t> defBlock;
+    vector <const Instruction*> defInst;
+    vector <size_t> defPhi;
+
+    // the strongly connected component of each induction variable found,
+    // noBlock for names computed from one
+    vector <size_t> componentOf;
+    vector <vector <size_t>> components;
+
+    // the reduced name each name replaced by strength reduction copies
+    unordered_map <size_t, size_t> copyOf;
+
+    // reduced names by opcode, name and operand, with the opcode to build them
+    unordered_map <string, size_t> reduced;
+    vector <vector <pair <OpCode, Operand>>> reducedBy;
+    vector <vector <size_t>> reducedTo;
+
+    // state of Tarjan's algorithm
+    vector <size_t> number, low;
+    vector <char> onStack;
+    vector <size_t> stack;
+    size_t counter;
+
+    StrengthReduction (SSAForm &f);
+
+    void operandsOf (size_t name, vector <size_t> *operands) const;
+    bool regionConstant (size_t name, size_t block, Operand *res) const;
+
+    void visit (size_t name);
+    void process (const vector <size_t> &component);
+
+    size_t newName (size_t block, const Instruction *inst);
+    void insertAfter (size_t block, const Instruction *after, Instruction *inst);
+    size_t apply (OpCode code, Operand lhs, Operand rhs, size_t block);
+    size_t reduce (OpCode code, size_t iv, Operand rc);
+
+    bool bounds (size_t iv, OpCode test, long long bound, long long *lo, long long *hi) const;
+    bool continues (size_t block, const Operation *cmp, size_t h, OpCode *test) const;
+    void replaceTests ();
+    void propagateCopies ();
+};
+
+StrengthReduction :: StrengthReduction (SSAForm &f) :
+    form (f), dom (f.succ, f.pred, 0), counter (0) {
+
+    form.buildDefUse ();
+    size_t num = form.numNames ();
+    header.assign (num, noBlock);
+    defBlock.assign (num, noBlock);
+    defInst.assign (num, nullptr);
+    defPhi.assign (num, 0);
+    componentOf.assign (num, noBlock);
+    reducedBy.resize (num);
+    reducedTo.resize (num);
+
+    for (size_t name = 0; name < num; name++) {
+        const SSASite &site = form.defSite[name];
+        defBlock[name] = site.block;
+        if (site.block == noBlock)
+            continue;
+        if (site.phi)
+            defPhi[name] = site.index;
+        else defInst[name] = form.blocks[site.block][site.index];
+    }
+
+    number.assign (num, 0);
+    low.assign (num, 0);
+    onStack.assign (num, 0);
+    for (size_t name = 0; name < num; name++) {
+        if (!number[name] && defBlock[name] != noBlock)
+            visit (name);
+    }
+}
+
+void StrengthReduction :: operandsOf (size_t name, vector <size_t> *operands) const {
+    if (defBlock[name] == noBlock)
+        return;
+    if (defInst[name] == nullptr)
+        *operands = form.phis[defBlock[name]][defPhi[name]].args;
+    else usedRegs (defInst[name]->op, operands);
+}
+
+// a name whose value does not change in the loop starting at block,
+// the constant is used for 'loadI' since it may be defined anywhere
+bool StrengthReduction :: regionConstant (size_t name, size_t block, Operand *res) const {
+    size_t b = defBlock[name];
+    if (b != noBlock && defInst[name] != nullptr && defInst[name]->op->code == OpCode::loadI_) {
+        *res = Operand {true, defInst[name]->op->constant};
+        return true;
+    }
+
+    *res = Operand {false, name};
+    return b == noBlock || (b != block && dom.dominates (b, block));
+}
+
+void StrengthReduction :: visit (size_t name) {
+    number[name] = low[name] = ++counter;
+    stack.push_back (name);
+    onStack[name] = 1;
+
+    vector <size_t> operands;
+    operandsOf (name, &operands);
+    for (size_t o : operands) {
+        if (defBlock[o] == noBlock)
+            continue;
+        if (!number[o]) {
+            visit (o);
+            low[name] = min (low[name], low[o]);
+        }
+        else if (onStack[o])
+            low[name] = min (low[name], number[o]);
+    }
+
+    if (low[name] != number[name])
+        return;
+
+    vector <size_t> component;
+    size_t top;
+    do {
+        top = stack.back ();
+        stack.pop_back ();
+        onStack[top] = 0;
+        component.push_back (top);
+    } while (top != name);
+
+    process (component);
+}
+
+void StrengthReduction :: process (const vector <size_t> &component) {
+    if (component.size () > 1) {
+        // the header is the block of the component met first in the
+        // dominator tree, it must hold a phi function of the component
+        size_t first = component[0];
+        for (size_t name : component) {
+            if (dom.dominates (defBlock[name], defBlock[first]))
+                first = name;
+        }
+
+        size_t h = defBlock[first];
+        unordered_set <size_t> members (component.begin (), component.end ());
+        bool induction = defInst[first] == nullptr && h != 0;
+
+        // an induction variable only adds or subtracts region constants
+        for (size_t name : component) {
+            if (!induction || !dom.dominates (h, defBlock[name])) {
+                induction = false;
+                break;
+            }
+            if (defInst[name] == nullptr) {
+                // a phi function of an inner loop header
+                if (defBlock[name] != h) {
+                    induction = false;
+                    break;
+                }
+                for (size_t arg : form.phis[h][defPhi[name]].args) {
+                    Operand rc;
+                    induction = induction && (members.count (arg) || regionConstant (arg, h, &rc));
+                }
+                continue;
+            }
+
+            const Operation *op = defInst[name]->op;
+            Operand rc;
+            switch (op->code) {
+                case OpCode::add_:
+                    induction = (members.count (op->reg0) && regionConstant (op->reg1, h, &rc)) ||
+                        (members.count (op->reg1) && regionConstant (op->reg0, h, &rc));
+                    break;
+                case OpCode::sub_:
+                    induction = members.count (op->reg0) && regionConstant (op->reg1, h, &rc);
+                    break;
+                case OpCode::addI_: case OpCode::subI_: case OpCode::i2i_:
+                    induction = members.count (op->reg0);
+                    break;
+                default:
+                    induction = false;
+            }
+        }
+
+        if (induction) {
+            for (size_t name : component) {
+                header[name] = h;
+                componentOf[name] = components.size ();
+            }
+            components.push_back (component);
+            return;
+        }
+    }
+
+    for (size_t name : component) {
+        const Instruction *inst = defInst[name];
+        if (inst == nullptr)
+            continue;
+
+        // the candidates compute from an induction variable and a region constant
+        const Operation *op = inst->op;
+        size_t iv = noBlock;
+        Operand rc;
+        switch (op->code) {
+            case OpCode::mult_: case OpCode::add_:
+                if (header[op->reg0] != noBlock && regionConstant (op->reg1, header[op->reg0], &rc))
+                    iv = op->reg0;
+                else if (header[op->reg1] != noBlock && regionConstant (op->reg0, header[op->reg1], &rc))
+                    iv = op->reg1;
+                break;
+            case OpCode::sub_:
+                if (header[op->reg0] != noBlock && regionConstant (op->reg1, header[op->reg0], &rc))
+                    iv = op->reg0;
+                break;
+            case OpCode::multI_: case OpCode::addI_: case OpCode::subI_:
+                if (header[op->reg0] != noBlock) {
+                    iv = op->reg0;
+                    rc = Operand {true, op->constant};
+                }
+                break;
+            case OpCode::i2i_:
+                header[name] = header[op->reg0];
+                break;
+            default: break;
+        }
+
+        if (iv == noBlock)
+            continue;
+
+        OpCode code = op->code;
+        if (code == OpCode::multI_ || code == OpCode::addI_ || code == OpCode::subI_)
+            code = OpCode (code - 1);
+
+        // the name becomes a copy of the reduced induction variable
+        size_t res = reduce (code, iv, rc);
+        size_t b = defBlock[name];
+        auto &block = form.blocks[b];
+        size_t i = find (block.begin (), block.end (), inst) - block.begin ();
+
+        Instruction *copy = new Instruction (inst->label ? strdup (inst->label) : nullptr,
+            new Operation (OpCode::i2i_, res, 0, name));
+        block[i] = copy;
+        defInst[name] = copy;
+        copyOf[name] = res;
+        delete inst;
+        header[name] = header[iv];
+    }
+}
+
+size_t StrengthReduction :: newName (size_t block, const Instruction *inst) {
+    size_t name = form.origReg.size ();
+    form.origReg.push_back (form.nextReg++);
+    header.push_back (noBlock);
+    defBlock.push_back (block);
+    defInst.push_back (inst);
+    defPhi.push_back (0);
+    componentOf.push_back (noBlock);
+    reducedBy.emplace_back ();
+    reducedTo.emplace_back ();
+    return name;
+}
+
+// help to insert instruction after 'after', or before the jump at the
+// end of block if 'after' is nullptr
+void StrengthReduction :: insertAfter (size_t block, const Instruction *after, Instruction *inst) {
+    auto &insts = form.blocks[block];
+    size_t at = insts.size ();
+
+    if (after != nullptr)
+        at = find (insts.begin (), insts.end (), after) - insts.begin () + 1;
+    else {
+        OpCode code = insts.back ()->op->code;
+        if (code == OpCode::br_ || code == OpCode::cbr_)
+            at--;
+    }
+    insts.insert (insts.begin () + at, inst);
+}
+
+// help to compute 'lhs code rhs' at compile time when both are constants
+static bool foldOperands (OpCode code, Operand lhs, Operand rhs, long long *res) {
+    return lhs.constant && rhs.constant &&
+        evaluate (code, (long long) lhs.value, (long long) rhs.value, res) && isEncodable (*res);
+}
+
+// compute 'lhs code rhs' of region constants at the end of block,
+// which is the immediate dominator of the loop header, a constant when
+// both are constants
+size_t StrengthReduction :: apply (OpCode code, Operand lhs, Operand rhs, size_t block) {
+    string key = "A" + to_string (size_t (code)) + "$" + to_string (lhs.constant) + "$" +
+        to_string (lhs.value) + "$" + to_string (rhs.constant) + "$" + to_string (rhs.value) +
+        "$" + to_string (block);
+    auto it = reduced.find (key);
+    if (it != reduced.end ())
+        return it->second;
+
+    long long value;
+    if (foldOperands (code, lhs, rhs, &value)) {
+        Instruction *inst = new Instruction (nullptr, new Operation (OpCode::loadI_, 0, 0, 0, value));
+        size_t name = newName (block, inst);
+        inst->op->reg2 = name;
+        insertAfter (block, nullptr, inst);
+        reduced[key] = name;
+        return name;
+    }
+
+    if (lhs.constant && !rhs.constant && code != OpCode::sub_)
+        swap (lhs, rhs);
+
+    if (lhs.constant) {
+        Instruction *inst = new Instruction (nullptr, new Operation (OpCode::loadI_, 0, 0, 0, lhs.value));
+        size_t name = newName (block, inst);
+        inst->op->reg2 = name;
+        insertAfter (block, nullptr, inst);
+        lhs = Operand {false, name};
+    }
+
+    Instruction *inst = rhs.constant ?
+        new Instruction (nullptr, new Operation (OpCode (code + 1), lhs.value, 0, 0, rhs.value)) :
+        new Instruction (nullptr, new Operation (code, lhs.value, rhs.value, 0));
+    size_t name = newName (block, inst);
+    inst->op->reg2 = name;
+    insertAfter (block, nullptr, inst);
+
+    reduced[key] = name;
+    return name;
+}
+
+// the induction variable computing 'iv code rc' in place of 'iv', its
+// definitions are copies of those of 'iv' with the operands reduced
+size_t StrengthReduction :: reduce (OpCode code, size_t iv, Operand rc) {
+    string key = "R" + to_string (size_t (code)) + "$" + to_string (iv) + "$" +
+        to_string (rc.constant) + "$" + to_string (rc.value);
+    auto it = reduced.find (key);
+    if (it != reduced.end ())
+        return it->second;
+
+    size_t h = header[iv], b = defBlock[iv];
+    size_t pre = dom.idom[h];
+    size_t res = newName (b, nullptr);
+    header[res] = h;
+    reduced[key] = res;
+    reducedBy[iv].push_back (make_pair (code, rc));
+    reducedTo[iv].push_back (res);
+
+    auto transform = [&] (size_t o) {
+        if (header[o] == h)
+            return reduce (code, o, rc);
+        Operand value;
+        regionConstant (o, h, &value);
+        return apply (code, value, rc, pre);
+    };
+
+    if (defInst[iv] == nullptr) {
+        Phi phi {res, form.phis[b][defPhi[iv]].args};
+        defPhi[res] = form.phis[b].size ();
+        form.phis[b].push_back (phi);
+
+        for (size_t k = 0; k < phi.args.size (); k++) {
+            size_t arg = transform (phi.args[k]);
+            form.phis[b][defPhi[res]].args[k] = arg;
+        }
+        return res;
+    }
+
+    // only the operand which is induction variable is reduced for add and
+    // subtract, for multiply the region constant operand is multiplied too
+    const Operation *op = defInst[iv]->op;
+    Operation *copy = new Operation (op->code, op->reg0, op->reg1, res, op->constant);
+
+    if (op->code == OpCode::add_ || op->code == OpCode::sub_) {
+        size_t *other = nullptr;
+        for (size_t *field : {&copy->reg0, &copy->reg1}) {
+            if (header[*field] == h)
+                *field = reduce (code, *field, rc);
+            else other = field;
+        }
+
+        // a constant step becomes the immediate operand when it can
+        Operand value;
+        long long step;
+        if (code == OpCode::mult_ && other != nullptr) {
+            regionConstant (*other, h, &value);
+            if (foldOperands (code, value, rc, &step) && (op->code == OpCode::add_ || other == &copy->reg1)) {
+                copy->code = OpCode (op->code + 1);
+                copy->constant = step;
+                copy->reg0 = other == &copy->reg0 ? copy->reg1 : copy->reg0;
+                copy->reg1 = 0;
+            }
+            else *other = apply (code, value, rc, pre);
+        }
+    }
+    else {
+        copy->reg0 = reduce (code, op->reg0, rc);
+
+        // the constant of 'addI' or 'subI' is multiplied too, as a register
+        // when the product cannot be written in the operation
+        long long step;
+        if (code == OpCode::mult_ && op->code != OpCode::i2i_ &&
+            foldOperands (code, Operand {true, op->constant}, rc, &step))
+            copy->constant = step;
+        else if (code == OpCode::mult_ && op->code != OpCode::i2i_) {
+            copy->code = OpCode (op->code - 1);
+            copy->reg1 = apply (code, Operand {true, op->constant}, rc, pre);
+        }
+    }
+
+    Instruction *inst = new Instruction (nullptr, copy);
+    defInst[res] = inst;
+    insertAfter (b, defInst[iv], inst);
+    return res;
+}
+
+// help to bound the values induction variable takes in its loop, which
+// goes on only while 'iv test bound' holds, from the constants it starts
+// with and its constant steps, all in one direction; false when they are
+// not known or may wrap around
+bool StrengthReduction :: bounds (size_t iv, OpCode test, long long bound,
+    long long *lo, long long *hi) const {
+
+    if (componentOf[iv] == noBlock)
+        return false;
+    const vector <size_t> &component = components[componentOf[iv]];
+    unordered_set <size_t> members (component.begin (), component.end ());
+    size_t h = header[iv];
+
+    long long low = bound, high = bound, up = 0, down = 0;
+    for (size_t name : component) {
+        Operand rc;
+        if (defInst[name] == nullptr) {
+            for (size_t arg : form.phis[defBlock[name]][defPhi[name]].args) {
+                if (members.count (arg))
+                    continue;
+                if (!regionConstant (arg, h, &rc) || !rc.constant || !isEncodable ((long long) rc.value))
+                    return false;
+                low = min (low, (long long) rc.value);
+                high = max (high, (long long) rc.value);
+            }
+            continue;
+        }
+
+        const Operation *op = defInst[name]->op;
+        long long step = (long long) op->constant;
+        switch (op->code) {
+            case OpCode::addI_: case OpCode::subI_: break;
+            case OpCode::add_: case OpCode::sub_:
+                if (!regionConstant (members.count (op->reg0) ? op->reg1 : op->reg0, h, &rc) || !rc.constant)
+                    return false;
+                step = (long long) rc.value;
+                break;
+            case OpCode::i2i_: continue;
+            default: return false;
+        }
+        if (!isEncodable (step))
+            return false;
+        if (op->code == OpCode::addI_ || op->code == OpCode::add_)
+            up += step;
+        else down += step;
+    }
+
+    // a variable going up must stop at the bound from below, and one going
+    // down from above, each at most a round of steps past it
+    if (up && down)
+        return false;
+    if (up && test != OpCode::cmp_LT_ && test != OpCode::cmp_LE_)
+        return false;
+    if (down && test != OpCode::cmp_GT_ && test != OpCode::cmp_GE_)
+        return false;
+
+    *lo = low - down;
+    *hi = high + up;
+    return *lo >= numeric_limits<int>::min () && *hi <= numeric_limits<int>::max ();
+}
+
+// help to tell whether comparison in block decides on every round of the
+// loop at header h whether it goes on, 'test' is set to the comparison
+// under which it does
+bool StrengthReduction :: continues (size_t block, const Operation *cmp, size_t h, OpCode *test) const {
+    const Operation *br = form.blocks[block].back ()->op;
+    if (br->code != OpCode::cbr_ || br->reg0 != cmp->reg2)
+        return false;
+
+    // the blocks of loop, found backward from the branches back to header,
+    // each of which must come after the comparison
+    vector <char> inLoop (form.blocks.size (), 0);
+    bool back = false;
+    vector <size_t> workList;
+    inLoop[h] = 1;
+    for (size_t p : form.pred[h]) {
+        if (!dom.dominates (h, p))
+            continue;
+        if (!dom.dominates (block, p))
+            return false;
+        back = true;
+        if (!inLoop[p]) {
+            inLoop[p] = 1;
+            workList.push_back (p);
+        }
+    }
+    while (workList.size ()) {
+        size_t x = workList.back ();
+        workList.pop_back ();
+        for (size_t p : form.pred[x]) {
+            if (!inLoop[p]) {
+                inLoop[p] = 1;
+                workList.push_back (p);
+            }
+        }
+    }
+    if (!back || !inLoop[block])
+        return false;
+
+    // exactly one target stays in loop
+    bool first = false, second = false;
+    for (size_t s : form.succ[block]) {
+        const char *label = form.blocks[s][0]->label;
+        if (label != nullptr && strcmp (label, br->label1) == 0)
+            first = inLoop[s];
+        if (label != nullptr && strcmp (label, br->label2) == 0)
+            second = inLoop[s];
+    }
+    if (first == second)
+        return false;
+    *test = first ? cmp->code : negateTest (cmp->code);
+    return true;
+}
+
+// linear function test replacement, a comparison of an induction variable
+// with a constant compares a multiple of it when there is such a reduced
+// variable, and the values compared are known not to wrap around
+void StrengthReduction :: replaceTests () {
+    for (size_t b : form.layout) {
+        for (const Instruction *inst : form.blocks[b]) {
+            Operation *op = inst->op;
+            if (op->code < OpCode::cmp_LT_ || op->code > OpCode::cmp_NE_)
+                continue;
+
+            for (size_t side = 0; side < 2; side++) {
+                size_t iv = side ? op->reg1 : op->reg0;
+                size_t bound = side ? op->reg0 : op->reg1;
+                size_t h = header[iv];
+                Operand rc;
+                if (h == noBlock || !regionConstant (bound, h, &rc) || !rc.constant ||
+                    !isEncodable ((long long) rc.value))
+                    continue;
+
+                // a positive constant multiplier keeps the order
+                size_t k = 0;
+                while (k < reducedBy[iv].size () && (reducedBy[iv][k].first != OpCode::mult_ ||
+                    !reducedBy[iv][k].second.constant || reducedBy[iv][k].second.value == 0))
+                    k++;
+                if (k == reducedBy[iv].size ())
+                    continue;
+
+                // nor does it wrap around for any value compared
+                OpCode test;
+                long long lo, hi, c = (long long) reducedBy[iv][k].second.value;
+                if (!continues (b, op, h, &test) ||
+                    !bounds (iv, side ? swapTest (test) : test, (long long) rc.value, &lo, &hi) ||
+                    c * lo < numeric_limits<int>::min () || c * hi > numeric_limits<int>::max ())
+                    continue;
+
+                size_t newBound = apply (OpCode::mult_, rc, reducedBy[iv][k].second, dom.idom[h]);
+                if (side) {
+                    op->reg1 = reducedTo[iv][k];
+                    op->reg0 = newBound;
+                }
+                else {
+                    op->reg0 = reducedTo[iv][k];
+                    op->reg1 = newBound;
+                }
+                break;
+            }
+        }
+    }
+}
+
+// the uses of the names replaced in the block of their copy read the
+// reduced names instead, which are defined right after the induction
+// variables reduced and so dominate them, while uses further away keep the
+// copy, not to make the reduced names live across their own steps
+void StrengthReduction :: propagateCopies () {
+    for (size_t b : form.layout) {
+        for (const Instruction *inst : form.blocks[b]) {
+            vector <size_t*> fields;
+            useFields (inst->op, &fields);
+            for (size_t *field : fields) {
+                auto it = copyOf.find (*field);
+                if (it != copyOf.end () && defBlock[*field] == b)
+                    *field = it->second;
+            }
+        }
+    }
+}
+
+// help to remove the names that nothing useful reads, e.g. induction
+// variables only used to compute themselves after test replacement
+static void removeUseless (SSAForm &form) {
+    form.buildDefUse ();
+    size_t num = form.numNames ();
+    vector <char> useful (num, 0);
+    vector <size_t> workList;
+
+    auto markUses = [&] (const vector <size_t> &uses) {
+        for (size_t name : uses) {
+            if (!useful[name]) {
+                useful[name] = 1;
+                workList.push_back (name);
+            }
+        }
+    };
+
+    for (size_t b : form.layout) {
+        for (const Instruction *inst : form.blocks[b]) {
+            size_t reg;
+            if (definedReg (inst->op, &reg) && inst->op->code != OpCode::read_ &&
+                inst->op->code != OpCode::cread_)
+                continue;
+
+            vector <size_t> uses;
+            usedRegs (inst->op, &uses);
+            markUses (uses);
+        }
+    }
+
+    while (workList.size ()) {
+        size_t name = workList.back ();
+        workList.pop_back ();
+
+        const SSASite &site = form.defSite[name];
+        if (site.block == noBlock)
+            continue;
+        if (site.phi)
+            markUses (form.phis[site.block][site.index].args);
+        else {
+            vector <size_t> uses;
+            usedRegs (form.blocks[site.block][site.index]->op, &uses);
+            markUses (uses);
+        }
+    }
+
+    for (size_t b : form.layout) {
+        auto &phis = form.phis[b];
+        phis.erase (remove_if (phis.begin (), phis.end (),
+            [&] (const Phi &phi) { return !useful[phi.dst]; }), phis.end ());
+
+        // the label of an instruction removed moves to the next one kept
+        vector <const Instruction*> newBlock;
+        char *label = nullptr;
+        for (const Instruction *inst : form.blocks[b]) {
+            size_t reg;
+            if (definedReg (inst->op, &reg) && !useful[reg] &&
+                inst->op->code != OpCode::read_ && inst->op->code != OpCode::cread_) {
+                if (inst->label != nullptr && label == nullptr)
+                    label = strdup (inst->label);
+                delete inst;
+                continue;
+            }
+            newBlock.push_back (withLabel (inst, label));
+            label = nullptr;
+        }
+        if (label != nullptr)
+            newBlock.push_back (withLabel (new Instruction (nullptr, new Operation ()), label));
+        form.blocks[b] = std::move (newBlock);
+    }
+}
+
+void strengthReduction (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+
+    StrengthReduction osr (form);
+    osr.replaceTests ();
+    osr.propagateCopies ();
+
+    removeUseless (form);
+    destroySSA (form, toMe);
+}
+
+
+// a loop with a single latch ending in 'cmp ; cbr', which is also the only
+// way out, and an induction variable stepping once per iteration towards
+// the bound, the loop continues while 'iv test bound' holds
+struct CountedLoop {
+    size_t latch, exit;
+    size_t iv, bound;
+
+    // position of the comparison read by the branch in latch
+    size_t compare;
+
+    // the step is a positive constant or a register that is not changed in
+    // loop, 'up' tells whether it is added or subtracted
+    bool constant, up;
+    size_t step;
+
+    // one of cmp_LT, cmp_LE, cmp_GT, cmp_GE or cmp_NE
+    OpCode test;
+
+    // whether the induction variable is stepped before the comparison
+    bool stepFirst;
+};
+
+static bool countedLoop (const vector <vector <const Instruction*>> &blocks,
+    const DominatorTree &dom, const LoopForest &forest, size_t l, CountedLoop *res) {
+
+    const LoopNest &loop = forest.loops[l];
+    if (!loop.reducible || loop.preheader == noBlock || loop.latches.size () != 1 ||
+        loop.exits.size () != 1 || loop.exits[0].first != loop.latches[0])
+        return false;
+
+    size_t latch = loop.latches[0];
+    const auto &block = blocks[latch];
+    size_t size = block.size ();
+    if (size < 2 || block[size - 1]->op->code != OpCode::cbr_)
+        return false;
+
+    // the branch reads the last comparison in latch
+    const Operation *cbr = block[size - 1]->op;
+    size_t ci = size - 1, reg;
+    while (ci > 0 && !(definedReg (block[ci - 1]->op, &reg) && reg == cbr->reg0))
+        ci--;
+    if (ci-- == 0)
+        return false;
+
+    const Operation *cmp = block[ci]->op;
+    if (cmp->code < OpCode::cmp_LT_ || cmp->code > OpCode::cmp_NE_)
+        return false;
+
+    string header (blocks[loop.header][0]->label);
+    res->latch = latch;
+    res->compare = ci;
+    res->exit = loop.exits[0].second;
+    res->test = cmp->code;
+    if (header != cbr->label1)
+        res->test = negateTest (res->test);
+
+    vector <size_t> defCount;
+    vector <pair <size_t, size_t>> defAt;
+    for (size_t b : loop.blocks) {
+        for (size_t i = 0; i < blocks[b].size (); i++) {
+            size_t reg;
+            if (!definedReg (blocks[b][i]->op, &reg))
+                continue;
+            if (reg >= defCount.size ()) {
+                defCount.resize (reg + 1, 0);
+                defAt.resize (reg + 1);
+            }
+            defCount[reg]++;
+            defAt[reg] = make_pair (b, i);
+        }
+    }
+
+    auto invariant = [&] (size_t reg) {
+        return reg >= defCount.size () || defCount[reg] == 0;
+    };
+
+    // the induction variable is compared with a bound not changed in loop
+    bool swapped = invariant (cmp->reg0);
+    res->iv = swapped ? cmp->reg1 : cmp->reg0;
+    res->bound = swapped ? cmp->reg0 : cmp->reg1;
+    if (swapped)
+        res->test = swapTest (res->test);
+    if (invariant (res->iv) || defCount[res->iv] != 1 || !invariant (res->bound))
+        return false;
+
+    // the only definition steps it, once in every iteration
+    size_t b = defAt[res->iv].first, i = defAt[res->iv].second;
+    const Operation *op = blocks[b][i]->op;
+    if (forest.loopOf[b] != l || !dom.dominates (b, latch))
+        return false;
+
+    size_t iv = res->iv;
+    switch (op->code) {
+        case OpCode::addI_: case OpCode::subI_:
+            if (op->reg0 != iv || op->constant == 0)
+                return false;
+            res->constant = true;
+            res->step = op->constant;
+            break;
+        case OpCode::add_:
+            if (op->reg0 != iv && op->reg1 != iv)
+                return false;
+            res->constant = false;
+            res->step = op->reg0 == iv ? op->reg1 : op->reg0;
+            break;
+        case OpCode::sub_:
+            if (op->reg0 != iv)
+                return false;
+            res->constant = false;
+            res->step = op->reg1;
+            break;
+        default: return false;
+    }
+    if (!res->constant && !invariant (res->step))
+        return false;
+
+    res->up = op->code == OpCode::addI_ || op->code == OpCode::add_;
+    res->stepFirst = b != latch || i < ci;
+
+    // a loop running away from its bound never ends before overflow, and
+    // one testing equality runs at most twice
+    if (res->up)
+        return res->test == OpCode::cmp_LT_ || res->test == OpCode::cmp_LE_ || res->test == OpCode::cmp_NE_;
+    return res->test == OpCode::cmp_GT_ || res->test == OpCode::cmp_GE_ || res->test == OpCode::cmp_NE_;
+}
+
+// the largest loop body in instructions after unrolling
+const size_t maxUnrolledSize = 512;
+
+// the cost model aims at unrolled bodies of about this many instructions,
+// with at most this many registers live, and lets the whole procedure
+// grow by its own size, but at least by the given number of instructions
+const size_t unrollTarget = 64;
+const size_t unrollRegisters = 32;
+const size_t minGrowthBudget = 128;
+
+// roughly the instructions added besides the copies of body
+const size_t unrollOverhead = 16;
+
+// the largest straight-line code replacing a loop with constant trip count
+const size_t maxFullUnrollSize = 128;
+
+// help to emit the blocks computing how many times the unrolled body may
+// run, 'count' gets the trip count divided by 'unrollBy' rounded down, and
+// the code jumps to 'remainder' when it is zero or the step is not positive,
+// the register holding the trip count is returned
+static size_t emitTripCount (const CountedLoop &info, size_t unrollBy,
+    size_t zero, size_t count, size_t &nextReg, LabelMaker &maker,
+    const string &body, const string &remainder,
+    vector <vector <const Instruction*>> *toMe) {
+
+    auto emit = [&] (OpCode code, size_t reg0, size_t reg1, size_t constant) {
+        toMe->back ().push_back (new Instruction (nullptr, new Operation (
+            code, reg0, reg1, nextReg, constant)));
+        return nextReg++;
+    };
+
+    // the code goes on in a new block when not jumping to remainder
+    auto branch = [&] (size_t cond, bool toRemainder) {
+        string next = maker.make ("TC");
+        toMe->back ().push_back (new Instruction (nullptr, new Operation (
+            OpCode::cbr_, cond, 0, 0, 0, (toRemainder ? remainder : next).c_str (),
+            (toRemainder ? next : remainder).c_str ())));
+        toMe->push_back (vector <const Instruction*> {new Instruction (next.c_str ())});
+    };
+
+    toMe->push_back (vector <const Instruction*> {new Instruction (maker.make ("TC").c_str ())});
+    toMe->back ().push_back (new Instruction (nullptr, new Operation (
+        OpCode::loadI_, 0, 0, zero, 0)));
+
+    // a step in register must be positive
+    if (!info.constant) {
+        size_t cond = emit (OpCode::cmp_LE_, info.step, zero, 0);
+        branch (cond, true);
+    }
+
+    // the value compared first, and its distance to the bound
+    size_t first = info.iv;
+    if (info.stepFirst) {
+        if (info.constant)
+            first = emit (info.up ? OpCode::addI_ : OpCode::subI_, info.iv, 0, info.step);
+        else first = emit (info.up ? OpCode::add_ : OpCode::sub_, info.iv, info.step, 0);
+    }
+
+    // the distance wraps around unless both are on the same side of zero
+    size_t below = emit (OpCode::cmp_LT_, first, zero, 0);
+    size_t cond = emit (OpCode::cmp_NE_, below, emit (OpCode::cmp_LT_, info.bound, zero, 0), 0);
+    branch (cond, true);
+    size_t dist = info.up ? emit (OpCode::sub_, info.bound, first, 0) :
+        emit (OpCode::sub_, first, info.bound, 0);
+
+    bool strict = info.test == OpCode::cmp_LT_ || info.test == OpCode::cmp_GT_;
+    cond = emit (strict ? OpCode::cmp_GT_ : OpCode::cmp_GE_, dist, zero, 0);
+    branch (cond, false);
+
+    // the loop runs 'ceil (dist / step) + 1', that is '(dist - 1) / step + 2'
+    // times for strict comparison, 'dist / step + 2' times for non-strict
+    // one, and 'dist / step + 1' times for 'cmp_NE', which may be fewer if
+    // the step does not divide; only the last addition may wrap around, to
+    // a negative count which runs the original loop
+    size_t extra = strict || info.test == OpCode::cmp_LE_ || info.test == OpCode::cmp_GE_ ? 2 : 1;
+    if (strict && info.constant && info.step == 1)
+        extra = 1;
+    else if (strict)
+        dist = emit (OpCode::subI_, dist, 0, 1);
+    size_t trips = dist;
+    if (!info.constant)
+        trips = emit (OpCode::div_, dist, info.step, 0);
+    else if (info.step > 1)
+        trips = emit (OpCode::divI_, dist, 0, info.step);
+    trips = emit (OpCode::addI_, trips, 0, extra);
+
+    toMe->back ().push_back (new Instruction (nullptr, new Operation (
+        OpCode::divI_, trips, 0, count, unrollBy)));
+    cond = emit (OpCode::cmp_GT_, count, zero, 0);
+    toMe->back ().push_back (new Instruction (nullptr, new Operation (
+        OpCode::cbr_, cond, 0, 0, 0, body.c_str (), remainder.c_str ())));
+    return trips;
+}
+
+// help to copy the loop body 'copies' times one after another, the branch
+// of latch is dropped in all copies but the last, and its test too unless
+// something else reads it, the last copy goes on to 'again' in place of
+// header, or when 'again' is empty, the loop is known to end there and
+// the last copy jumps to the exit
+static void copyBody (const CountedLoop &info, const LoopNest &loop, size_t copies,
+    const string &again, const Liveness &live, LabelMaker &maker,
+    const vector <vector <const Instruction*>> &blocks, const vector <size_t> &layout,
+    vector <vector <const Instruction*>> *toMe) {
+
+    size_t h = loop.header, latch = info.latch;
+
+    // blocks of loop in layout order, starting from header
+    size_t pos = find (layout.begin (), layout.end (), h) - layout.begin ();
+    vector <size_t> body;
+    for (size_t k = 0; k < layout.size (); k++) {
+        size_t b = layout[(pos + k) % layout.size ()];
+        if (find (loop.blocks.begin (), loop.blocks.end (), b) != loop.blocks.end ())
+            body.push_back (b);
+    }
+
+    // the block each one falls into
+    vector <size_t> fallInto (blocks.size (), noBlock);
+    for (size_t k = 0; k + 1 < layout.size (); k++) {
+        OpCode code = blocks[layout[k]].back ()->op->code;
+        if (code != OpCode::br_ && code != OpCode::cbr_)
+            fallInto[layout[k]] = layout[k + 1];
+    }
+
+    vector <vector <string>> labels (copies, vector <string> (blocks.size ()));
+    for (size_t k = 0; k < copies; k++) {
+        for (size_t b : body)
+            labels[k][b] = maker.make (string (blocks[b][0]->label) + "U");
+    }
+
+    // the comparison is dropped with the branch if nothing else reads it
+    size_t cond = blocks[latch].back ()->op->reg0;
+    bool keepTest = live.liveIn[h].test (cond) || live.liveIn[info.exit].test (cond) ||
+        info.compare == 0;
+
+    for (size_t k = 0; k < copies; k++) {
+        for (size_t i = 0; i < body.size (); i++) {
+            size_t b = body[i];
+            const auto &block = blocks[b];
+            vector <const Instruction*> copy;
+
+            // the branch of latch is only kept in the last copy
+            bool inner = b == latch && (k + 1 < copies || again.empty ());
+            size_t size = inner ? block.size () - 1 : block.size ();
+
+            for (size_t j = 0; j < size; j++) {
+                if (inner && j == info.compare && !keepTest)
+                    continue;
+
+                Instruction *inst = new Instruction (block[j]);
+                if (j == 0) {
+                    delete [] inst->label;
+                    inst->label = strdup (labels[k][b].c_str ());
+                }
+                for (size_t c : body)
+                    retarget (inst, string (blocks[c][0]->label), labels[k][c]);
+                copy.push_back (inst);
+            }
+
+            if (b == latch && k + 1 == copies && again.size ())
+                retarget (copy.back (), labels[k][h], again);
+
+            // the block that used to come next may not be here any more
+            string target;
+            if (b == latch && k + 1 < copies)
+                target = labels[k + 1][h];
+            else if (b == latch && again.empty ())
+                target = string (blocks[info.exit][0]->label);
+            else if (fallInto[b] != noBlock)
+                target = labels[k][fallInto[b]];
+
+            bool follows = i + 1 < body.size () ? target == labels[k][body[i + 1]] :
+                k + 1 < copies && target == labels[k + 1][h];
+            if (target.size () && !follows)
+                copy.push_back (new Instruction (nullptr, new Operation (
+                    OpCode::br_, 0, 0, 0, 0, target.c_str ())));
+
+            toMe->push_back (std::move (copy));
+        }
+    }
+}
+
+// help to place new blocks right before header, where the preheader falls
+// into, and to lead the preheader to the first of them
+static void placeBeforeHeader (const LoopNest &loop, vector <vector <const Instruction*>> &newBlocks,
+    vector <vector <const Instruction*>> &blocks, vector <size_t> *layout) {
+
+    string header (blocks[loop.header][0]->label);
+    retarget (blocks[loop.preheader].back (), header, string (newBlocks[0][0]->label));
+
+    size_t pos = find (layout->begin (), layout->end (), loop.header) - layout->begin ();
+    for (auto &block : newBlocks) {
+        blocks.push_back (std::move (block));
+        layout->insert (layout->begin () + pos++, blocks.size () - 1);
+    }
+}
+
+// help to unroll the loop, the unrolled body runs while at least 'unrollBy'
+// iterations are left, then the original loop runs the remaining ones
+static void unrollLoop (const CountedLoop &info, const LoopNest &loop, size_t unrollBy,
+    const Liveness &live, size_t &nextReg, LabelMaker &maker,
+    vector <vector <const Instruction*>> &blocks, vector <size_t> *layout) {
+
+    string header (blocks[loop.header][0]->label);
+    string next = maker.make ("UN");
+
+    vector <vector <const Instruction*>> copies;
+    copyBody (info, loop, unrollBy, next, live, maker, blocks, *layout, &copies);
+    string body (copies[0][0]->label);
+
+    vector <vector <const Instruction*>> newBlocks;
+    size_t zero = nextReg++, count = nextReg++;
+    emitTripCount (info, unrollBy, zero, count, nextReg, maker, body, header, &newBlocks);
+    for (auto &block : copies)
+        newBlocks.push_back (std::move (block));
+
+    // count down the rounds of unrolled body
+    size_t again = nextReg++;
+    newBlocks.push_back (vector <const Instruction*> {
+        new Instruction (next.c_str ()),
+        new Instruction (nullptr, new Operation (OpCode::subI_, count, 0, count, 1)),
+        new Instruction (nullptr, new Operation (OpCode::cmp_GT_, count, zero, again)),
+        new Instruction (nullptr, new Operation (OpCode::cbr_, again, 0, 0, 0,
+            body.c_str (), header.c_str ()))});
+
+    placeBeforeHeader (loop, newBlocks, blocks, layout);
+}
+
+// help to find the constant loaded into register when control leaves
+// block, following the chain of blocks with a single predecessor
+static bool constantAt (const vector <vector <const Instruction*>> &blocks,
+    const FlowGraph &graph, size_t b, size_t reg, long long *value) {
+
+    for (size_t steps = 0; steps < blocks.size (); steps++) {
+        for (size_t i = blocks[b].size (); i-- > 0;) {
+            const Operation *op = blocks[b][i]->op;
+            size_t def;
+            if (definedReg (op, &def) && def == reg) {
+                *value = op->constant;
+                return op->code == OpCode::loadI_;
+            }
+        }
+        if (graph.pred[b].size () != 1)
+            return false;
+        b = graph.pred[b][0];
+    }
+    return false;
+}
+
+// help to find the constant in register at the end of block 'b' also when
+// it is set before the path of single predecessors to 'b', as long as its
+// only definition is a load of the constant in a block dominating 'b'
+static bool foldedAt (const vector <vector <const Instruction*>> &blocks,
+    const FlowGraph &graph, const DominatorTree &dom, size_t b, size_t reg, long long *value) {
+
+    if (constantAt (blocks, graph, b, reg, value))
+        return true;
+
+    const Operation *def = nullptr;
+    size_t where = 0, defs = 0;
+    for (size_t c = 0; c < blocks.size (); c++) {
+        for (const Instruction *inst : blocks[c]) {
+            size_t dst;
+            if (definedReg (inst->op, &dst) && dst == reg) {
+                def = inst->op;
+                where = c;
+                defs++;
+            }
+        }
+    }
+    if (defs != 1 || def->code != OpCode::loadI_ || where >= dom.idom.size () || !dom.dominates (where, b))
+        return false;
+    *value = def->constant;
+    return true;
+}
+
+// help to run the test of counted loop from the given values, false when
+// the loop runs more than 'maxTrips' times
+static bool countTrips (const CountedLoop &info, long long init, long long step,
+    long long bound, size_t maxTrips, size_t *trips) {
+
+    OpCode code = info.up ? OpCode::add_ : OpCode::sub_;
+    long long value = init, next, cond;
+    for (*trips = 1; *trips <= maxTrips; (*trips)++) {
+        evaluate (code, value, step, &next);
+        evaluate (info.test, info.stepFirst ? next : value, bound, &cond);
+        value = next;
+        if (!cond)
+            return true;
+    }
+    return false;
+}
+
+// help to find the trip count of loop when the induction variable starts
+// from a constant, and its step and bound are constants too, false when
+// they are not known or the loop runs more than 'maxTrips' times
+static bool constantTrips (const CountedLoop &info, const LoopNest &loop,
+    const vector <vector <const Instruction*>> &blocks, const FlowGraph &graph,
+    size_t maxTrips, long long *init, long long *step, size_t *trips) {
+
+    long long bound;
+    *step = info.step;
+    if (!constantAt (blocks, graph, loop.preheader, info.iv, init) ||
+        !constantAt (blocks, graph, loop.preheader, info.bound, &bound) ||
+        (!info.constant && !constantAt (blocks, graph, loop.preheader, info.step, step)))
+        return false;
+
+    return countTrips (info, *init, *step, bound, maxTrips, trips);
+}
+
+// help to replace the loop by copies of its body, one for each iteration,
+// where the induction variable is loaded with its known value
+static void fullyUnrollLoop (const CountedLoop &info, const LoopNest &loop,
+    size_t trips, long long init, long long step, const Liveness &live, LabelMaker &maker,
+    vector <vector <const Instruction*>> &blocks, vector <size_t> *layout) {
+
+    vector <vector <const Instruction*>> newBlocks;
+    copyBody (info, loop, trips, "", live, maker, blocks, *layout, &newBlocks);
+
+    OpCode code = info.up ? OpCode::add_ : OpCode::sub_;
+    long long value = init;
+    for (auto &block : newBlocks) {
+        for (const Instruction *&inst : block) {
+            size_t reg;
+            if (!definedReg (inst->op, &reg) || reg != info.iv)
+                continue;
+
+            evaluate (code, value, step, &value);
+            if (!isEncodable (value))
+                continue;
+
+            char *label = inst->label != nullptr ? strdup (inst->label) : nullptr;
+            delete inst;
+            inst = new Instruction (label, new Operation (OpCode::loadI_, 0, 0, reg, value));
+        }
+    }
+
+    placeBeforeHeader (loop, newBlocks, blocks, layout);
+
+    // the loop is gone, so the jump to exit may not be needed
+    vector <size_t> newLayout;
+    for (size_t b : *layout) {
+        if (find (loop.blocks.begin (), loop.blocks.end (), b) == loop.blocks.end ())
+            newLayout.push_back (b);
+    }
+    *layout = std::move (newLayout);
+
+    for (size_t pos = 0; pos + 1 < layout->size (); pos++) {
+        auto &block = blocks[(*layout)[pos]];
+        const Operation *op = block.back ()->op;
+        if ((*layout)[pos + 1] == info.exit && block.size () > 1 && op->code == OpCode::br_ &&
+            string (blocks[info.exit][0]->label) == op->label1) {
+            delete block.back ();
+            block.pop_back ();
+        }
+    }
+}
+
+// choose the unrolling factor of loop, 1 when it is not worth unrolling,
+// together with a note saying why for the report
+static size_t unrollFactor (const vector <vector <const Instruction*>> &blocks,
+    const LoopNest &loop, const CountedLoop &info, const Liveness &live,
+    size_t numRegs, size_t budget, string *note) {
+
+    // size and latency of one iteration, without the loop test
+    size_t size = 0, cycles = 0;
+    for (size_t b : loop.blocks) {
+        for (size_t i = 0; i < blocks[b].size (); i++) {
+            OpCode code = blocks[b][i]->op->code;
+            if (code == OpCode::nop_ || (b == info.latch && (i == info.compare ||
+                i + 1 == blocks[b].size ())))
+                continue;
+            size++;
+            cycles += latency (code);
+        }
+    }
+
+    // registers live anywhere in loop, and those that only live within
+    // one iteration, which every copy needs once copies are scheduled together
+    size_t pressure = 0, local = 0;
+    BitVector across = live.liveIn[loop.header], defined (numRegs);
+    for (size_t b : loop.blocks) {
+        BitVector now = live.liveOut[b];
+        pressure = max (pressure, now.count ());
+        for (size_t i = blocks[b].size (); i-- > 0;) {
+            const Operation *op = blocks[b][i]->op;
+            size_t reg;
+            if (definedReg (op, &reg)) {
+                now.reset (reg);
+                defined.set (reg);
+            }
+            vector <size_t> uses;
+            usedRegs (op, &uses);
+            for (size_t use : uses)
+                now.set (use);
+            pressure = max (pressure, now.count ());
+        }
+    }
+    defined.subtract (across);
+    local = defined.count ();
+
+    // the test and branch are paid once per copy of body
+    size_t overhead = latency (OpCode::cmp_LT_) + latency (OpCode::cbr_);
+    *note = "size " + to_string (size) + ", latency " + to_string (cycles) +
+        ", registers " + to_string (pressure) + "+" + to_string (local);
+
+    if (overhead * 8 < cycles + overhead) {
+        *note += ", branch overhead too small";
+        return 1;
+    }
+
+    size_t factor = 1;
+    for (size_t f = 2; f <= 8; f *= 2) {
+        if (f * size > unrollTarget) {
+            *note += ", body too large";
+            break;
+        }
+        if (pressure + (f - 1) * local > unrollRegisters) {
+            *note += ", too many registers";
+            break;
+        }
+        if ((f - 1) * size + unrollOverhead > budget) {
+            *note += ", out of code growth budget";
+            break;
+        }
+        factor = f;
+    }
+    return factor;
+}
+
+void loopUnrolling (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, size_t unrollBy) {
+
+    vector <const Instruction*> code;
+    unordered_set <string> created;
+    insertPreheaders (fromMe, &code, lead, last, edges, &created);
+
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (code, &newLead, &newLast, &newEdges);
+
+    FlowGraph graph (newLead, newLast, newEdges);
+    DominatorTree dom (graph);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (code, graph, &blocks);
+    LabelMaker maker (code);
+    freeMemory (code);
+
+    size_t numRegs = nextUnusedReg (fromMe), nextReg = numRegs;
+    Liveness live (blocks, graph.succ, numRegs);
+
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+
+    // the code may grow by its own size
+    size_t budget = max (fromMe.size (), minGrowthBudget);
+
+    // only innermost loops are unrolled, the report tells
+    // the factor of each loop, 1 if it is not unrolled
+    for (size_t l = 0; l < forest.loops.size (); l++) {
+        const LoopNest &loop = forest.loops[l];
+        const char *label = blocks[loop.header][0]->label;
+        string name = label != nullptr ? string (label) : "entry";
+
+        CountedLoop info = CountedLoop ();
+        size_t factor = 1, size = 0, trips = 0;
+        long long init = 0, step = 0;
+        bool full = false;
+        string note;
+
+        if (loop.children.size ())
+            note = "not innermost";
+        else if (!countedLoop (blocks, dom, forest, l, &info))
+            note = "not a counted loop";
+        else {
+            for (size_t b : loop.blocks)
+                size += blocks[b].size ();
+
+            // a short loop with known trip count becomes straight-line code
+            size_t maxTrips = min (maxFullUnrollSize, size + budget) / size;
+            if (constantTrips (info, loop, blocks, graph, maxTrips, &init, &step, &trips)) {
+                full = true;
+                factor = trips;
+                note = "fully unrolled";
+            }
+            else if (unrollBy == 0)
+                factor = unrollFactor (blocks, loop, info, live, numRegs, budget, &note);
+            else {
+                factor = size * unrollBy > maxUnrolledSize ? 1 : unrollBy;
+                note = factor > 1 ? "given" : "body too large";
+            }
+        }
+
+        cerr << "unroll " << name << ": factor " << factor << " (" << note << ")\n";
+
+        size_t before = blocks.size (), added = 0;
+        if (full)
+            fullyUnrollLoop (info, loop, trips, init, step, live, maker, blocks, &layout);
+        else if (factor > 1)
+            unrollLoop (info, loop, factor, live, nextReg, maker, blocks, &layout);
+
+        for (size_t b = before; b < blocks.size (); b++)
+            added += blocks[b].size ();
+        budget -= min (budget, added);
+    }
+
+    dropPreheaders (blocks, &layout, created);
+    joinBlocks (blocks, layout, toMe);
+}
+
+// a linear function of the iteration numbers of the outer and the inner
+// loop, and of the values of registers not changed in the outer loop,
+// for a loop without nested ones only 'outer' is used
+struct Affine {
+    bool known;
+    long long outer, inner, constant;
+    map <size_t, long long> symbols;
+
+    Affine (bool k=false, long long c=0) : known (k), outer (0), inner (0), constant (c) {}
+
+    bool isConstant () const { return known && !outer && !inner && symbols.empty (); }
+};
+
+static Affine symbolOf (size_t reg) {
+    Affine res (true);
+    res.symbols[reg] = 1;
+    return res;
+}
+
+// 'lhs + factor * rhs'
+static Affine combine (const Affine &lhs, const Affine &rhs, long long factor) {
+    if (!lhs.known || !rhs.known)
+        return Affine ();
+
+    Affine res = lhs;
+    res.outer += factor * rhs.outer;
+    res.inner += factor * rhs.inner;
+    res.constant += factor * rhs.constant;
+    for (const auto &term : rhs.symbols) {
+        if ((res.symbols[term.first] += factor * term.second) == 0)
+            res.symbols.erase (term.first);
+    }
+    return res;
+}
+
+static Affine affineOf (const Operation *op, const function <Affine (size_t)> &valueOf) {
+    long long c = op->constant;
+    switch (op->code) {
+        case OpCode::loadI_: return Affine (true, c);
+        case OpCode::i2i_: return valueOf (op->reg0);
+        case OpCode::add_: return combine (valueOf (op->reg0), valueOf (op->reg1), 1);
+        case OpCode::sub_: return combine (valueOf (op->reg0), valueOf (op->reg1), -1);
+        case OpCode::addI_: return combine (valueOf (op->reg0), Affine (true, c), 1);
+        case OpCode::subI_: return combine (valueOf (op->reg0), Affine (true, c), -1);
+        case OpCode::multI_: return combine (Affine (true), valueOf (op->reg0), c);
+        case OpCode::lshiftI_:
+            if (c > 30)
+                return Affine ();
+            return combine (Affine (true), valueOf (op->reg0), 1LL << c);
+        case OpCode::mult_: {
+            Affine lhs = valueOf (op->reg0), rhs = valueOf (op->reg1);
+            if (lhs.isConstant ())
+                return combine (Affine (true), rhs, lhs.constant);
+            if (rhs.isConstant ())
+                return combine (Affine (true), lhs, rhs.constant);
+            return Affine ();
+        }
+        default: return Affine ();
+    }
+}
+
+// help to find the address accessed by load or store
+static Affine addressOf (const Operation *op, const function <Affine (size_t)> &valueOf) {
+    OpCode code = op->code;
+    Affine address = valueOf (code >= OpCode::store_ ? op->reg1 : op->reg0);
+    if (code == OpCode::loadAI_ || code == OpCode::cloadAI_ ||
+        code == OpCode::storeAI_ || code == OpCode::cstoreAI_)
+        return combine (address, Affine (true, op->constant), 1);
+    if (code == OpCode::loadAO_ || code == OpCode::cloadAO_)
+        return combine (address, valueOf (op->reg1), 1);
+    if (code == OpCode::storeAO_ || code == OpCode::cstoreAO_)
+        return combine (address, valueOf (op->reg2), 1);
+    return address;
+}
+
+// the bytes accessed by load or store
+static size_t widthOf (OpCode code) {
+    return (code >= OpCode::cload_ && code <= OpCode::cloadAO_) || code >= OpCode::cstore_ ? 1 : 4;
+}
+
+// a memory access of the loop nest, 'phase' tells whether it is before
+// the inner loop, in it, or after it
+struct JamAccess {
+    Affine address;
+    size_t width;
+    bool store;
+    size_t phase;
+};
+
+// the most iterations of a loop simulated to bound the dependence test
+const size_t maxSimulatedTrips = 1 << 16;
+
+// a bound larger than any address distance, standing for no bound
+const long long unbounded = 1LL << 60;
+
+// whether 'step * e' falls in [lo, hi] for some integer e in [1, maxE]
+static bool hitsRange (long long step, long long lo, long long hi, long long maxE) {
+    if (step < 0) {
+        step = -step;
+        swap (lo, hi);
+        lo = -lo;
+        hi = -hi;
+    }
+    if (lo > hi || maxE < 1)
+        return false;
+    if (step == 0)
+        return lo <= 0 && 0 <= hi;
+
+    long long first = lo <= step ? 1 : (lo + step - 1) / step;
+    long long last = hi >= 0 ? hi / step : -((-hi + step - 1) / step);
+    return first <= min (last, maxE);
+}
+
+// the range of 'coef * v' for v in [lo, hi], where hi may be unbounded
+static pair <long long, long long> termRange (long long coef, long long lo, long long hi) {
+    long long a = coef * lo;
+    long long b = hi >= unbounded ? (coef > 0 ? unbounded : coef < 0 ? -unbounded : 0) : coef * hi;
+    return make_pair (min (a, b), max (a, b));
+}
+
+// whether the copies of outer iteration can run with their inner loops fused,
+// that is no access of a later copy reaches memory touched by an earlier one
+// before it, which happens to accesses before the inner loop of later copies,
+// and to accesses in the inner loop of later copies at earlier inner iterations,
+// the inner loop runs at most 'maxInner' + 1 times and the outer one at most
+// 'maxOuter' + 1 times, outer iterations count from 0
+static bool jamLegal (const vector <JamAccess> &accesses, size_t factor,
+    long long maxInner, long long maxOuter) {
+    for (const JamAccess &x : accesses) {
+        for (const JamAccess &y : accesses) {
+            bool inner = x.phase == 1 && y.phase == 1;
+            if ((!x.store && !y.store) || (y.phase >= x.phase && !inner) || (inner && maxInner == 0))
+                continue;
+
+            const Affine &a = x.address, &b = y.address;
+            if (!a.known || !b.known || a.symbols != b.symbols)
+                return false;
+
+            // 'y' is in copy 'dp' after 'x', the bytes overlap when the
+            // distance of addresses is within (-y.width, x.width)
+            for (long long dp = 1; dp < (long long) factor && dp <= maxOuter; dp++) {
+                long long dist = b.outer * dp + b.constant - a.constant;
+                long long lo = 1 - (long long) y.width, hi = (long long) x.width - 1;
+
+                // the same access pattern is exact, 'y' is 'e' inner iterations earlier
+                if (inner && a.outer == b.outer && a.inner == b.inner) {
+                    if (hitsRange (-a.inner, lo - dist, hi - dist, maxInner))
+                        return false;
+                    continue;
+                }
+
+                // otherwise bound the distance over all the iterations
+                // 'x' is at most in the outer iteration 'dp' before the last
+                long long lastOuter = maxOuter >= unbounded ? unbounded : maxOuter - dp;
+                vector <pair <long long, long long>> terms {termRange (b.outer - a.outer, 0, lastOuter)};
+                if (inner) {
+                    terms.push_back (termRange (b.inner - a.inner, 0, maxInner));
+                    terms.push_back (termRange (-b.inner, 1, maxInner));
+                }
+                else {
+                    terms.push_back (termRange (b.inner, 0, maxInner));
+                    terms.push_back (termRange (-a.inner, 0, maxInner));
+                }
+
+                long long low = dist, high = dist;
+                for (const auto &term : terms) {
+                    low = max (low + term.first, -unbounded);
+                    high = min (high + term.second, unbounded);
+                }
+                if (low <= hi && lo <= high)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// help to find the blocks from 'from' to 'to' following the only successor,
+// where every block but the first has a single predecessor
+static bool chainOf (const FlowGraph &graph, const vector <vector <const Instruction*>> &blocks,
+    size_t from, size_t to, vector <size_t> *chain) {
+
+    for (size_t b = from; chain->size () < blocks.size (); b = graph.succ[b][0]) {
+        if (b != from && graph.pred[b].size () != 1)
+            return false;
+        chain->push_back (b);
+        if (b == to)
+            return true;
+        if (graph.succ[b].size () != 1 || blocks[b].back ()->op->code == OpCode::cbr_)
+            return false;
+    }
+    return false;
+}
+
+// help to unroll the outer loop by 'factor' and fuse the copies of its inner
+// loop into one, return the reason when it cannot be done
+static string jamLoop (size_t l, size_t factor, const FlowGraph &graph, const DominatorTree &dom,
+    const LoopForest &forest, const Liveness &live, size_t numRegs, size_t &nextReg,
+    LabelMaker &maker, vector <vector <const Instruction*>> &blocks, vector <size_t> *layout) {
+
+    const LoopNest &loop = forest.loops[l];
+    size_t il = loop.children[0];
+    const LoopNest &inner = forest.loops[il];
+
+    CountedLoop info, innerInfo;
+    if (!countedLoop (blocks, dom, forest, l, &info) || !info.constant)
+        return "not a counted loop";
+    if (inner.children.size () || inner.blocks.size () != 1 ||
+        !countedLoop (blocks, dom, forest, il, &innerInfo) || !innerInfo.constant)
+        return "inner loop not a counted block";
+
+    // the outer loop is a straight path into the inner loop and out of it
+    vector <size_t> before, after;
+    if (!chainOf (graph, blocks, loop.header, inner.preheader, &before) ||
+        !chainOf (graph, blocks, innerInfo.exit, info.latch, &after) ||
+        before.size () + after.size () + 1 != loop.blocks.size ())
+        return "not a simple nest";
+
+    size_t size = 0;
+    for (size_t b : loop.blocks) {
+        size += blocks[b].size ();
+        for (const Instruction *inst : blocks[b]) {
+            if (inst->op->code >= OpCode::read_)
+                return "input or output";
+        }
+    }
+    if (size * factor > maxUnrolledSize)
+        return "body too large";
+
+    // registers written in loop, only the induction variable may carry
+    // a value from one iteration of outer loop to the next
+    BitVector defined (numRegs), innerDefined (numRegs);
+    for (size_t b : loop.blocks) {
+        for (const Instruction *inst : blocks[b]) {
+            size_t reg;
+            if (definedReg (inst->op, &reg)) {
+                defined.set (reg);
+                if (b == inner.header)
+                    innerDefined.set (reg);
+            }
+        }
+    }
+
+    BitVector carried = live.liveIn[loop.header];
+    carried &= defined;
+    carried.reset (info.iv);
+    if (carried.any ())
+        return "registers carried";
+
+    // walk one iteration to find the addresses
+    unordered_map <size_t, Affine> env;
+    long long outerStep = info.up ? info.step : -(long long) info.step;
+    long long innerStep = innerInfo.up ? innerInfo.step : -(long long) innerInfo.step;
+    long long init;
+    bool initKnown = constantAt (blocks, graph, loop.preheader, info.iv, &init);
+    env[info.iv] = initKnown ? Affine (true, init) : symbolOf (info.iv);
+    env[info.iv].outer = outerStep;
+
+    // registers not written in loop hold their value at the preheader
+    auto valueOf = [&] (size_t reg) {
+        auto it = env.find (reg);
+        if (it != env.end ())
+            return it->second;
+        long long value;
+        if (defined.test (reg))
+            return Affine ();
+        if (foldedAt (blocks, graph, dom, loop.preheader, reg, &value))
+            return Affine (true, value);
+        return symbolOf (reg);
+    };
+
+    vector <JamAccess> accesses;
+    auto walk = [&] (size_t b, size_t phase) {
+        for (const Instruction *inst : blocks[b]) {
+            const Operation *op = inst->op;
+            OpCode code = op->code;
+            if (code >= OpCode::load_ && code <= OpCode::cstoreAO_)
+                accesses.push_back (JamAccess {addressOf (op, valueOf), widthOf (code),
+                    code >= OpCode::store_, phase});
+
+            size_t reg;
+            if (definedReg (op, &reg))
+                env[reg] = affineOf (op, valueOf);
+        }
+    };
+
+    for (size_t b : before)
+        walk (b, 0);
+
+    // the inner loop must run the same number of times in every copy
+    for (size_t reg : {innerInfo.iv, innerInfo.bound}) {
+        Affine value = valueOf (reg);
+        if (!value.known || value.outer)
+            return "inner trip count varies";
+    }
+
+    // values carried around inner loop are not known, except its induction variable
+    Affine start = valueOf (innerInfo.iv);
+    innerDefined.forEach ([&] (size_t reg) { env[reg] = Affine (); });
+    env[innerInfo.iv] = start;
+    env[innerInfo.iv].inner = innerStep;
+    walk (inner.header, 1);
+
+    innerDefined.forEach ([&] (size_t reg) { env[reg] = Affine (); });
+    for (size_t b : after)
+        walk (b, 2);
+
+    // the bound of inner iterations helps to tell accesses apart
+    Affine bound = valueOf (innerInfo.bound);
+    size_t trips;
+    long long maxInner = unbounded;
+    if (start.isConstant () && bound.isConstant () &&
+        countTrips (innerInfo, start.constant, innerInfo.step, bound.constant, maxSimulatedTrips, &trips))
+        maxInner = trips - 1;
+
+    // so does the bound of outer iterations, the copies run together only
+    // in the rounds where all of them run
+    long long outerBound, maxOuter = unbounded;
+    if (initKnown && foldedAt (blocks, graph, dom, loop.preheader, info.bound, &outerBound) &&
+        countTrips (info, init, info.step, outerBound, maxSimulatedTrips, &trips))
+        maxOuter = trips - 1;
+
+    if (!jamLegal (accesses, factor, maxInner, maxOuter))
+        return "dependence";
+
+    for (size_t c = 1; c < factor; c++) {
+        if (!isEncodable (c * info.step))
+            return "step too large";
+    }
+
+    // every copy but the last one gets its own registers
+    vector <unordered_map <size_t, size_t>> rename (factor);
+    for (size_t c = 0; c + 1 < factor; c++)
+        defined.forEach ([&] (size_t reg) { rename[c][reg] = nextReg++; });
+
+    auto copyOf = [&] (const Instruction *inst, size_t c) {
+        const Operation *op = inst->op;
+        Operation *copy = new Operation (op->code, op->reg0, op->reg1, op->reg2,
+            op->constant, op->label1, op->label2);
+        if (c + 1 < factor) {
+            vector <size_t*> fields;
+            useFields (copy, &fields);
+            size_t reg;
+            if (definedReg (copy, &reg))
+                fields.push_back (&copy->reg2);
+            for (size_t *field : fields) {
+                auto it = rename[c].find (*field);
+                if (it != rename[c].end ())
+                    *field = it->second;
+            }
+        }
+        return new Instruction (nullptr, copy);
+    };
+
+    string header (blocks[loop.header][0]->label), innerHeader (blocks[inner.header][0]->label);
+    string exit (blocks[info.exit][0]->label), innerExit (blocks[innerInfo.exit][0]->label);
+    string first = maker.make (header + "J"), body = maker.make (innerHeader + "J");
+    string last = maker.make ("JB"), next = maker.make ("UN");
+
+    // the induction variable of every copy starts one step further
+    vector <const Instruction*> top {new Instruction (first.c_str ())};
+    OpCode stepCode = info.up ? OpCode::addI_ : OpCode::subI_;
+    for (size_t c = 0; c < factor; c++) {
+        size_t dst = c + 1 < factor ? rename[c][info.iv] : info.iv;
+        if (c == 0)
+            top.push_back (new Instruction (nullptr, new Operation (OpCode::i2i_, info.iv, 0, dst, 0)));
+        else top.push_back (new Instruction (nullptr, new Operation (stepCode, info.iv, 0, dst, c * info.step)));
+    }
+
+    // the tests are kept only in the last copy, unless something else reads them
+    auto dropTest = [&] (const CountedLoop &test, size_t h) {
+        size_t cond = blocks[test.latch].back ()->op->reg0;
+        return !live.liveIn[h].test (cond) && !live.liveIn[test.exit].test (cond);
+    };
+    bool dropInner = dropTest (innerInfo, inner.header), dropOuter = dropTest (info, loop.header);
+
+    vector <const Instruction*> middle {new Instruction (body.c_str ())}, bottom {new Instruction (last.c_str ())};
+    for (size_t c = 0; c < factor; c++) {
+        bool lastCopy = c + 1 == factor;
+        for (size_t b : before) {
+            for (const Instruction *inst : blocks[b]) {
+                OpCode code = inst->op->code;
+                if (code != OpCode::nop_ && code != OpCode::br_)
+                    top.push_back (copyOf (inst, c));
+            }
+        }
+
+        const auto &block = blocks[inner.header];
+        for (size_t j = 0; j < block.size (); j++) {
+            OpCode code = block[j]->op->code;
+            if (code == OpCode::nop_ || (!lastCopy && (j + 1 == block.size () ||
+                (j == innerInfo.compare && dropInner))))
+                continue;
+            middle.push_back (copyOf (block[j], c));
+        }
+
+        for (size_t b : after) {
+            for (size_t j = 0; j < blocks[b].size (); j++) {
+                OpCode code = blocks[b][j]->op->code;
+                if (code == OpCode::nop_ || code == OpCode::br_ || (!lastCopy && b == info.latch &&
+                    (j + 1 == blocks[b].size () || (j == info.compare && dropOuter))))
+                    continue;
+                bottom.push_back (copyOf (blocks[b][j], c));
+            }
+        }
+    }
+
+    retarget (middle.back (), innerHeader, body);
+    retarget (middle.back (), innerExit, last);
+    retarget (bottom.back (), header, next);
+
+    vector <vector <const Instruction*>> newBlocks;
+    size_t zero = nextReg++, count = nextReg++, again = nextReg++;
+    emitTripCount (info, factor, zero, count, nextReg, maker, first, header, &newBlocks);
+    newBlocks.push_back (std::move (top));
+    newBlocks.push_back (std::move (middle));
+    newBlocks.push_back (std::move (bottom));
+
+    // count down the rounds of jammed loop
+    newBlocks.push_back (vector <const Instruction*> {
+        new Instruction (next.c_str ()),
+        new Instruction (nullptr, new Operation (OpCode::subI_, count, 0, count, 1)),
+        new Instruction (nullptr, new Operation (OpCode::cmp_GT_, count, zero, again)),
+        new Instruction (nullptr, new Operation (OpCode::cbr_, again, 0, 0, 0,
+            first.c_str (), header.c_str ()))});
+
+    placeBeforeHeader (loop, newBlocks, blocks, layout);
+    return "";
+}
+
+void unrollAndJam (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, size_t factor) {
+
+    vector <const Instruction*> code;
+    unordered_set <string> created;
+    insertPreheaders (fromMe, &code, lead, last, edges, &created);
+
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (code, &newLead, &newLast, &newEdges);
+
+    FlowGraph graph (newLead, newLast, newEdges);
+    DominatorTree dom (graph);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (code, graph, &blocks);
+    LabelMaker maker (code);
+    freeMemory (code);
+
+    size_t numRegs = nextUnusedReg (fromMe), nextReg = numRegs;
+    Liveness live (blocks, graph.succ, numRegs);
+
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+
+    // loops with exactly one nested loop are jammed, the report tells
+    // the factor of each, 1 if it is not jammed
+    for (size_t l = 0; factor > 1 && l < forest.loops.size (); l++) {
+        const LoopNest &loop = forest.loops[l];
+        if (loop.children.size () != 1)
+            continue;
+
+        const char *label = blocks[loop.header][0]->label;
+        string name = label != nullptr ? string (label) : "entry";
+        string note = jamLoop (l, factor, graph, dom, forest, live, numRegs, nextReg,
+            maker, blocks, &layout);
+
+        cerr << "jam " << name << ": factor " << (note.empty () ? factor : 1);
+        cerr << " (" << (note.empty () ? "jammed" : note) << ")\n";
+    }
+
+    dropPreheaders (blocks, &layout, created);
+    joinBlocks (blocks, layout, toMe);
+}
+
+// the most operations of a header copied to the end of each latch
+const size_t maxRotatedSize = 16;
+
+void loopRotation (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    FlowGraph graph (lead, last, edges);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+
+    // a loop tested at the top has a header leaving loop by its conditional
+    // branch, copying the header over the branch back to it in each latch
+    // tests the condition at the bottom, the header is left as the guard run
+    // once before the first iteration, and the loop starts after it
+    for (size_t l = 0; l < forest.loops.size (); l++) {
+        const LoopNest &loop = forest.loops[l];
+        size_t h = loop.header;
+        const vector <const Instruction*> &header = blocks[h];
+        if (!loop.reducible || header.back ()->op->code != OpCode::cbr_ ||
+            graph.succ[h].size () != 2 || header.size () > maxRotatedSize)
+            continue;
+
+        size_t inside = 0;
+        for (size_t s : graph.succ[h])
+            inside += forest.contains (l, s);
+        if (inside != 1)
+            continue;
+
+        for (size_t b : loop.latches) {
+            vector <const Instruction*> &latch = blocks[b];
+            OpCode code = latch.back ()->op->code;
+            if (b == h)
+                continue;
+
+            if (code == OpCode::br_) {
+                // a block of only the branch keeps its label on a nop
+                const Instruction *branch = latch.back ();
+                latch.pop_back ();
+                if (branch->label != nullptr)
+                    latch.push_back (new Instruction (branch->label));
+                delete branch;
+            }
+            else if (code == OpCode::cbr_ || b + 1 != h)
+                continue;
+
+            for (const Instruction *inst : header) {
+                if (inst->op->code == OpCode::nop_)
+                    continue;
+                Instruction *copy = new Instruction (inst);
+                if (copy->label != nullptr) {
+                    delete[] copy->label;
+                    copy->label = nullptr;
+                }
+                latch.push_back (copy);
+            }
+        }
+    }
+
+    joinBlocks (blocks, layout, toMe);
+}
+
+// the most operations of a loop copied by unswitching
+const size_t maxUnswitchedSize = 128;
+
+// help to find a block of loop ending in a conditional branch on a register
+// the loop never writes, noBlock when there is none
+static size_t invariantBranch (const vector <vector <const Instruction*>> &blocks,
+    const LoopNest &loop, const vector <size_t> &layout, size_t numRegs) {
+
+    BitVector defined (numRegs);
+    for (size_t b : loop.blocks) {
+        for (const Instruction *inst : blocks[b]) {
+            size_t reg;
+            if (definedReg (inst->op, &reg))
+                defined.set (reg);
+        }
+    }
+
+    for (size_t b : layout) {
+        const Operation *op = blocks[b].back ()->op;
+        if (find (loop.blocks.begin (), loop.blocks.end (), b) != loop.blocks.end () &&
+            op->code == OpCode::cbr_ && !defined.test (op->reg0) &&
+            string (op->label1) != string (op->label2))
+            return b;
+    }
+    return noBlock;
+}
+
+// help to copy the loop for the false outcome of the branch ending 'test',
+// and let the original one run the true outcome, the preheader chooses
+// between them, the copy is placed before the header
+static void unswitchLoop (const LoopNest &loop, size_t test, LabelMaker &maker,
+    vector <vector <const Instruction*>> &blocks, vector <size_t> *layout) {
+
+    vector <size_t> body;
+    for (size_t b : *layout) {
+        if (find (loop.blocks.begin (), loop.blocks.end (), b) != loop.blocks.end ())
+            body.push_back (b);
+    }
+
+    // the block each one falls into
+    vector <size_t> fallInto (blocks.size (), noBlock);
+    for (size_t k = 0; k + 1 < layout->size (); k++) {
+        OpCode code = blocks[(*layout)[k]].back ()->op->code;
+        if (code != OpCode::br_ && code != OpCode::cbr_)
+            fallInto[(*layout)[k]] = (*layout)[k + 1];
+    }
+
+    unordered_map <size_t, string> labels;
+    for (size_t b : body)
+        labels[b] = maker.make (string (blocks[b][0]->label) + "S");
+    auto labelOf = [&] (size_t b) {
+        return labels.count (b) ? labels[b] : string (blocks[b][0]->label);
+    };
+
+    vector <vector <const Instruction*>> newBlocks;
+    for (size_t i = 0; i < body.size (); i++) {
+        size_t b = body[i];
+        vector <const Instruction*> copy;
+        for (const Instruction *old : blocks[b]) {
+            Instruction *inst = new Instruction (old);
+            if (copy.empty ()) {
+                delete [] inst->label;
+                inst->label = strdup (labels[b].c_str ());
+            }
+            for (size_t c : body)
+                retarget (inst, string (blocks[c][0]->label), labels[c]);
+            copy.push_back (inst);
+        }
+
+        if (fallInto[b] != noBlock && (i + 1 == body.size () || fallInto[b] != body[i + 1]))
+            copy.push_back (new Instruction (nullptr, new Operation (
+                OpCode::br_, 0, 0, 0, 0, labelOf (fallInto[b]).c_str ())));
+        newBlocks.push_back (std::move (copy));
+    }
+
+    // the branch becomes a jump to the outcome of each version
+    size_t pos = find (body.begin (), body.end (), test) - body.begin ();
+    size_t cond = blocks[test].back ()->op->reg0;
+    for (auto *block : {&blocks[test], &newBlocks[pos]}) {
+        const Instruction *branch = block->back ();
+        const char *target = block == &blocks[test] ? branch->op->label1 : branch->op->label2;
+        Instruction *jump = new Instruction (nullptr, new Operation (OpCode::br_, 0, 0, 0, 0, target));
+        if (branch->label != nullptr)
+            jump->label = strdup (branch->label);
+        delete branch;
+        block->back () = jump;
+    }
+
+    // the preheader tests the condition once
+    auto &preheader = blocks[loop.preheader];
+    if (preheader.back ()->op->code == OpCode::br_) {
+        const Instruction *jump = preheader.back ();
+        preheader.pop_back ();
+        if (jump->label != nullptr)
+            preheader.push_back (new Instruction (jump->label));
+        delete jump;
+    }
+    string header (blocks[loop.header][0]->label);
+    preheader.push_back (new Instruction (nullptr, new Operation (
+        OpCode::cbr_, cond, 0, 0, 0, header.c_str (), labels[loop.header].c_str ())));
+
+    pos = find (layout->begin (), layout->end (), loop.header) - layout->begin ();
+    for (auto &block : newBlocks) {
+        blocks.push_back (std::move (block));
+        layout->insert (layout->begin () + pos++, blocks.size () - 1);
+    }
+}
+
+void loopUnswitching (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    vector <const Instruction*> code;
+    unordered_set <string> created;
+    insertPreheaders (fromMe, &code, lead, last, edges, &created);
+
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (code, &newLead, &newLast, &newEdges);
+
+    FlowGraph graph (newLead, newLast, newEdges);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (code, graph, &blocks);
+    LabelMaker maker (code);
+    freeMemory (code);
+
+    size_t numRegs = nextUnusedReg (fromMe);
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+
+    // the code may grow by its own size
+    size_t budget = max (fromMe.size (), minGrowthBudget);
+
+    // each loop is unswitched on one branch at most, and loops around
+    // an unswitched one are left alone as their blocks have changed
+    vector <bool> changed (blocks.size (), false);
+    for (const LoopNest &loop : forest.loops) {
+        size_t size = 0;
+        bool touched = false;
+        for (size_t b : loop.blocks) {
+            size += blocks[b].size ();
+            touched = touched || changed[b];
+        }
+        if (!loop.reducible || loop.preheader == noBlock || touched ||
+            size > min (maxUnswitchedSize, budget) ||
+            blocks[loop.preheader].back ()->op->code == OpCode::cbr_)
+            continue;
+
+        size_t test = invariantBranch (blocks, loop, layout, numRegs);
+        if (test == noBlock)
+            continue;
+
+        unswitchLoop (loop, test, maker, blocks, &layout);
+        budget -= size;
+        for (size_t b : loop.blocks)
+            changed[b] = true;
+        changed[loop.preheader] = true;
+    }
+
+    dropPreheaders (blocks, &layout, created);
+
+    // blocks only reached by the branches turned into jumps are dropped
+    unordered_map <string, size_t> blockOf;
+    vector <size_t> position (blocks.size ());
+    for (size_t k = 0; k < layout.size (); k++) {
+        size_t b = layout[k];
+        position[b] = k;
+        if (blocks[b][0]->label != nullptr)
+            blockOf[string (blocks[b][0]->label)] = b;
+    }
+
+    vector <bool> reached (blocks.size (), false);
+    vector <size_t> work {layout[0]};
+    reached[layout[0]] = true;
+    while (work.size ()) {
+        size_t b = work.back ();
+        work.pop_back ();
+
+        const Operation *op = blocks[b].back ()->op;
+        vector <size_t> next;
+        if (op->code == OpCode::br_ || op->code == OpCode::cbr_) {
+            next.push_back (blockOf[string (op->label1)]);
+            if (op->code == OpCode::cbr_)
+                next.push_back (blockOf[string (op->label2)]);
+        }
+        else if (op->code != OpCode::halt_ && position[b] + 1 < layout.size ())
+            next.push_back (layout[position[b] + 1]);
+
+        for (size_t s : next) {
+            if (!reached[s]) {
+                reached[s] = true;
+                work.push_back (s);
+            }
+        }
+    }
+
+    vector <size_t> live;
+    for (size_t b : layout) {
+        if (reached[b])
+            live.push_back (b);
+    }
+
+    vector <const Instruction*> unswitched;
+    joinBlocks (blocks, live, &unswitched);
+
+    // the jumps left in place of branches are folded into the blocks they reach
+    vector <size_t> cleanLead, cleanLast;
+    vector <pair <size_t, size_t>> cleanEdges;
+    buildCFG (unswitched, &cleanLead, &cleanLast, &cleanEdges);
+    cleanControlFlow (unswitched, toMe, cleanLead, cleanLast, cleanEdges);
+    freeMemory (unswitched);
+}
+
+// the most operations in a loop body scheduled by software pipelining, and
+// the most stages of its schedule, dependences between iterations further
+// apart than 'maxDistance' always hold with that many stages
+const size_t maxPipelinedSize = 64;
+const size_t maxStages = 8;
+const long long maxDistance = 2 * maxStages;
+
+// a dependence between operations of loop body, 'to' in the iteration
+// 'distance' after the one of 'from' starts 'delay' cycles after it at least
+struct Dependence {
+    size_t from, to;
+    long long delay, distance;
+};
+
+// help to find the dependences among operations of a loop body, which are
+// kept in order, operations starting in the same cycle are emitted in the
+// order of body, so only the one coming first may start with no delay, the
+// uses in 'rebased' follow the steps of the register they read by their
+// offsets, so they depend on no definition of it
+static void bodyDependences (const vector <const Operation*> &ops,
+    const vector <Affine> &addresses, const unordered_map <size_t, size_t> &rebased,
+    vector <Dependence> *toMe) {
+
+    size_t n = ops.size ();
+    auto order = [] (size_t from, size_t to) { return from < to ? 0LL : 1LL; };
+
+    vector <vector <size_t>> uses (n);
+    vector <size_t> def (n);
+    vector <bool> defines (n);
+    unordered_map <size_t, vector <size_t>> defsOf;
+    for (size_t x = 0; x < n; x++) {
+        usedRegs (ops[x], &uses[x]);
+        defines[x] = definedReg (ops[x], &def[x]);
+        if (defines[x])
+            defsOf[def[x]].push_back (x);
+    }
+
+    // a use reads the last definition before it, from the previous iteration
+    // when there is none, and comes before the next definition
+    for (size_t y = 0; y < n; y++) {
+        auto base = rebased.find (y);
+        for (size_t reg : uses[y]) {
+            auto it = defsOf.find (reg);
+            if (it == defsOf.end () || (base != rebased.end () && base->second == reg))
+                continue;
+            const vector <size_t> &defs = it->second;
+
+            auto next = upper_bound (defs.begin (), defs.end (), y);
+            auto reaching = lower_bound (defs.begin (), defs.end (), y);
+            if (reaching != defs.begin ()) {
+                size_t x = *(reaching - 1);
+                toMe->push_back (Dependence {x, y, (long long) latency (ops[x]->code), 0});
+            }
+            else toMe->push_back (Dependence {defs.back (), y, (long long) latency (ops[defs.back ()]->code), 1});
+
+            if (next != defs.end ())
+                toMe->push_back (Dependence {y, *next, order (y, *next), 0});
+            else toMe->push_back (Dependence {y, defs.front (), order (y, defs.front ()), 1});
+        }
+    }
+
+    // definitions of a register stay in order
+    for (const auto &entry : defsOf) {
+        const vector <size_t> &defs = entry.second;
+        for (size_t k = 0; k + 1 < defs.size (); k++)
+            toMe->push_back (Dependence {defs[k], defs[k + 1], 1, 0});
+        toMe->push_back (Dependence {defs.back (), defs.front (), order (defs.back (), defs.front ()), 1});
+    }
+
+    // accesses to memory stay in order when one of them stores and they may
+    // overlap, the first iteration where they do gives the distance
+    auto overlap = [&] (size_t x, size_t y, long long d) {
+        const Affine &a = addresses[x], &b = addresses[y];
+        if (!a.known || !b.known || a.symbols != b.symbols || a.outer != b.outer)
+            return true;
+        long long dist = b.outer * d + b.constant - a.constant;
+        return -(long long) widthOf (ops[y]->code) < dist && dist < (long long) widthOf (ops[x]->code);
+    };
+
+    for (size_t x = 0; x < n; x++) {
+        for (size_t y = 0; y < n; y++) {
+            OpCode cx = ops[x]->code, cy = ops[y]->code;
+            bool mx = cx >= OpCode::load_ && cx <= OpCode::cstoreAO_;
+            bool my = cy >= OpCode::load_ && cy <= OpCode::cstoreAO_;
+            if (!mx || !my || (cx < OpCode::store_ && cy < OpCode::store_))
+                continue;
+
+            long long delay = cx >= OpCode::store_ && cy < OpCode::store_ ?
+                latency (cx) : order (x, y);
+            for (long long d = x < y ? 0 : 1; d <= maxDistance; d++) {
+                if (overlap (x, y, d)) {
+                    toMe->push_back (Dependence {x, y, delay, d});
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// help to tell whether some cycle of dependences needs more than 'ii'
+// cycles per iteration, by the longest paths among operations
+static bool tooShort (size_t n, const vector <Dependence> &deps, long long ii) {
+    const long long none = std::numeric_limits<long long>::min () / 2;
+    vector <vector <long long>> path (n, vector <long long> (n, none));
+    for (const Dependence &dep : deps)
+        path[dep.from][dep.to] = max (path[dep.from][dep.to], dep.delay - ii * dep.distance);
+
+    for (size_t k = 0; k < n; k++) {
+        for (size_t i = 0; i < n; i++) {
+            if (path[i][k] == none)
+                continue;
+            for (size_t j = 0; j < n; j++) {
+                if (path[k][j] != none)
+                    path[i][j] = max (path[i][j], path[i][k] + path[k][j]);
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (path[i][i] > 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+// help to place operations in a schedule repeating every 'ii' cycles, by
+// iterative modulo scheduling, the operation with the longest path to the
+// end goes first, into the earliest cycle after its predecessors with free
+// resources, otherwise it displaces the operations in its way, which are
+// placed again, until all are placed or the budget runs out
+static bool moduloSchedule (const vector <const Operation*> &ops,
+    const vector <Dependence> &deps, long long ii, const Machine &machine,
+    vector <long long> *time) {
+
+    size_t n = ops.size ();
+    vector <vector <const Dependence*>> in (n), out (n);
+    for (const Dependence &dep : deps) {
+        in[dep.to].push_back (&dep);
+        out[dep.from].push_back (&dep);
+    }
+
+    vector <long long> height (n, 0);
+    for (size_t round = 0; round < n; round++) {
+        for (const Dependence &dep : deps)
+            height[dep.from] = max (height[dep.from], height[dep.to] + dep.delay - ii * dep.distance);
+    }
+
+    vector <size_t> order;
+    for (size_t x = 0; x < n; x++)
+        order.push_back (x);
+    stable_sort (order.begin (), order.end (), [&] (size_t a, size_t b) {
+        return height[a] > height[b];
+    });
+
+    // the operations placed in each row of the modulo reservation table
+    vector <vector <size_t>> rows (ii);
+    auto fits = [&] (size_t x, long long row) {
+        size_t slots = 0, memory = 0, multiply = 0;
+        for (size_t y : rows[row]) {
+            slots++;
+            memory += usesMemory (ops[y]->code);
+            multiply += usesMultiplier (ops[y]->code);
+        }
+        return slots < machine.width &&
+            (!usesMemory (ops[x]->code) || memory < machine.memory) &&
+            (!usesMultiplier (ops[x]->code) || multiply < machine.multiply);
+    };
+    auto remove = [&] (size_t y) {
+        auto &row = rows[(*time)[y] % ii];
+        row.erase (find (row.begin (), row.end (), y));
+        (*time)[y] = -1;
+    };
+
+    time->assign (n, -1);
+    vector <long long> last (n, -1);
+    for (size_t budget = 4 * n; budget > 0; budget--) {
+        size_t x = n;
+        for (size_t y : order) {
+            if ((*time)[y] < 0) {
+                x = y;
+                break;
+            }
+        }
+        if (x == n)
+            return true;
+
+        long long start = 0;
+        for (const Dependence *dep : in[x]) {
+            if ((*time)[dep->from] >= 0)
+                start = max (start, (*time)[dep->from] + dep->delay - ii * dep->distance);
+        }
+
+        long long at = -1;
+        for (long long t = start; t < start + ii && at < 0; t++) {
+            if (fits (x, t % ii))
+                at = t;
+        }
+        if (at < 0)
+            at = last[x] < 0 || start > last[x] ? start : last[x] + 1;
+
+        // make room in the row, then displace successors now too early
+        while (!fits (x, at % ii)) {
+            const auto &row = rows[at % ii];
+            size_t victim = row.front ();
+            for (size_t y : row) {
+                if ((usesMemory (ops[x]->code) && usesMemory (ops[y]->code)) ||
+                    (usesMultiplier (ops[x]->code) && usesMultiplier (ops[y]->code)))
+                    victim = y;
+            }
+            remove (victim);
+        }
+        for (const Dependence *dep : out[x]) {
+            if (dep->to != x && (*time)[dep->to] >= 0 &&
+                (*time)[dep->to] < at + dep->delay - ii * dep->distance)
+                remove (dep->to);
+        }
+
+        (*time)[x] = last[x] = at;
+        rows[at % ii].push_back (x);
+    }
+    return find (time->begin (), time->end (), -1) == time->end ();
+}
+
+// help to replace a counted loop of one block by a software pipeline, the
+// prologue starts the first iterations stage by stage, the kernel runs one
+// stage of each iteration in flight, and the epilogue finishes the last
+// ones, loops running fewer times than stages go to the original loop,
+// the reason it is not pipelined is returned, or the schedule found
+static string pipelineLoop (size_t l, const FlowGraph &graph, const DominatorTree &dom,
+    const LoopForest &forest, const Liveness &live, const Machine &machine,
+    size_t &nextReg, LabelMaker &maker,
+    vector <vector <const Instruction*>> &blocks, vector <size_t> *layout) {
+
+    const LoopNest &loop = forest.loops[l];
+    CountedLoop info;
+    if (loop.blocks.size () != 1)
+        return "not a single block";
+    if (!countedLoop (blocks, dom, forest, l, &info))
+        return "not a counted loop";
+
+    // the operations of body, without its label and branch, and without the
+    // comparison read by the branch unless something else reads it
+    const auto &block = blocks[loop.header];
+    size_t cond = block.back ()->op->reg0;
+    bool dropTest = !live.liveIn[loop.header].test (cond) && !live.liveIn[info.exit].test (cond);
+
+    vector <const Instruction*> body;
+    vector <const Operation*> ops;
+    for (size_t j = 0; j + 1 < block.size (); j++) {
+        OpCode code = block[j]->op->code;
+        if (code >= OpCode::read_)
+            return "input or output";
+        if (code != OpCode::nop_ && !(j == info.compare && dropTest)) {
+            body.push_back (block[j]);
+            ops.push_back (block[j]->op);
+        }
+    }
+    size_t n = ops.size ();
+    if (n == 0 || n > maxPipelinedSize)
+        return n ? "body too large" : "empty body";
+
+    // registers stepped by a constant are linear in the iteration number
+    unordered_map <size_t, size_t> defCount;
+    for (const Operation *op : ops) {
+        size_t reg;
+        if (definedReg (op, &reg))
+            defCount[reg]++;
+    }
+
+    unordered_map <size_t, Affine> env;
+    for (const Operation *op : ops) {
+        size_t reg;
+        if (!definedReg (op, &reg))
+            continue;
+        env[reg] = Affine ();
+        if ((op->code == OpCode::addI_ || op->code == OpCode::subI_) &&
+            op->reg0 == reg && defCount[reg] == 1) {
+            long long value;
+            env[reg] = constantAt (blocks, graph, loop.preheader, reg, &value) ?
+                Affine (true, value) : symbolOf (reg);
+            env[reg].outer = op->code == OpCode::addI_ ? op->constant : -op->constant;
+        }
+    }
+
+    auto valueOf = [&] (size_t reg) {
+        auto it = env.find (reg);
+        if (it != env.end ())
+            return it->second;
+        long long value;
+        if (constantAt (blocks, graph, loop.preheader, reg, &value))
+            return Affine (true, value);
+        return symbolOf (reg);
+    };
+
+    vector <Affine> addresses (n);
+    for (size_t x = 0; x < n; x++) {
+        OpCode code = ops[x]->code;
+        if (code >= OpCode::load_ && code <= OpCode::cstoreAO_)
+            addresses[x] = addressOf (ops[x], valueOf);
+        size_t reg;
+        if (definedReg (ops[x], &reg))
+            env[reg] = affineOf (ops[x], valueOf);
+    }
+
+    // a register stepped once by a constant and read otherwise only as the
+    // base of accesses or by immediate adds is followed by the offsets of
+    // these uses, rebased for each copy by the steps it runs ahead of or
+    // behind its iteration, so no use waits on the step or holds it back
+    unordered_map <size_t, size_t> stepAt, rebased;
+    for (size_t x = 0; x < n; x++) {
+        const Operation *op = ops[x];
+        if ((op->code == OpCode::addI_ || op->code == OpCode::subI_) &&
+            op->reg0 == op->reg2 && defCount[op->reg2] == 1)
+            stepAt[op->reg2] = x;
+    }
+
+    auto baseOf = [&] (size_t x, size_t *reg) {
+        const Operation *op = ops[x];
+        switch (op->code) {
+            case OpCode::load_: case OpCode::loadAI_: case OpCode::cload_:
+            case OpCode::cloadAI_: case OpCode::addI_:
+                *reg = op->reg0;
+                return true;
+            case OpCode::store_: case OpCode::storeAI_: case OpCode::cstore_:
+            case OpCode::cstoreAI_:
+                *reg = op->reg1;
+                return op->reg0 != op->reg1;
+            default:
+                return false;
+        }
+    };
+
+    unordered_set <size_t> pinned;
+    for (size_t x = 0; x < n; x++) {
+        vector <size_t> regs;
+        usedRegs (ops[x], &regs);
+        for (size_t reg : regs) {
+            auto it = stepAt.find (reg);
+            size_t base;
+            if (it == stepAt.end () || it->second == x)
+                continue;
+            if (baseOf (x, &base) && base == reg)
+                rebased[x] = reg;
+            else pinned.insert (reg);
+        }
+    }
+    for (auto it = rebased.begin (); it != rebased.end (); ) {
+        if (pinned.count (it->second))
+            it = rebased.erase (it);
+        else it++;
+    }
+
+    vector <Dependence> deps;
+    bodyDependences (ops, addresses, rebased, &deps);
+
+    // the bounds on the interval between iterations set by resources and
+    // by cycles of dependences
+    size_t memory = 0, multiply = 0;
+    for (const Operation *op : ops) {
+        memory += usesMemory (op->code);
+        multiply += usesMultiplier (op->code);
+    }
+    auto ceilDiv = [] (size_t a, size_t b) { return (long long) ((a + b - 1) / b); };
+    long long resMII = max (ceilDiv (n, machine.width), max (ceilDiv (memory, machine.memory),
+        ceilDiv (multiply, machine.multiply)));
+
+    long long lo = 1, hi = 1;
+    for (const Dependence &dep : deps)
+        hi += dep.delay;
+    while (lo < hi) {
+        long long mid = (lo + hi) / 2;
+        if (tooShort (n, deps, mid))
+            lo = mid + 1;
+        else hi = mid;
+    }
+    long long recMII = lo;
+
+    // a longer interval makes room for more operations in each row, though
+    // once it passes the length of body it stops paying off
+    vector <long long> time;
+    long long ii = max (resMII, recMII), stages = 0;
+    for (; ii <= max (resMII, recMII) + (long long) n; ii++) {
+        if (!moduloSchedule (ops, deps, ii, machine, &time))
+            continue;
+        stages = *max_element (time.begin (), time.end ()) / ii + 1;
+        if (stages <= (long long) maxStages)
+            break;
+    }
+
+    string bounds = "ResMII " + to_string (resMII) + ", RecMII " + to_string (recMII);
+    if (stages == 0 || stages > (long long) maxStages)
+        return "no schedule, " + bounds;
+    if (stages == 1)
+        return "one stage, II " + to_string (ii) + ", " + bounds;
+
+    // operations of the iterations in flight, by the cycle they start and
+    // their order in body, as they run when the loop runs 'stages' times,
+    // that is the prologue, one round of the kernel and the epilogue, a use
+    // of a stepped register reads it stepped 'ahead' more times than in the
+    // loop, which is the same in each round of the kernel
+    vector <vector <pair <size_t, long long>>> parts (3);
+    unordered_map <size_t, long long> seen;
+    for (long long c = 0; c < (2 * stages - 1) * ii; c++) {
+        auto &part = parts[c < (stages - 1) * ii ? 0 : c < stages * ii ? 1 : 2];
+        for (size_t x = 0; x < n; x++) {
+            if (c < time[x] || (c - time[x]) % ii != 0 || (c - time[x]) / ii >= stages)
+                continue;
+            long long ahead = 0;
+            auto it = rebased.find (x);
+            if (it != rebased.end ())
+                ahead = seen[it->second] - (c - time[x]) / ii - (stepAt[it->second] < x);
+            size_t reg;
+            if (definedReg (ops[x], &reg) && stepAt.count (reg))
+                seen[reg]++;
+            part.push_back ({x, ahead});
+        }
+    }
+
+    // the offsets rebased stay positive by lowering the registers they read
+    // for the pipeline, by the most any offset goes below zero
+    auto stepOf = [&] (size_t reg) {
+        const Operation *op = ops[stepAt[reg]];
+        return op->code == OpCode::addI_ ? (long long) op->constant : -(long long) op->constant;
+    };
+    auto offsetOf = [&] (size_t x) {
+        OpCode code = ops[x]->code;
+        bool none = code == OpCode::load_ || code == OpCode::cload_ ||
+            code == OpCode::store_ || code == OpCode::cstore_;
+        return none ? 0LL : (long long) ops[x]->constant;
+    };
+
+    unordered_map <size_t, long long> bias;
+    for (const auto &part : parts) {
+        for (const auto &copy : part) {
+            auto it = rebased.find (copy.first);
+            if (it != rebased.end ())
+                bias[it->second] = max (bias[it->second], copy.second * stepOf (it->second) - offsetOf (copy.first));
+        }
+    }
+    for (const auto &part : parts) {
+        for (const auto &copy : part) {
+            auto it = rebased.find (copy.first);
+            if (it != rebased.end () && (!isEncodable (bias[it->second]) ||
+                !isEncodable (offsetOf (copy.first) - copy.second * stepOf (it->second) + bias[it->second])))
+                return "offsets out of range, " + bounds;
+        }
+    }
+
+    auto copyOf = [&] (const pair <size_t, long long> &copy) {
+        Instruction *inst = new Instruction (body[copy.first]);
+        delete [] inst->label;
+        inst->label = nullptr;
+
+        auto it = rebased.find (copy.first);
+        long long offset = it == rebased.end () ? 0 :
+            offsetOf (copy.first) - copy.second * stepOf (it->second) + bias[it->second];
+        if (it != rebased.end () && offset != offsetOf (copy.first)) {
+            Operation *op = inst->op;
+            switch (op->code) {
+                case OpCode::load_: op->code = OpCode::loadAI_; break;
+                case OpCode::cload_: op->code = OpCode::cloadAI_; break;
+                case OpCode::store_: op->code = OpCode::storeAI_; break;
+                case OpCode::cstore_: op->code = OpCode::cstoreAI_; break;
+                default: break;
+            }
+            op->constant = offset;
+        }
+        return inst;
+    };
+    auto emit = [&] (vector <const Instruction*> &to, const vector <pair <size_t, long long>> &part) {
+        for (const auto &copy : part)
+            to.push_back (copyOf (copy));
+    };
+
+    string header (blocks[loop.header][0]->label), exit (blocks[info.exit][0]->label);
+    string prologue = maker.make (header + "P"), kernel = maker.make (header + "K");
+    string epilogue = maker.make (header + "E");
+
+    vector <vector <const Instruction*>> newBlocks;
+    size_t zero = nextReg++, count = nextReg++, rounds = nextReg++, again = nextReg++;
+    size_t trips = emitTripCount (info, stages, zero, count, nextReg, maker, prologue, header, &newBlocks);
+
+    // the prologue starts all but the last of the first 'stages' iterations
+    vector <const Instruction*> pro {new Instruction (prologue.c_str ()),
+        new Instruction (nullptr, new Operation (OpCode::subI_, trips, 0, rounds, stages - 1))};
+    for (size_t x = 0; x < n; x++) {
+        size_t reg;
+        if (definedReg (ops[x], &reg) && stepAt.count (reg) && stepAt[reg] == x && bias[reg] > 0)
+            pro.push_back (new Instruction (nullptr, new Operation (OpCode::subI_, reg, 0, reg, bias[reg])));
+    }
+    emit (pro, parts[0]);
+    newBlocks.push_back (std::move (pro));
+
+    vector <const Instruction*> ker {new Instruction (kernel.c_str ())};
+    emit (ker, parts[1]);
+    ker.push_back (new Instruction (nullptr, new Operation (OpCode::subI_, rounds, 0, rounds, 1)));
+    ker.push_back (new Instruction (nullptr, new Operation (OpCode::cmp_GT_, rounds, zero, again)));
+    ker.push_back (new Instruction (nullptr, new Operation (OpCode::cbr_, again, 0, 0, 0,
+        kernel.c_str (), epilogue.c_str ())));
+    newBlocks.push_back (std::move (ker));
+
+    vector <const Instruction*> epi {new Instruction (epilogue.c_str ())};
+    emit (epi, parts[2]);
+    for (size_t x = 0; x < n; x++) {
+        size_t reg;
+        if (definedReg (ops[x], &reg) && stepAt.count (reg) && stepAt[reg] == x && bias[reg] > 0)
+            epi.push_back (new Instruction (nullptr, new Operation (OpCode::addI_, reg, 0, reg, bias[reg])));
+    }
+    epi.push_back (new Instruction (nullptr, new Operation (OpCode::br_, 0, 0, 0, 0, exit.c_str ())));
+    newBlocks.push_back (std::move (epi));
+
+    placeBeforeHeader (loop, newBlocks, blocks, layout);
+    return "II " + to_string (ii) + ", " + bounds + ", " + to_string (stages) + " stages";
+}
+
+void softwarePipelining (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    vector <const Instruction*> code;
+    unordered_set <string> created;
+    insertPreheaders (fromMe, &code, lead, last, edges, &created);
+
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (code, &newLead, &newLast, &newEdges);
+
+    FlowGraph graph (newLead, newLast, newEdges);
+    DominatorTree dom (graph);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (code, graph, &blocks);
+    LabelMaker maker (code);
+    freeMemory (code);
+
+    size_t numRegs = nextUnusedReg (fromMe), nextReg = numRegs;
+    Liveness live (blocks, graph.succ, numRegs);
+
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+
+    // innermost loops are pipelined, the report tells the interval between
+    // iterations of each, with its bounds by resources and by recurrences
+    Machine machine;
+    for (size_t l = 0; l < forest.loops.size (); l++) {
+        const LoopNest &loop = forest.loops[l];
+        if (loop.children.size ())
+            continue;
+
+        const char *label = blocks[loop.header][0]->label;
+        string name = label != nullptr ? string (label) : "entry";
+        cerr << "pipeline " << name << ": " << pipelineLoop (l, graph, dom, forest, live, machine,
+            nextReg, maker, blocks, &layout) << "\n";
+    }
+
+    dropPreheaders (blocks, &layout, created);
+    joinBlocks (blocks, layout, toMe);
+}
@@ -1,10 +1,9 @@
 #include <algorithm>
-#include <cmath>
 #include <iostream>
 #include <limits>
-#include <queue>
 #include <unordered_set>
 
+#include "../headers/analysis.h"
 #include "../headers/optim.h"
 #include "../headers/struct.h"
 #include "../headers/util.h"
@@ -75,9 +74,83 @@ void buildCFG (const vector <const Instruction*> &fromMe, vector <size_t> *lead,
     }
 }
 
+// help to simplify an operation from the value numbers of its operands, the
+// result is either the constant 'value', or the value of operand 'which'
+static bool simplify (OpCode code, size_t lhs, size_t rhs,
+    const unordered_map <size_t, long long> &constVal,
+    bool *known, long long *value, size_t *which) {
+
+    bool lhsKnown = constVal.find (lhs) != constVal.end ();
+    bool rhsKnown = constVal.find (rhs) != constVal.end ();
+    long long lhsVal = lhsKnown ? constVal.at (lhs) : 0;
+    long long rhsVal = rhsKnown ? constVal.at (rhs) : 0;
+
+    auto constant = [&] (long long c) {
+        *known = true;
+        *value = c;
+        return true;
+    };
+    auto operand = [&] (size_t k) {
+        *known = false;
+        *which = k;
+        return true;
+    };
+
+    // both operands are known, e.g. 4 + 5 is 9
+    long long res;
+    if (lhsKnown && (rhsKnown || code == OpCode::not_) && evaluate (code, lhsVal, rhsVal, &res))
+        return isEncodable (res) && constant (res);
+    if (code == OpCode::not_)
+        return false;
+
+    // x - x is 0, x and x and x or x are x, and comparing x with x is known
+    if (lhs == rhs) {
+        switch (code) {
+            case OpCode::sub_: return constant (0);
+            case OpCode::and_: case OpCode::or_: return operand (0);
+            case OpCode::cmp_LT_: case OpCode::cmp_GT_: case OpCode::cmp_NE_: return constant (0);
+            case OpCode::cmp_LE_: case OpCode::cmp_GE_: case OpCode::cmp_EQ_: return constant (1);
+            default: break;
+        }
+    }
+
+    // x * 0 and x and 0 are 0
+    bool absorb = code == OpCode::mult_ || code == OpCode::multI_ ||
+        code == OpCode::and_ || code == OpCode::andI_;
+    if (absorb && ((lhsKnown && lhsVal == 0) || (rhsKnown && rhsVal == 0)))
+        return constant (0);
+
+    // x + 0, x - 0, x or 0, shifts by 0, x * 1 and x / 1 are x
+    bool zero = code == OpCode::add_ || code == OpCode::addI_ || code == OpCode::sub_ ||
+        code == OpCode::subI_ || code == OpCode::or_ || code == OpCode::orI_ ||
+        code == OpCode::lshift_ || code == OpCode::lshiftI_ ||
+        code == OpCode::rshift_ || code == OpCode::rshiftI_;
+    bool one = code == OpCode::mult_ || code == OpCode::multI_ ||
+        code == OpCode::div_ || code == OpCode::divI_;
+    long long neutral = one ? 1 : 0;
+    if ((zero || one) && rhsKnown && rhsVal == neutral)
+        return operand (0);
+    if ((zero || one) && isCommutative (code) && lhsKnown && lhsVal == neutral)
+        return operand (1);
+    return false;
+}
+
+// whether the bytes of two memory values may overlap, which is ruled out
+// only for known offsets from the same base
+static bool mayOverlap (const MemoryValue &a, const MemoryValue &b) {
+    if (a.base != b.base || !a.known || !b.known)
+        return true;
+    return a.offset < b.offset + (long long) b.width && b.offset < a.offset + (long long) a.width;
+}
+
+static bool sameAddress (const MemoryValue &a, const MemoryValue &b) {
+    return a.base == b.base && a.known == b.known && a.offset == b.offset && a.width == b.width;
+}
+
 void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, size_t last, 
     HashMaps &hashMaps, unordered_set <size_t> &removal, 
-    unordered_map <size_t, RewriteInfo> &rewrite, size_t &nextReg) {
+    unordered_map <size_t, RewriteInfo> &rewrite, 
+    unordered_map <size_t, FoldInfo> &folded, size_t &nextReg) {
 
     // maps variable or constant or expression to value number
     unordered_map <string, size_t> &valDict = hashMaps.valDict;
@@ -89,14 +162,96 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
     // maps old variable name to new variable name
     unordered_map <string, string> &renameMap = hashMaps.renameMap;
 
+    // maps value number to the constant it is known to be
+    unordered_map <size_t, long long> &constVal = hashMaps.constVal;
+
     // get the next value
     size_t nextVal = 0;
     for (const auto &keyVal : valDict)
         nextVal = max (nextVal, keyVal.second);
 
+    // get the value number of constant
+    auto numberConstant = [&] (const string &constant) {
+        if (valDict.find (constant) == valDict.end ()) {
+            valDict[constant] = ++nextVal;
+            constVal[nextVal] = stoll (constant);
+        }
+        return valDict[constant];
+    };
+
+    // values known to be in memory
+    vector <MemoryValue> &memory = hashMaps.memory;
+
+    // get the value number of register, which has the most recent name
+    auto numberOf = [&] (size_t reg) {
+        string name = "r" + to_string (reg);
+        name = (renameMap.find (name) == renameMap.end ()) ? name : renameMap[name];
+        if (valDict.find (name) == valDict.end ())
+            valDict[name] = ++nextVal;
+        return valDict[name];
+    };
+
+    // get the address of load or store as a base and an offset, a constant
+    // base is folded into the offset
+    auto addressOf = [&] (const Operation *op) {
+        bool store = op->code >= OpCode::store_ && op->code <= OpCode::cstoreAO_;
+        bool byte = (op->code >= OpCode::cload_ && op->code <= OpCode::cloadAO_) ||
+            op->code >= OpCode::cstore_;
+
+        MemoryValue addr {numberOf (store ? op->reg1 : op->reg0), true, 0, byte ? 1u : 4u, 0, 0};
+        if (op->code == OpCode::loadAI_ || op->code == OpCode::cloadAI_ ||
+            op->code == OpCode::storeAI_ || op->code == OpCode::cstoreAI_)
+            addr.offset = (long long) op->constant;
+
+        else if (op->code == OpCode::loadAO_ || op->code == OpCode::cloadAO_ ||
+            op->code == OpCode::storeAO_ || op->code == OpCode::cstoreAO_) {
+            size_t offset = numberOf (store ? op->reg2 : op->reg1);
+            if (constVal.find (offset) != constVal.end ())
+                addr.offset = constVal[offset];
+            else if (constVal.find (addr.base) != constVal.end ()) {
+                addr.offset = constVal[addr.base];
+                addr.base = offset;
+            }
+            else {
+                addr.known = false;
+                addr.offset = offset;
+            }
+        }
+
+        if (addr.known && constVal.find (addr.base) != constVal.end ()) {
+            addr.offset += constVal[addr.base];
+            addr.base = 0;
+        }
+        return addr;
+    };
+
     for (size_t i = lead; i <= last; i++) {
         OpCode code = fromMe[i]->op->code;
 
+        // a store drops the values in memory it may overwrite, then a word
+        // stored is known to be there, while a byte stored is only part of it
+        if (code >= OpCode::store_ && code <= OpCode::cstoreAO_) {
+            MemoryValue addr = addressOf (fromMe[i]->op);
+            size_t value = numberOf (fromMe[i]->op->reg0);
+
+            // when memory holds the value already
+            auto same = find_if (memory.begin (), memory.end (),
+                [&] (const MemoryValue &m) { return sameAddress (m, addr); });
+            if (same != memory.end () && same->value == value) {
+                removal.insert (i);
+                continue;
+            }
+
+            memory.erase (remove_if (memory.begin (), memory.end (),
+                [&] (const MemoryValue &m) { return mayOverlap (m, addr); }), memory.end ());
+            if (addr.width == 4) {
+                addr.value = value;
+                addr.holder = fromMe[i]->op->reg0;
+                memory.push_back (addr);
+            }
+            continue;
+        }
+
         if (opcodeMap[code - OpCode::nop_] > 5)
             continue;
 
@@ -113,6 +268,30 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
         reg1 = (renameMap.find (reg1) == renameMap.end ()) ? reg1 : renameMap[reg1];
         reg2 = (renameMap.find (reg2) == renameMap.end ()) ? reg2 : renameMap[reg2];
 
+        // give variable 'reg2' a value computed before, as a copy does
+        auto assign = [&] (size_t rvalue) {
+            // when variable 'reg2' has not been assigned yet
+            if (valDict.find (reg2) == valDict.end ())
+                valDict[reg2] = rvalue;
+
+            // when variable 'reg2' changes value, rename it
+            else if (valDict[reg2] != rvalue) {
+                // memorize the #line where the variable is re-written
+                // note that only the smallest #line is kept, and only for values
+                // computed here, not constants, copies or values from before
+                if (varDict.find (valDict[reg2]) != varDict.end () &&
+                    varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
+                    varDict[valDict[reg2]].second = i - 1;
+
+                string newName = "r" + to_string (nextReg++);
+                renameMap[reg2Init] = newName;
+                valDict[newName] = rvalue;
+            }
+
+            // when the instruction has no effect
+            else removal.insert (i);
+        };
+
         // number the values
         size_t key = opcodeMap[code - OpCode::nop_];
         switch (key) {
@@ -136,8 +315,7 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
 
                 else if (key == 1) {
                     // when constant number 'constant' has not been used
-                    if (valDict.find (constant) == valDict.end ())
-                        valDict[constant] = ++nextVal;
+                    numberConstant (constant);
                     tag = makeHashTag (code, valDict[reg0],
                                        std::numeric_limits<int>::max(),
                                        valDict[constant]);
@@ -147,6 +325,27 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
                 else tag = makeHashTag (code, valDict[reg0],
                                         std::numeric_limits<int>::max(), 0);
 
+                // when the value follows from the values of the operands, the
+                // operation becomes 'loadI' of it or 'i2i' of the operand
+                bool known;
+                long long value;
+                size_t which;
+                size_t rhs = key == 0 ? valDict[reg1] : key == 1 ? valDict[constant] : 0;
+                if (simplify (code, valDict[reg0], rhs, constVal, &known, &value, &which)) {
+                    size_t rvalue;
+                    if (known) {
+                        rvalue = numberConstant (to_string (value));
+                        folded[i] = FoldInfo (OpCode::loadI_, value);
+                    }
+                    else {
+                        rvalue = which == 0 ? valDict[reg0] : rhs;
+                        folded[i] = FoldInfo (OpCode::i2i_,
+                            which == 0 ? fromMe[i]->op->reg0 : fromMe[i]->op->reg1);
+                    }
+                    assign (rvalue);
+                    break;
+                }
+
                 // when the expression has been evaluated
                 if (valDict.find (tag) != valDict.end ()) {
                     size_t rvalue = valDict[tag];
@@ -158,8 +357,10 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
                     // when variable 'reg2' changes value, rename it
                     else if (valDict[reg2] != rvalue) {
                         // memorize the #line where the variable is re-written
-                        // note that only the smallest #line is kept
-                        if (varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
+                        // note that only the smallest #line is kept, and only for values
+                        // computed here, not constants, copies or values from before
+                        if (varDict.find (valDict[reg2]) != varDict.end () &&
+                            varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
                             varDict[valDict[reg2]].second = i - 1;
 
                         string newName = "r" + to_string (nextReg++);
@@ -194,8 +395,10 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
                     // when variable 'reg2' changes value, rename it
                     else if (valDict[reg2] != lvalue) {
                         // memorize the #line where the variable is re-written
-                        // note that only the smallest #line is kept
-                        if (varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
+                        // note that only the smallest #line is kept, and only for values
+                        // computed here, not constants, copies or values from before
+                        if (varDict.find (valDict[reg2]) != varDict.end () &&
+                            varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
                             varDict[valDict[reg2]].second = i - 1;
 
                         string newName = "r" + to_string (nextReg++);
@@ -223,36 +426,46 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
 
                 else { // the case where opcode is 'loadI'
                     // when constant number 'constant' has not been used
-                    if (valDict.find (constant) == valDict.end ())
-                        valDict[constant] = ++nextVal;
-                    rvalue = valDict[constant];
+                    rvalue = numberConstant (constant);
                 }
 
-                // when variable 'reg2' has not been assigned yet
-                if (valDict.find (reg2) == valDict.end ())
-                    valDict[reg2] = rvalue;
-
-                // when variable 'reg2' changes value, rename it
-                else if (valDict[reg2] != rvalue) {
-                    // memorize the #line where the variable is re-written
-                    // note that only the smallest #line is kept
-                    if (varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
-                        varDict[valDict[reg2]].second = i - 1;
-
-                    string newName = "r" + to_string (nextReg++);
-                    renameMap[reg2Init] = newName;
-                    valDict[newName] = rvalue;
-                }
-
-                // when the instruction has no effect
-                else removal.insert (i);
-
+                assign (rvalue);
                 break;
             }
 
             case 3: // opcode 'load', 'loadAI', 'loadAO', 'cload', 
                     // 'cloadAI', 'cloadAO', 'read', 'cread'
             {
+                MemoryValue addr;
+                bool load = code != OpCode::read_ && code != OpCode::cread_;
+                if (load)
+                    addr = addressOf (fromMe[i]->op);
+
+                // when the value at the address is known, the load becomes a
+                // copy of the register holding it, or of the one memorized
+                auto known = find_if (memory.begin (), memory.end (),
+                    [&] (const MemoryValue &m) { return load && sameAddress (m, addr); });
+                if (known != memory.end ()) {
+                    size_t rvalue = known->value, holder = known->holder;
+                    bool held = numberOf (holder) == rvalue;
+
+                    assign (rvalue);
+                    if (removal.find (i) != removal.end ())
+                        break;
+
+                    if (held)
+                        folded[i] = FoldInfo (OpCode::i2i_, holder);
+                    else if (constVal.find (rvalue) != constVal.end () && isEncodable (constVal[rvalue]))
+                        folded[i] = FoldInfo (OpCode::loadI_, constVal[rvalue]);
+                    else if (varDict.find (rvalue) != varDict.end ()) {
+                        auto &lines = varDict[rvalue];
+                        rewrite[lines.first].first = lines.second;
+                        rewrite[lines.first].second.push_back (i);
+                    }
+                    known->holder = fromMe[i]->op->reg2;
+                    break;
+                }
+
                 size_t lvalue = ++nextVal;
 
                 // when variable 'reg2' has not been assigned yet
@@ -262,8 +475,10 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
                 // when variable 'reg2' has been assigned before
                 else {
                     // memorize the #line where the variable is re-written
-                    // note that only the smallest #line is kept
-                    if (varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
+                    // note that only the smallest #line is kept, and only for values
+                    // computed here, not constants, copies or values from before
+                    if (varDict.find (valDict[reg2]) != varDict.end () &&
+                        varDict[valDict[reg2]].second == std::numeric_limits<int>::max())
                         varDict[valDict[reg2]].second = i - 1;
                     
                     // since we don't know the loaded value, rename variable 'reg2' directly
@@ -274,6 +489,11 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
 
                 varDict[lvalue] = make_pair (i, std::numeric_limits<int>::max());
 
+                if (load) {
+                    addr.value = lvalue;
+                    addr.holder = fromMe[i]->op->reg2;
+                    memory.push_back (addr);
+                }
                 break;
             }
 
@@ -282,226 +502,6 @@ void valueNumbering (const vector <const Instruction*> &fromMe, size_t lead, siz
     } // end of for-loop
 }
 
-void loopUnrolling (unordered_map <string, vector <const Instruction*>> &instMap, 
-    Graph &graph, Graph &revGraph, const Loop &loop, unordered_map <string, string> &dependency, 
-    size_t nextReg, size_t &nextLabel, size_t unrollBy) {
-
-    // decide whether we unroll the loop
-    vector <const Instruction*> &tailBlock = instMap[loop.tail];
-
-    // there must be "[addI, subI, multI, divI, lshiftI, rshiftI] => 
-    // [cmp_LT, cmp_LE, cmp_GT, cmp_GE] => cbr" sequence at the end
-    size_t tsize = tailBlock.size ();
-    if (tsize < 3 || tailBlock[tsize - 1]->op->code != OpCode::cbr_) return;
-    
-    OpCode cmp = tailBlock[tsize - 2]->op->code;
-    OpCode loopType = tailBlock[tsize - 3]->op->code;
-    if (cmp < OpCode::cmp_LT_ || cmp > OpCode::cmp_GE_ || (loopType != OpCode::addI_ && 
-        loopType != OpCode::subI_ && loopType != OpCode::multI_ && loopType != OpCode::divI_ && 
-        loopType != OpCode::lshiftI_ && loopType != OpCode::rshiftI_)) return;
-
-    // get the looping step
-    size_t loopStep = tailBlock[tsize - 3]->op->constant;
-
-    // get the looping variable
-    size_t loopVar = tailBlock[tsize - 3]->op->reg2;
-
-    // find all the blocks that the loop affects using reverse graph
-    unordered_set <string> involvedLabels;
-    queue <string> q;
-    
-    q.push (loop.tail);
-    involvedLabels.insert (loop.tail);
-    
-    while (q.size ()) {
-        string label = q.front ();
-        q.pop ();
-
-        // when the loop head is visited, don't visit its parents
-        if (label == loop.head)
-            continue;
-
-        for (const string &par : revGraph.edges[label]) {
-            if (involvedLabels.find (par) != involvedLabels.end ())
-                continue;
-            involvedLabels.insert (par);
-            q.push (par);
-        }
-    }
-
-    // if too many blocks are involved in loop
-    // we just give up unrolling it
-    if (involvedLabels.size () > 20)
-        return;
-
-    // when the looping variable is assigned anywhere in loop, stop unrolling
-    for (const string &label : involvedLabels) {
-        size_t bsize = instMap[label].size ();
-        for (size_t i = 0; i < bsize; i++) {
-
-            // the looping variable should only be modifies here
-            if (label == loop.tail && i == bsize - 3)
-                continue;
-            
-            // when the operation is assignment and target is looping variable
-            const Instruction *inst = instMap[label][i];
-            if (opcodeMap[inst->op->code] != 9 && inst->op->reg2 == loopVar)
-                return;
-        }
-    }
-
-    // get the reference to the parent block and the head block
-    // and get the size of each block
-    vector <const Instruction*> &parBlock = instMap[loop.parent];
-    vector <const Instruction*> &headBlock = instMap[loop.head];
-    size_t psize = parBlock.size (), hsize = headBlock.size ();
-
-    // the new parent for remaining case (< 'unrollBy')
-    string extraParLabel = loop.parent + "X" + to_string (nextLabel);
-    vector <const Instruction*> extraParBody;
-
-    // add 'nop' after the label
-    // and copy comparison and conditional branch instruction
-    // finally add the extra parent to the instruction map
-    extraParBody.push_back (new Instruction (extraParLabel.c_str ()));
-    copyInstructions (parBlock, &extraParBody, psize - 2, 2);
-    instMap[extraParLabel] = std::move (extraParBody);
-
-    // maintain the graph
-    string exitLabel = string (parBlock.back ()->op->label2);
-    graph.vertices.push_back (extraParLabel);    
-    graph.edges[extraParLabel].insert (loop.head);
-    graph.edges[extraParLabel].insert (exitLabel);
-
-    // calculate the new step value
-    size_t newStep = unrollBy * loopStep;
-    if (loopType == OpCode::multI_ || loopType == OpCode::divI_)
-        newStep = pow (loopStep, unrollBy);
-
-    // copy the loop body for 'unrollBy' times
-    for (const string &label : involvedLabels) {
-        if (label == loop.head || label == loop.tail)
-            continue;
-
-        // get the reference to the old body block
-        vector <const Instruction*> &bodyBlock = instMap[label];
-        size_t bsize = bodyBlock.size ();
-        
-        for (size_t i = 0; i < unrollBy; i++) {
-            string suffix = "X" + to_string (nextLabel + i);
-            string newLabel = label + suffix;
-
-            // copy instructions from original block
-            vector <const Instruction*> newBody;
-            newBody.push_back (new Instruction (newLabel.c_str ()));
-            copyInstructions (bodyBlock, &newBody, 1, bsize - 2);
-            modifyBranch (bodyBlock, &newBody, &graph, &dependency, 
-                involvedLabels, label, newLabel, suffix);
-
-            instMap[newLabel] = std::move (newBody);
-        } // end of for-loop
-    } // end of for-loop
-
-    // this is the label of new head of unrolled loop
-    string newHeadLabel = loop.head + "X" + to_string (nextLabel);
-    
-    if (loop.head != loop.tail) {
-        // coalesce the head block and the tail block in the body of unrolled loop
-        for (size_t i = 0; i < unrollBy - 1; i++) {
-            string linkLabel = loop.tail + "X" + to_string (nextLabel + i);
-            vector <const Instruction*> linkBody;
-            
-            linkBody.push_back (new Instruction (linkLabel.c_str ()));
-            copyInstructions (tailBlock, &linkBody, 1, tsize - 3);
-            copyInstructions (headBlock, &linkBody, 1, hsize - 2);
-            modifyBranch (headBlock, &linkBody, &graph, &dependency, 
-                involvedLabels, loop.head, linkLabel, "X" + to_string (nextLabel + i + 1));
-
-            instMap[linkLabel] = std::move (linkBody);
-        } // end of for-loop
-
-        // deal with the entry (new head) block
-        vector <const Instruction*> newHeadBody;
-
-        newHeadBody.push_back (new Instruction (newHeadLabel.c_str ()));
-        copyInstructions (headBlock, &newHeadBody, 1, hsize - 2);
-        modifyBranch (headBlock, &newHeadBody, &graph, &dependency, 
-            involvedLabels, loop.head, newHeadLabel, "X" + to_string (nextLabel));
-
-        instMap[newHeadLabel] = std::move (newHeadBody);
-
-        // deal with the exit (new tail) block
-        string newTailLabel = loop.tail + "X" + to_string (nextLabel + unrollBy - 1);
-        vector <const Instruction*> newTailBody;
-        
-        newTailBody.push_back (new Instruction (newTailLabel.c_str ()));
-        copyInstructions (tailBlock, &newTailBody, 1, tsize - 3);
-        finalizeTail (tailBlock, &newTailBody, nextReg, newStep, 
-            newHeadLabel, extraParLabel);
-
-        // maintail the graph
-        graph.vertices.push_back (newTailLabel);
-        graph.edges[newTailLabel].insert (newHeadLabel);
-        graph.edges[newTailLabel].insert (extraParLabel);
-
-        instMap[newTailLabel] = std::move (newTailBody);
-
-        nextLabel += unrollBy;
-    } // end of if (loop.head != loop.tail)
-
-    else { // when loop.head == loop.tail
-        string newHeadLabel = loop.head + "X" + to_string (nextLabel);
-        vector <const Instruction*> newHeadBody;
-
-        newHeadBody.push_back (new Instruction (newHeadLabel.c_str ()));
-        for (size_t i = 0; i < unrollBy; i++)
-            copyInstructions (headBlock, &newHeadBody, 1, hsize - 3);
-
-        finalizeTail (headBlock, &newHeadBody, nextReg, newStep, 
-            newHeadLabel, extraParLabel);
-
-        // maintail the graph
-        graph.vertices.push_back (newHeadLabel);
-        graph.edges[newHeadLabel].insert (newHeadLabel);
-        graph.edges[newHeadLabel].insert (extraParLabel);
-
-        instMap[newHeadLabel] = std::move (newHeadBody);
-
-        nextLabel++;
-    }
-
-    // rewrite the parent block to lead it to the new head
-    const Instruction* cbrInst = parBlock[psize - 1];
-    const Instruction* cmpInst = parBlock[psize - 2];
-
-    graph.edges[loop.parent].erase (string (cbrInst->op->label1));
-    graph.edges[loop.parent].erase (string (cbrInst->op->label2));
-    
-    delete cbrInst;
-
-    // build the increment instruction
-    parBlock[psize - 2] = new Instruction (nullptr, new Operation (
-        loopType, loopVar, 0, nextReg, newStep));
-    
-    // build the comparison instruction
-    parBlock[psize - 1] = new Instruction (nullptr, new Operation (
-        cmpInst->op->code, nextReg, cmpInst->op->reg1, cmpInst->op->reg2));
-    
-    // build the conditional branch instruction
-    parBlock.push_back (new Instruction (nullptr, new Operation (
-        OpCode::cbr_, cmpInst->op->reg2, 0, 0, 0, 
-        newHeadLabel.c_str (), extraParLabel.c_str ())));
-    
-    delete cmpInst;
-
-    // maintain the graph
-    graph.edges[loop.parent].insert (newHeadLabel);
-    graph.edges[loop.parent].insert (extraParLabel);
-
-    // also maintain the reverse graph
-    graph.reverseGraph (&revGraph);
-}
-
 void valueNumbering (const vector <const Instruction*> &fromMe, 
     vector <const Instruction*> *toMe, 
     const vector <size_t> &lead, const vector <size_t> &last, 
@@ -532,6 +532,9 @@ void valueNumbering (const vector <const Instruction*> &fromMe,
     // to #lines of variables that need this value
     unordered_map <size_t, RewriteInfo> rewrite;
 
+    // instructions simplified to 'loadI' or 'i2i'
+    unordered_map <size_t, FoldInfo> folded;
+
     // maps block start line to computed hash maps for EBB at that point
     unordered_map <size_t, HashMaps> sofar;
 
@@ -553,59 +556,315 @@ void valueNumbering (const vector <const Instruction*> &fromMe,
         }
 
         valueNumbering (fromMe, beginEnd.first, beginEnd.second, 
-            sofar[beginEnd.first], removal, rewrite, nextReg);
+            sofar[beginEnd.first], removal, rewrite, folded, nextReg);
     }
 
-    writeInstsBack (fromMe, toMe, removal, rewrite, tempReg);
+    writeInstsBack (fromMe, toMe, removal, rewrite, folded, tempReg);
 }
 
-void loopUnrolling (const vector <const Instruction*> &fromMe, 
+void dominatorValueNumbering (const vector <const Instruction*> &fromMe, 
     vector <const Instruction*> *toMe, 
     const vector <size_t> &lead, const vector <size_t> &last, 
-    const vector <pair <size_t, size_t>> edges, size_t unrollBy) {
+    const vector <pair <size_t, size_t>> &edges) {
+
+    FlowGraph graph (lead, last, edges);
+    DominatorTree domTree (graph);
+    size_t numBlocks = graph.size ();
+
+    // registers written in each block
+    vector <vector <size_t>> blockDefs (numBlocks);
+    for (size_t b = 0; b < numBlocks; b++) {
+        for (size_t i = lead[b]; i <= last[b]; i++) {
+            size_t reg;
+            if (definedReg (fromMe[i]->op, &reg))
+                blockDefs[b].push_back (reg);
+        }
+    }
 
-    // maps label to instructions in block body
-    unordered_map <string, vector <const Instruction*>> instMap;
-    size_t numBlocks = lead.size ();
+    // registers that may be re-written on the way from the immediate dominator
+    // to a join point, found by walking backward until the immediate dominator
+    vector <vector <size_t>> killed (numBlocks);
+    for (size_t b : domTree.order) {
+        if (b == domTree.entry || graph.pred[b].size () < 2)
+            continue;
 
-    // remember the block order
-    vector <string> order;
-    
-    for (size_t i = 0; i < numBlocks; i++) {
-        string label = i ? string (fromMe[lead[i]]->label) : "START";
-        order.push_back (label);
+        size_t idom = domTree.idom[b];
+        vector <char> seen (numBlocks, 0);
+        vector <size_t> workList;
 
-        // locate the vector that stores instructions under label 'label'
-        auto &insts = instMap[label];
-        for (size_t j = lead[i]; j <= last[i]; j++)
-            insts.push_back (new Instruction (fromMe[j]));
+        for (size_t p : graph.pred[b]) {
+            if (p != idom && !seen[p]) {
+                seen[p] = 1;
+                workList.push_back (p);
+            }
+        }
+
+        while (workList.size ()) {
+            size_t x = workList.back ();
+            workList.pop_back ();
+            killed[b].insert (killed[b].end (), blockDefs[x].begin (), blockDefs[x].end ());
+
+            for (size_t p : graph.pred[x]) {
+                if (p != idom && !seen[p]) {
+                    seen[p] = 1;
+                    workList.push_back (p);
+                }
+            }
+        }
+
+        std::sort (killed[b].begin (), killed[b].end ());
+        killed[b].erase (std::unique (killed[b].begin (), killed[b].end ()), killed[b].end ());
     }
 
-    Graph graph (fromMe, lead, last, edges);
+    // maps register to the value number it holds
+    ScopedMap <size_t> regVal;
 
-    vector <Loop> loops;
-    graph.findLoop (&loops);
+    // maps hash tag of expression to value number
+    ScopedMap <string> exprVal;
 
-    Graph revGraph;
-    graph.reverseGraph (&revGraph);
+    // maps value number to the register that first held it
+    ScopedMap <size_t> holder;
 
-    // get next unused register
-    size_t nextReg = nextUnusedReg (fromMe);
+    // maps constant to value number, the same everywhere
+    unordered_map <size_t, size_t> constVal;
+
+    size_t nextVal = 0;
+
+    // redundant instructions, and instructions to be replaced by a copy
+    // from the register which still holds the value
+    unordered_set <size_t> removal;
+    unordered_map <size_t, size_t> copyMap;
+
+    auto valueOf = [&] (size_t reg) {
+        size_t val;
+        if (!regVal.find (reg, &val)) {
+            val = ++nextVal;
+            regVal.set (reg, val);
+        }
+        return val;
+    };
+
+    // find the register which still holds value number 'val'
+    auto holderOf = [&] (size_t val, size_t *reg) {
+        size_t cur;
+        return holder.find (val, reg) && regVal.find (*reg, &cur) && cur == val;
+    };
+
+    auto define = [&] (size_t reg, size_t val) {
+        regVal.set (reg, val);
+        size_t cur;
+        if (!holderOf (val, &cur))
+            holder.set (val, reg);
+    };
+
+    // the value has been computed before, reuse it if possible
+    auto reuse = [&] (size_t line, size_t reg, size_t val, bool copy) {
+        size_t cur;
+        if (regVal.find (reg, &cur) && cur == val) {
+            removal.insert (line);
+            return;
+        }
+        if (copy && holderOf (val, &cur))
+            copyMap[line] = cur;
+        define (reg, val);
+    };
+
+    auto number = [&] (size_t block) {
+        // values of registers re-written on some path into the block are unknown
+        for (size_t reg : killed[block])
+            regVal.set (reg, ++nextVal);
+
+        for (size_t i = lead[block]; i <= last[block]; i++) {
+            const Operation *op = fromMe[i]->op;
+            size_t key = opcodeMap[op->code - OpCode::nop_];
+
+            // 'i2c' and 'c2i' convert the value, so treat them like 'not'
+            if (op->code == OpCode::i2c_ || op->code == OpCode::c2i_)
+                key = 5;
+
+            switch (key) {
+                case 0: // opcode on 3 registers
+                case 1: // opcode on 2 registers and 1 constant
+                case 5: // opcode 'not'
+                {
+                    size_t lhs = valueOf (op->reg0);
+                    string tag;
+
+                    if (key == 0)
+                        tag = makeHashTag (op->code, lhs, valueOf (op->reg1), 0);
+                    else if (key == 1)
+                        tag = makeHashTag (op->code, lhs, 
+                                           std::numeric_limits<int>::max(), op->constant);
+                    else tag = makeHashTag (op->code, lhs, 
+                                            std::numeric_limits<int>::max(), 0);
+
+                    size_t val;
+                    if (exprVal.find (tag, &val))
+                        reuse (i, op->reg2, val, true);
+                    else {
+                        val = ++nextVal;
+                        exprVal.set (tag, val);
+                        define (op->reg2, val);
+                    }
+                    break;
+                }
+
+                case 2: // opcode 'i2i', 'c2c'
+                    reuse (i, op->reg2, valueOf (op->reg0), false);
+                    break;
+
+                case 4: // opcode 'loadI'
+                {
+                    if (constVal.find (op->constant) == constVal.end ())
+                        constVal[op->constant] = ++nextVal;
+                    reuse (i, op->reg2, constVal[op->constant], false);
+                    break;
+                }
+
+                case 3: // loads and reads, the value is unknown
+                    define (op->reg2, ++nextVal);
+                    break;
+
+                default: break;
+            }
+        }
+    };
+
+    // walk the dominator tree, each entry keeps the marks of three tables
+    struct Frame {
+        size_t block, child, regMark, exprMark, holderMark;
+    };
+
+    vector <Frame> stack;
+    auto enter = [&] (size_t block) {
+        stack.push_back (Frame {block, 0, regVal.mark (), exprVal.mark (), holder.mark ()});
+        number (block);
+    };
+
+    enter (domTree.entry);
+    while (stack.size ()) {
+        Frame &top = stack.back ();
+        const auto &children = domTree.children[top.block];
+
+        if (top.child < children.size ())
+            enter (children[top.child++]);
+        else {
+            regVal.rollBack (top.regMark);
+            exprVal.rollBack (top.exprMark);
+            holder.rollBack (top.holderMark);
+            stack.pop_back ();
+        }
+    }
+
+    for (size_t i = 0; i < fromMe.size (); i++) {
+        const Instruction *inst = fromMe[i];
+
+        // keep the label of removed instruction with a 'nop'
+        if (removal.find (i) != removal.end ()) {
+            if (inst->label != nullptr)
+                toMe->push_back (new Instruction (inst->label));
+        }
+
+        else if (copyMap.find (i) != copyMap.end ()) {
+            char *label = (inst->label != nullptr) ? strdup (inst->label) : nullptr;
+            toMe->push_back (new Instruction (label, new Operation (
+                OpCode::i2i_, copyMap[i], 0, inst->op->reg2, 0)));
+        }
 
-    // the dependency for natural control transition
-    unordered_map <string, string> dependency;
+        else toMe->push_back (new Instruction (inst));
+    }
+}
 
-    size_t nextLabel = 0;
-    for (const auto &loop : loops) 
-        loopUnrolling (instMap, graph, revGraph, 
-            loop, dependency, nextReg, nextLabel, unrollBy);
+void ungroupInstructions (vector <const Instruction*> &fromMe) {
+    size_t nextReg = 0;
+    vector <const Instruction*> code;
+    for (size_t i = 0; i < fromMe.size ();) {
+        size_t end = i + 1;
+        while (end < fromMe.size () && fromMe[end]->bundled)
+            end++;
+        if (end == i + 1) {
+            code.push_back (fromMe[i++]);
+            continue;
+        }
+        if (nextReg == 0)
+            nextReg = nextUnusedReg (fromMe);
+
+        // the registers written in the group
+        unordered_set <size_t> written;
+        for (size_t k = i; k < end; k++) {
+            size_t def;
+            if (definedReg (fromMe[k]->op, &def))
+                written.insert (def);
+        }
 
-    writeInstsBack (instMap, toMe, order, dependency);
+        // operations run in order with stores after them, so that loads see
+        // memory as it was, a register read by a later operation or a store is
+        // written through a new register and copied back after the stores, and
+        // a branch reads a copy made before the group
+        vector <const Instruction*> before, main, stores, after, branches;
+        for (size_t k = i; k < end; k++) {
+            Instruction *inst = const_cast <Instruction*> (fromMe[k]);
+            Operation *op = inst->op;
+            inst->bundled = false;
+
+            if (op->code == OpCode::br_ || op->code == OpCode::cbr_) {
+                if (op->code == OpCode::cbr_ && written.count (op->reg0)) {
+                    before.push_back (new Instruction (nullptr, new Operation (
+                        OpCode::i2i_, op->reg0, 0, nextReg, 0)));
+                    op->reg0 = nextReg++;
+                }
+                branches.push_back (inst);
+                continue;
+            }
+            if (op->code >= OpCode::store_ && op->code <= OpCode::cstoreAO_) {
+                stores.push_back (inst);
+                continue;
+            }
+
+            size_t def;
+            bool later = false;
+            if (definedReg (op, &def)) {
+                for (size_t l = i; l < end && !later; l++) {
+                    OpCode code = fromMe[l]->op->code;
+                    bool store = code >= OpCode::store_ && code <= OpCode::cstoreAO_;
+                    if (l == k || code == OpCode::br_ || code == OpCode::cbr_ || (l < k && !store))
+                        continue;
+                    vector <size_t> uses;
+                    usedRegs (fromMe[l]->op, &uses);
+                    later = find (uses.begin (), uses.end (), def) != uses.end ();
+                }
+            }
+            if (later) {
+                after.push_back (new Instruction (nullptr, new Operation (
+                    OpCode::i2i_, nextReg, 0, def, 0)));
+                op->reg2 = nextReg++;
+            }
+            main.push_back (inst);
+        }
+
+        vector <const Instruction*> group;
+        for (auto part : {&before, &main, &stores, &after, &branches})
+            group.insert (group.end (), part->begin (), part->end ());
+
+        // the label of the group goes first
+        Instruction *first = const_cast <Instruction*> (fromMe[i]);
+        if (first->label != nullptr && group[0] != first) {
+            const_cast <Instruction*> (group[0])->label = first->label;
+            first->label = nullptr;
+        }
+        code.insert (code.end (), group.begin (), group.end ());
+        i = end;
+    }
+    fromMe = std::move (code);
 }
 
 void generateCode (const vector <const Instruction*> fromMe, FILE *writeToMe) {
-    for (const Instruction* inst : fromMe) {
-        string instruction = translate (inst);
+    for (size_t i = 0; i < fromMe.size ();) {
+        vector <const Instruction*> group {fromMe[i++]};
+        while (i < fromMe.size () && fromMe[i]->bundled)
+            group.push_back (fromMe[i++]);
+
+        string instruction = translate (group);
         fprintf (writeToMe, "%s", instruction.c_str ());
     }
     fprintf (writeToMe, "\thalt\n");
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+
+#include "../headers/analysis.h"
+#include "../headers/optim.h"
+#include "../headers/ssa.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+// the definitions a pattern may look through, found along def-use chains
+struct Definitions {
+    const SSAForm &form;
+
+    Definitions (const SSAForm &f) : form (f) {}
+
+    // the operation defining name, nullptr for a phi function or a value
+    // the procedure starts with
+    const Operation* of (size_t name) const {
+        const SSASite &site = form.defSite[name];
+        if (site.block == noBlock || site.phi)
+            return nullptr;
+        return form.blocks[site.block][site.index]->op;
+    }
+
+    // help to tell whether name is loaded with a constant which can be
+    // written in an operation
+    bool constant (size_t name, long long *value) const {
+        const Operation *def = of (name);
+        if (def == nullptr || def->code != OpCode::loadI_ || !isEncodable ((long long) def->constant))
+            return false;
+        *value = (long long) def->constant;
+        return true;
+    }
+};
+
+// a rewrite of one operation in place, tried on the opcodes listed, which
+// returns whether it changed the operation
+struct Pattern {
+    const char *name;
+    vector <OpCode> codes;
+    bool (*rewrite) (Operation *op, const Definitions &defs);
+};
+
+static void makeCopy (Operation *op, size_t src) {
+    op->code = OpCode::i2i_;
+    op->reg0 = src;
+    op->reg1 = 0;
+    op->constant = 0;
+}
+
+static void makeConstant (Operation *op, long long value) {
+    op->code = OpCode::loadI_;
+    op->reg0 = op->reg1 = 0;
+    op->constant = value;
+}
+
+static const vector <Pattern> patterns {
+    // x + 0, x - 0, x << 0, x >> 0, x or 0, x * 1 and x / 1 are x
+    {"identity", {OpCode::addI_, OpCode::subI_, OpCode::lshiftI_, OpCode::rshiftI_,
+        OpCode::orI_, OpCode::multI_, OpCode::divI_},
+        [] (Operation *op, const Definitions &defs) {
+            bool one = op->code == OpCode::multI_ || op->code == OpCode::divI_;
+            if (op->constant != (one ? 1 : 0))
+                return false;
+            makeCopy (op, op->reg0);
+            return true;
+        }},
+
+    // x * 0 and x and 0 are 0
+    {"absorb", {OpCode::multI_, OpCode::andI_},
+        [] (Operation *op, const Definitions &defs) {
+            if (op->constant != 0)
+                return false;
+            makeConstant (op, 0);
+            return true;
+        }},
+
+    // x * 2^k is x << k
+    {"shift", {OpCode::multI_},
+        [] (Operation *op, const Definitions &defs) {
+            if (op->constant < 2 || !isPowerOfTwo (op->constant))
+                return false;
+            op->code = OpCode::lshiftI_;
+            op->constant = getPower (op->constant);
+            return true;
+        }},
+
+    // an operand loaded with a constant becomes the immediate operand
+    {"immediate", {OpCode::add_, OpCode::sub_, OpCode::mult_, OpCode::lshift_,
+        OpCode::rshift_, OpCode::and_, OpCode::or_},
+        [] (Operation *op, const Definitions &defs) {
+            long long value;
+            if (isCommutative (op->code) && !defs.constant (op->reg1, &value) &&
+                defs.constant (op->reg0, &value))
+                swap (op->reg0, op->reg1);
+            if (!defs.constant (op->reg1, &value))
+                return false;
+            op->code = static_cast <OpCode> (op->code + 1);
+            op->reg1 = 0;
+            op->constant = value;
+            return true;
+        }},
+
+    // (x + c1) + c2 is x + (c1 + c2), and the same for subtraction
+    {"add chain", {OpCode::addI_, OpCode::subI_},
+        [] (Operation *op, const Definitions &defs) {
+            const Operation *def = defs.of (op->reg0);
+            if (def == nullptr || (def->code != OpCode::addI_ && def->code != OpCode::subI_))
+                return false;
+            long long sum = (def->code == OpCode::addI_ ? 1 : -1) * (long long) def->constant +
+                (op->code == OpCode::addI_ ? 1 : -1) * (long long) op->constant;
+            if (!isEncodable (sum < 0 ? -sum : sum))
+                return false;
+            op->code = sum < 0 ? OpCode::subI_ : OpCode::addI_;
+            op->reg0 = def->reg0;
+            op->constant = sum < 0 ? -sum : sum;
+            return true;
+        }},
+
+    // (x << c1) << c2 is x << (c1 + c2) within a word, the same for right
+    // shifts, and (x * c1) * c2 is x * (c1 * c2)
+    {"chain", {OpCode::lshiftI_, OpCode::rshiftI_, OpCode::multI_},
+        [] (Operation *op, const Definitions &defs) {
+            const Operation *def = defs.of (op->reg0);
+            if (def == nullptr || def->code != op->code)
+                return false;
+            long long value;
+            if (op->code == OpCode::multI_) {
+                value = (long long) def->constant * (long long) op->constant;
+                if (def->constant != 0 && value / (long long) def->constant != (long long) op->constant)
+                    return false;
+            }
+            else value = (long long) def->constant + (long long) op->constant;
+            if (!isEncodable (value) || (op->code != OpCode::multI_ && value >= 32))
+                return false;
+            op->reg0 = def->reg0;
+            op->constant = value;
+            return true;
+        }},
+};
+
+// a rewrite of neighboring instructions after leaving SSA form, which
+// returns whether instruction, followed by 'next', can be removed
+struct LayoutPattern {
+    const char *name;
+    bool (*removable) (const Instruction *inst, const Instruction *next);
+};
+
+static const vector <LayoutPattern> layoutPatterns {
+    // a copy of a register onto itself
+    {"self copy", [] (const Instruction *inst, const Instruction *next) {
+        return inst->op->code == OpCode::i2i_ && inst->op->reg0 == inst->op->reg2;
+    }},
+
+    // a jump to the instruction right after it
+    {"jump to next", [] (const Instruction *inst, const Instruction *next) {
+        return inst->op->code == OpCode::br_ && next != nullptr && next->label != nullptr &&
+            strcmp (next->label, inst->op->label1) == 0;
+    }},
+};
+
+// whether operation has no effect but writing its register
+static bool isPure (const Operation *op) {
+    size_t key = opcodeMap[op->code - OpCode::nop_];
+    return key != 9 && op->code != OpCode::read_ && op->code != OpCode::cread_;
+}
+
+void peepholeOptimization (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+    form.buildDefUse ();
+    Definitions defs (form);
+
+    // the number of uses left of each name
+    vector <size_t> uses (form.numNames (), 0);
+    for (size_t name = 0; name < form.numNames (); name++)
+        uses[name] = form.useSites[name].size ();
+
+    vector <size_t> fired (patterns.size () + 2, 0);
+    const size_t copies = patterns.size (), dead = patterns.size () + 1;
+
+    // instructions to visit, each once at a time, first in layout order
+    deque <pair <size_t, size_t>> work;
+    vector <vector <char>> queued (form.blocks.size ());
+    auto push = [&] (size_t b, size_t i) {
+        if (!queued[b][i]) {
+            queued[b][i] = 1;
+            work.push_back (make_pair (b, i));
+        }
+    };
+    for (size_t b = 0; b < form.blocks.size (); b++)
+        queued[b].assign (form.blocks[b].size (), 0);
+    for (size_t b : form.layout) {
+        for (size_t i = 0; i < form.blocks[b].size (); i++)
+            push (b, i);
+    }
+
+    // help to visit again what may match now that name changed
+    auto pushUsers = [&] (size_t name) {
+        for (const SSASite &site : form.useSites[name]) {
+            if (!site.phi)
+                push (site.block, site.index);
+        }
+    };
+    auto pushDef = [&] (size_t name) {
+        const SSASite &site = form.defSite[name];
+        if (site.block != noBlock && !site.phi)
+            push (site.block, site.index);
+    };
+
+    while (work.size ()) {
+        size_t b = work.front ().first, i = work.front ().second;
+        work.pop_front ();
+        queued[b][i] = 0;
+
+        Operation *op = form.blocks[b][i]->op;
+        if (op->code == OpCode::nop_)
+            continue;
+
+        vector <size_t> before;
+        usedRegs (op, &before);
+
+        size_t def;
+        bool defines = definedReg (op, &def);
+
+        // nothing reads the result
+        if (defines && isPure (op) && uses[def] == 0) {
+            for (size_t name : before) {
+                uses[name]--;
+                pushDef (name);
+            }
+            *op = Operation ();
+            fired[dead]++;
+            continue;
+        }
+
+        // the uses of a copy read its source instead
+        if (op->code == OpCode::i2i_) {
+            size_t src = op->reg0;
+            for (const SSASite &site : form.useSites[def]) {
+                if (site.phi) {
+                    for (size_t &arg : form.phis[site.block][site.index].args) {
+                        if (arg == def) {
+                            arg = src;
+                            uses[src]++;
+                        }
+                    }
+                }
+                else {
+                    vector <size_t*> fields;
+                    useFields (form.blocks[site.block][site.index]->op, &fields);
+                    for (size_t *field : fields) {
+                        if (*field == def) {
+                            *field = src;
+                            uses[src]++;
+                        }
+                    }
+                    push (site.block, site.index);
+                }
+                form.useSites[src].push_back (site);
+            }
+            form.useSites[def].clear ();
+            uses[def] = 0;
+            uses[src]--;
+            pushDef (src);
+            *op = Operation ();
+            fired[copies]++;
+            continue;
+        }
+
+        for (size_t p = 0; p < patterns.size (); p++) {
+            const Pattern &pattern = patterns[p];
+            if (find (pattern.codes.begin (), pattern.codes.end (), op->code) == pattern.codes.end () ||
+                !pattern.rewrite (op, defs))
+                continue;
+            fired[p]++;
+
+            vector <size_t> after;
+            usedRegs (op, &after);
+            for (size_t name : before) {
+                uses[name]--;
+                pushDef (name);
+            }
+            for (size_t name : after) {
+                uses[name]++;
+                form.useSites[name].push_back (SSASite {b, i, false});
+            }
+            push (b, i);
+            if (defines)
+                pushUsers (def);
+            break;
+        }
+    }
+
+    // drop the 'nop' left without label
+    for (size_t b : form.layout) {
+        auto &block = form.blocks[b];
+        block.erase (remove_if (block.begin (), block.end (), [] (const Instruction *inst) {
+            if (inst->op->code != OpCode::nop_ || inst->label != nullptr)
+                return false;
+            delete inst;
+            return true;
+        }), block.end ());
+
+        if (block.empty ())
+            block.push_back (new Instruction (nullptr, new Operation ()));
+    }
+
+    vector <const Instruction*> code;
+    destroySSA (form, &code);
+
+    // one sweep over the code for the patterns on neighboring instructions
+    vector <size_t> removed (layoutPatterns.size (), 0);
+    for (size_t i = 0; i < code.size (); i++) {
+        const Instruction *inst = code[i];
+        const Instruction *next = i + 1 < code.size () ? code[i + 1] : nullptr;
+
+        size_t p = 0;
+        while (p < layoutPatterns.size () && !layoutPatterns[p].removable (inst, next))
+            p++;
+        if (p == layoutPatterns.size ()) {
+            toMe->push_back (inst);
+            continue;
+        }
+
+        removed[p]++;
+        if (inst->label != nullptr)
+            toMe->push_back (new Instruction (inst->label));
+        delete inst;
+    }
+
+    for (size_t p = 0; p < patterns.size (); p++) {
+        if (fired[p])
+            cerr << "peephole " << patterns[p].name << ": " << fired[p] << "\n";
+    }
+    if (fired[copies])
+        cerr << "peephole copy: " << fired[copies] << "\n";
+    if (fired[dead])
+        cerr << "peephole dead: " << fired[dead] << "\n";
+    for (size_t p = 0; p < layoutPatterns.size (); p++) {
+        if (removed[p])
+            cerr << "peephole " << layoutPatterns[p].name << ": " << removed[p] << "\n";
+    }
+}
@@ -0,0 +1,601 @@
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../headers/analysis.h"
+#include "../headers/optim.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+// spilled values live in memory from this address on, one word each
+const size_t spillBase = 32768;
+
+// the most rounds of spilling and coloring before giving up
+const size_t maxAllocRounds = 32;
+
+// registers which are live at the same time, and so cannot share
+// a physical register, a copy does not make its source and destination
+// interfere, as they hold the same value
+struct Interference {
+    vector <unordered_set <size_t>> adj;
+    BitVector present;
+
+    Interference (size_t numRegs) : adj (numRegs), present (numRegs) {}
+
+    void add (size_t a, size_t b) {
+        if (a == b)
+            return;
+        adj[a].insert (b);
+        adj[b].insert (a);
+    }
+};
+
+// help to build the interference graph by walking each block backward from
+// the registers live out of it, 'base' holds the spill address and is left out
+static void buildInterference (const vector <vector <const Instruction*>> &blocks,
+    const Liveness &live, size_t base, Interference *graph) {
+
+    for (size_t b = 0; b < blocks.size (); b++) {
+        BitVector now = live.liveOut[b];
+        for (size_t i = blocks[b].size (); i-- > 0;) {
+            const Operation *op = blocks[b][i]->op;
+            vector <size_t> uses;
+            usedRegs (op, &uses);
+
+            size_t def;
+            if (definedReg (op, &def) && def != base) {
+                graph->present.set (def);
+                now.forEach ([&] (size_t reg) {
+                    if (reg != base && !(op->code == OpCode::i2i_ && reg == op->reg0))
+                        graph->add (def, reg);
+                });
+                now.reset (def);
+            }
+            for (size_t reg : uses) {
+                if (reg != base) {
+                    graph->present.set (reg);
+                    now.set (reg);
+                }
+            }
+        }
+    }
+}
+
+// help to color the graph with 'colors' colors by simplification, a register
+// with fewer neighbors than colors is removed, and when there is none the one
+// cheapest to spill for its degree is removed, optimistically hoping its
+// neighbors leave a color for it, registers left without one are returned
+static void colorGraph (const Interference &graph, size_t colors,
+    const vector <double> &cost, vector <size_t> *color, vector <size_t> *spilled) {
+
+    size_t n = graph.adj.size ();
+    vector <size_t> degree (n, 0), stack;
+    vector <bool> removed (n, true);
+    graph.present.forEach ([&] (size_t reg) {
+        removed[reg] = false;
+        degree[reg] = graph.adj[reg].size ();
+    });
+
+    size_t left = graph.present.count ();
+    while (left) {
+        size_t pick = n;
+        for (size_t reg = 0; reg < n && pick == n; reg++) {
+            if (!removed[reg] && degree[reg] < colors)
+                pick = reg;
+        }
+        if (pick == n) {
+            double best = 0;
+            for (size_t reg = 0; reg < n; reg++) {
+                if (removed[reg])
+                    continue;
+                double metric = cost[reg] / degree[reg];
+                if (pick == n || metric < best) {
+                    pick = reg;
+                    best = metric;
+                }
+            }
+        }
+
+        removed[pick] = true;
+        stack.push_back (pick);
+        left--;
+        for (size_t other : graph.adj[pick])
+            degree[other]--;
+    }
+
+    color->assign (n, colors);
+    while (stack.size ()) {
+        size_t reg = stack.back ();
+        stack.pop_back ();
+
+        vector <bool> taken (colors, false);
+        for (size_t other : graph.adj[reg]) {
+            if ((*color)[other] < colors)
+                taken[(*color)[other]] = true;
+        }
+        size_t c = find (taken.begin (), taken.end (), false) - taken.begin ();
+        if (c < colors)
+            (*color)[reg] = c;
+        else spilled->push_back (reg);
+    }
+}
+
+// help to put a value in memory, each definition is stored right after it
+// into a new register, and each use is loaded right before into another
+// one, a register only loaded with one constant is loaded again instead
+static void spillRegister (size_t reg, bool remat, long long value, size_t base,
+    size_t offset, size_t &nextReg, unordered_set <size_t> &noSpill,
+    vector <vector <const Instruction*>> &blocks) {
+
+    for (auto &block : blocks) {
+        vector <const Instruction*> newBlock;
+        for (const Instruction *inst : block) {
+            Operation *op = inst->op;
+            char *label = inst->label;
+
+            // the constant is loaded again at each use
+            size_t def;
+            if (remat && definedReg (op, &def) && def == reg) {
+                if (label != nullptr)
+                    newBlock.push_back (new Instruction (label));
+                delete inst;
+                continue;
+            }
+
+            vector <size_t*> fields;
+            useFields (op, &fields);
+            size_t temp = 0;
+            for (size_t *field : fields) {
+                if (*field != reg)
+                    continue;
+                if (temp == 0) {
+                    temp = nextReg++;
+                    noSpill.insert (temp);
+                    Operation *load = remat ?
+                        new Operation (OpCode::loadI_, 0, 0, temp, value) :
+                        new Operation (OpCode::loadAI_, base, 0, temp, offset);
+                    newBlock.push_back (new Instruction (label, load));
+                    const_cast <Instruction*> (inst)->label = nullptr;
+                    label = nullptr;
+                }
+                *field = temp;
+            }
+
+            newBlock.push_back (inst);
+            if (definedReg (op, &def) && def == reg) {
+                size_t stored = nextReg++;
+                noSpill.insert (stored);
+                op->reg2 = stored;
+                newBlock.push_back (new Instruction (nullptr, new Operation (
+                    OpCode::storeAI_, stored, base, 0, offset)));
+            }
+        }
+        block = std::move (newBlock);
+    }
+}
+
+void registerAllocation (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, size_t k) {
+
+    FlowGraph graph (lead, last, edges);
+    LoopForest forest (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+
+    // an access in a loop counts ten times one outside it
+    vector <double> weight (blocks.size (), 1);
+    for (size_t b = 0; b < blocks.size (); b++) {
+        for (size_t d = 0; d < min (forest.depth (b), (size_t) 6); d++)
+            weight[b] *= 10;
+    }
+
+    size_t nextReg = nextUnusedReg (fromMe), base = 0, slots = 0;
+    size_t spills = 0, remats = 0;
+    bool reserved = false, done = false;
+    unordered_set <size_t> noSpill;
+    vector <size_t> color;
+
+    for (size_t round = 0; round < maxAllocRounds && !done && k > (reserved ? 1 : 0); round++) {
+        size_t numRegs = nextReg;
+
+        Liveness live (blocks, graph.succ, numRegs);
+        Interference interference (numRegs);
+        buildInterference (blocks, live, reserved ? base : numRegs, &interference);
+
+        // the cost of spilling is the weighted number of accesses, a register
+        // loaded with a single constant costs less as it needs no memory
+        vector <double> cost (numRegs, 0);
+        vector <bool> remat (numRegs, true);
+        vector <long long> value (numRegs, 0);
+        vector <bool> defined (numRegs, false);
+        for (size_t b = 0; b < blocks.size (); b++) {
+            for (const Instruction *inst : blocks[b]) {
+                const Operation *op = inst->op;
+                vector <size_t> uses;
+                usedRegs (op, &uses);
+                for (size_t reg : uses)
+                    cost[reg] += weight[b];
+
+                size_t def;
+                if (!definedReg (op, &def))
+                    continue;
+                cost[def] += weight[b];
+                if (op->code != OpCode::loadI_ || (defined[def] && value[def] != (long long) op->constant))
+                    remat[def] = false;
+                defined[def] = true;
+                value[def] = op->constant;
+            }
+        }
+        for (size_t reg = 0; reg < numRegs; reg++) {
+            remat[reg] = remat[reg] && defined[reg];
+            if (remat[reg])
+                cost[reg] /= 2;
+            if (noSpill.count (reg))
+                cost[reg] = std::numeric_limits<double>::infinity ();
+        }
+
+        vector <size_t> spilled;
+        colorGraph (interference, reserved ? k - 1 : k, cost, &color, &spilled);
+        if (spilled.empty ()) {
+            done = true;
+            break;
+        }
+
+        // spilling to memory needs a register for the spill address
+        for (size_t reg : spilled) {
+            if (!remat[reg] && !reserved) {
+                reserved = true;
+                base = nextReg++;
+            }
+        }
+        for (size_t reg : spilled) {
+            spillRegister (reg, remat[reg], value[reg], base, slots * 4, nextReg, noSpill, blocks);
+            if (remat[reg])
+                remats++;
+            else {
+                slots++;
+                spills++;
+            }
+        }
+    }
+
+    vector <const Instruction*> code;
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+    joinBlocks (blocks, layout, &code);
+
+    if (!done) {
+        cerr << "allocate: cannot fit in " << k << " registers\n";
+        for (const Instruction *inst : fromMe)
+            toMe->push_back (new Instruction (inst));
+        freeMemory (code);
+        return;
+    }
+
+    // the physical registers are r0 to r(k-1), the spill address is in the last one
+    if (reserved) {
+        toMe->push_back (new Instruction (nullptr, new Operation (
+            OpCode::loadI_, 0, 0, k - 1, spillBase)));
+    }
+    for (const Instruction *inst : code) {
+        Operation *op = inst->op;
+        vector <size_t*> fields;
+        useFields (op, &fields);
+        size_t def;
+        if (definedReg (op, &def))
+            fields.push_back (&op->reg2);
+        for (size_t *field : fields)
+            *field = reserved && *field == base ? k - 1 : color[*field];
+
+        // a copy between registers given the same color does nothing
+        if (op->code == OpCode::i2i_ && op->reg0 == op->reg2) {
+            if (inst->label != nullptr)
+                toMe->push_back (new Instruction (inst->label));
+            delete inst;
+            continue;
+        }
+        toMe->push_back (inst);
+    }
+
+    cerr << "allocate: " << k << " registers, " << spills << " spilled, ";
+    cerr << remats << " rematerialized\n";
+}
+
+// help to find the register a register was merged into
+static size_t findAlias (vector <size_t> &alias, size_t reg) {
+    while (alias[reg] != reg) {
+        alias[reg] = alias[alias[reg]];
+        reg = alias[reg];
+    }
+    return reg;
+}
+
+// help to replace each use of a copy's destination by its source wherever the
+// copy is available, that is on every path to the use it ran and neither
+// register was written since, returns the number of uses replaced
+static size_t propagateCopies (vector <vector <const Instruction*>> &blocks,
+    const FlowGraph &graph) {
+
+    // every copy in the code, by index
+    vector <pair <size_t, size_t>> copies;
+    unordered_map <size_t, vector <size_t>> touching, byDst;
+    for (auto &block : blocks) {
+        for (const Instruction *inst : block) {
+            const Operation *op = inst->op;
+            if (op->code != OpCode::i2i_ || op->reg0 == op->reg2)
+                continue;
+            size_t c = copies.size ();
+            copies.push_back (make_pair (op->reg0, op->reg2));
+            touching[op->reg0].push_back (c);
+            touching[op->reg2].push_back (c);
+            byDst[op->reg2].push_back (c);
+        }
+    }
+    if (copies.empty ())
+        return 0;
+
+    // help to find the copy of a register available in 'avail', if any
+    auto findCopy = [&] (const BitVector &avail, size_t reg, size_t *src) {
+        auto it = byDst.find (reg);
+        if (it == byDst.end ())
+            return false;
+        for (size_t c : it->second) {
+            if (avail.test (c)) {
+                *src = copies[c].first;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // help to step over an instruction, a write kills the copies of
+    // the register and a copy becomes available
+    auto transfer = [&] (BitVector &avail, const Operation *op) {
+        size_t def;
+        if (!definedReg (op, &def))
+            return;
+        auto it = touching.find (def);
+        if (it != touching.end ()) {
+            for (size_t c : it->second)
+                avail.reset (c);
+        }
+        if (op->code == OpCode::i2i_ && op->reg0 != op->reg2) {
+            for (size_t c : byDst[def]) {
+                if (copies[c].first == op->reg0)
+                    avail.set (c);
+            }
+        }
+    };
+
+    // copies available on entry to each block, found by iterating forward
+    size_t num = blocks.size (), numCopies = copies.size ();
+    vector <BitVector> in (num, BitVector (numCopies)), out (num, BitVector (numCopies));
+    for (size_t b = 1; b < num; b++) {
+        if (graph.pred[b].size ())
+            out[b].fill ();
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < num; b++) {
+            BitVector avail (numCopies);
+            if (b != 0 && graph.pred[b].size ()) {
+                avail.fill ();
+                for (size_t p : graph.pred[b])
+                    avail &= out[p];
+            }
+            in[b] = avail;
+            for (const Instruction *inst : blocks[b])
+                transfer (avail, inst->op);
+            if (avail != out[b]) {
+                out[b] = std::move (avail);
+                changed = true;
+            }
+        }
+    }
+
+    // read each use from the start of the chain of copies it comes through
+    size_t replaced = 0;
+    for (size_t b = 0; b < num; b++) {
+        BitVector avail = in[b];
+        for (const Instruction *inst : blocks[b]) {
+            vector <size_t*> fields;
+            useFields (inst->op, &fields);
+            for (size_t *field : fields) {
+                size_t src;
+                bool found = false;
+                while (findCopy (avail, *field, &src)) {
+                    *field = src;
+                    found = true;
+                }
+                if (found)
+                    replaced++;
+            }
+            transfer (avail, inst->op);
+        }
+    }
+    return replaced;
+}
+
+// help to remove copies whose destination is never read afterwards, and
+// copies of a register onto itself, returns the number removed
+static size_t removeDeadCopies (vector <vector <const Instruction*>> &blocks,
+    const FlowGraph &graph, size_t numRegs) {
+
+    size_t removed = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        Liveness live (blocks, graph.succ, numRegs);
+        for (size_t b = 0; b < blocks.size (); b++) {
+            BitVector now = live.liveOut[b];
+            vector <bool> dead (blocks[b].size (), false);
+            for (size_t i = blocks[b].size (); i-- > 0;) {
+                const Operation *op = blocks[b][i]->op;
+                if (op->code == OpCode::i2i_ && (op->reg0 == op->reg2 || !now.test (op->reg2))) {
+                    dead[i] = true;
+                    continue;
+                }
+
+                size_t def;
+                if (definedReg (op, &def))
+                    now.reset (def);
+                vector <size_t> uses;
+                usedRegs (op, &uses);
+                for (size_t reg : uses)
+                    now.set (reg);
+            }
+
+            vector <const Instruction*> newBlock;
+            for (size_t i = 0; i < blocks[b].size (); i++) {
+                const Instruction *inst = blocks[b][i];
+                if (!dead[i]) {
+                    newBlock.push_back (inst);
+                    continue;
+                }
+                if (inst->label != nullptr)
+                    newBlock.push_back (new Instruction (inst->label));
+                delete inst;
+                removed++;
+                changed = true;
+            }
+            blocks[b] = std::move (newBlock);
+        }
+    }
+    return removed;
+}
+
+// help to merge the source and destination of copies which do not interfere,
+// conservatively, only when the merged register has fewer than 'k' neighbors
+// of degree 'k' or more (Briggs), or each neighbor of the destination has
+// degree below 'k' or already interferes with the source (George), so that
+// coalescing never makes the code harder to color with 'k' registers,
+// returns the number of copies coalesced
+static size_t coalesceCopies (vector <vector <const Instruction*>> &blocks,
+    const FlowGraph &graph, size_t numRegs, size_t k) {
+
+    Liveness live (blocks, graph.succ, numRegs);
+    Interference interference (numRegs);
+    buildInterference (blocks, live, numRegs, &interference);
+    auto &adj = interference.adj;
+
+    // by default, as many registers as are live at once at the busiest point
+    if (k == 0) {
+        for (size_t b = 0; b < blocks.size (); b++) {
+            BitVector now = live.liveOut[b];
+            k = max (k, now.count ());
+            for (size_t i = blocks[b].size (); i-- > 0;) {
+                const Operation *op = blocks[b][i]->op;
+                size_t def;
+                if (definedReg (op, &def))
+                    now.reset (def);
+                vector <size_t> uses;
+                usedRegs (op, &uses);
+                for (size_t reg : uses)
+                    now.set (reg);
+                k = max (k, now.count ());
+            }
+        }
+    }
+
+    vector <size_t> alias (numRegs);
+    for (size_t reg = 0; reg < numRegs; reg++)
+        alias[reg] = reg;
+
+    auto briggs = [&] (size_t s, size_t d) {
+        size_t significant = 0;
+        unordered_set <size_t> seen;
+        for (size_t reg : {s, d}) {
+            for (size_t other : adj[reg]) {
+                if (!seen.insert (other).second)
+                    continue;
+                size_t degree = adj[other].size ();
+                if (adj[s].count (other) && adj[d].count (other))
+                    degree--;
+                if (degree >= k)
+                    significant++;
+            }
+        }
+        return significant < k;
+    };
+
+    auto george = [&] (size_t s, size_t d) {
+        for (size_t other : adj[d]) {
+            if (adj[other].size () >= k && !adj[s].count (other))
+                return false;
+        }
+        return true;
+    };
+
+    size_t coalesced = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &block : blocks) {
+            for (const Instruction *inst : block) {
+                const Operation *op = inst->op;
+                if (op->code != OpCode::i2i_)
+                    continue;
+                size_t s = findAlias (alias, op->reg0), d = findAlias (alias, op->reg2);
+                if (s == d || adj[s].count (d) || !(briggs (s, d) || george (s, d)))
+                    continue;
+
+                // the destination is renamed to the source
+                for (size_t other : adj[d]) {
+                    adj[other].erase (d);
+                    interference.add (s, other);
+                }
+                adj[d].clear ();
+                alias[d] = s;
+                coalesced++;
+                changed = true;
+            }
+        }
+    }
+
+    for (auto &block : blocks) {
+        for (const Instruction *inst : block) {
+            Operation *op = inst->op;
+            vector <size_t*> fields;
+            useFields (op, &fields);
+            size_t def;
+            if (definedReg (op, &def))
+                fields.push_back (&op->reg2);
+            for (size_t *field : fields)
+                *field = findAlias (alias, *field);
+        }
+    }
+    return coalesced;
+}
+
+void copyPropagation (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, size_t k) {
+
+    FlowGraph graph (lead, last, edges);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+    size_t numRegs = nextUnusedReg (fromMe);
+
+    size_t propagated = propagateCopies (blocks, graph);
+    size_t removed = removeDeadCopies (blocks, graph, numRegs);
+    size_t coalesced = coalesceCopies (blocks, graph, numRegs, k);
+    removed += removeDeadCopies (blocks, graph, numRegs);
+
+    vector <size_t> layout;
+    for (size_t b = 0; b < blocks.size (); b++)
+        layout.push_back (b);
+    joinBlocks (blocks, layout, toMe);
+
+    cerr << "copies: " << propagated << " uses propagated, " << removed << " removed, ";
+    cerr << coalesced << " coalesced\n";
+}
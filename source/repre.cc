@@ -25,8 +25,24 @@ struct Instructions* makeInstructions (struct Instruction* inst) {
     return res;
 }
 
+struct Instruction* makeBundled (struct Operation* op) {
+    Instruction* res = new Instruction (nullptr, op);
+    res->bundled = true;
+    return res;
+}
+
 void appendInstruction (struct Instructions* toMe, struct Instruction* inst) {
     toMe->insts.push_back (inst);
 }
 
+void appendInstructions (struct Instructions* toMe, struct Instructions* fromMe) {
+    toMe->insts.insert (toMe->insts.end (), fromMe->insts.begin (), fromMe->insts.end ());
+    fromMe->insts.clear ();
+    delete fromMe;
+}
+
+void labelInstructions (struct Instructions* toMe, char* label) {
+    const_cast <Instruction*> (toMe->insts[0])->label = label;
+}
+
 } // extern
@@ -0,0 +1,1882 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <unordered_set>
+
+#include "../headers/analysis.h"
+#include "../headers/optim.h"
+#include "../headers/ssa.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+// lattice value of sparse conditional constant propagation
+struct Lattice {
+    enum State { top, constant, bottom } state;
+    long long value;
+
+    Lattice (State s=top, long long v=0) : state (s), value (v) {}
+
+    bool operator!= (const Lattice &other) const {
+        return state != other.state || (state == constant && value != other.value);
+    }
+};
+
+static Lattice meet (const Lattice &a, const Lattice &b) {
+    if (a.state == Lattice::top)
+        return b;
+    if (b.state == Lattice::top)
+        return a;
+    if (a.state == Lattice::constant && b.state == Lattice::constant && a.value == b.value)
+        return a;
+    return Lattice (Lattice::bottom);
+}
+
+// help to find the successor of block that branch label leads to
+static size_t targetOf (const SSAForm &form, size_t block, const char *label) {
+    for (size_t s : form.succ[block]) {
+        if (form.label (s) != nullptr && strcmp (form.label (s), label) == 0)
+            return s;
+    }
+    return noBlock;
+}
+
+// help to insert instruction at the top of block, after its label
+static void insertAtTop (vector <const Instruction*> &block, Instruction *inst) {
+    if (block[0]->op->code == OpCode::nop_) {
+        block.insert (block.begin () + 1, inst);
+        return;
+    }
+
+    // move the label to the new instruction
+    inst->label = block[0]->label;
+    const_cast <Instruction*> (block[0])->label = nullptr;
+    block.insert (block.begin (), inst);
+}
+
+void constantPropagation (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+
+    size_t numBlocks = form.blocks.size ();
+    vector <Lattice> values (form.numNames ());
+    for (size_t name : form.entryNames)
+        values[name] = Lattice (Lattice::bottom);
+
+    vector <char> executed (numBlocks, 0);
+    vector <vector <char>> edgeExec (numBlocks);
+    for (size_t b = 0; b < numBlocks; b++)
+        edgeExec[b].assign (form.pred[b].size (), 0);
+
+    vector <pair <size_t, size_t>> cfgWork;
+    vector <size_t> ssaWork;
+
+    auto lower = [&] (size_t name, const Lattice &value) {
+        Lattice res = meet (values[name], value);
+        if (res != values[name]) {
+            values[name] = res;
+            ssaWork.push_back (name);
+        }
+    };
+
+    auto visitPhi = [&] (size_t b, size_t j) {
+        const Phi &phi = form.phis[b][j];
+        Lattice res;
+        for (size_t k = 0; k < phi.args.size (); k++) {
+            if (edgeExec[b][k])
+                res = meet (res, values[phi.args[k]]);
+        }
+        lower (phi.dst, res);
+    };
+
+    auto visitInst = [&] (size_t b, size_t i) {
+        const Operation *op = form.blocks[b][i]->op;
+        size_t key = opcodeMap[op->code - OpCode::nop_];
+
+        if (op->code == OpCode::cbr_) {
+            const Lattice &cond = values[op->reg0];
+            if (cond.state == Lattice::top)
+                return;
+            if (cond.state == Lattice::constant) {
+                const char *label = cond.value ? op->label1 : op->label2;
+                cfgWork.push_back (make_pair (b, targetOf (form, b, label)));
+            }
+            else for (size_t s : form.succ[b])
+                cfgWork.push_back (make_pair (b, s));
+            return;
+        }
+
+        if (op->code == OpCode::br_) {
+            cfgWork.push_back (make_pair (b, form.succ[b][0]));
+            return;
+        }
+
+        Lattice res (Lattice::bottom);
+        switch (key) {
+            case 0: // opcode on 3 registers
+            case 1: // opcode on 2 registers and 1 constant
+            case 5: // opcode 'not'
+            {
+                const Lattice &lhs = values[op->reg0];
+                Lattice rhs = (key == 0) ? values[op->reg1] : Lattice (Lattice::constant, op->constant);
+
+                // multiply or and with zero is zero whatever the other operand is
+                bool absorb = (op->code == OpCode::mult_ || op->code == OpCode::multI_ ||
+                    op->code == OpCode::and_ || op->code == OpCode::andI_) &&
+                    ((lhs.state == Lattice::constant && lhs.value == 0) ||
+                     (rhs.state == Lattice::constant && rhs.value == 0));
+
+                long long value;
+                if (absorb)
+                    res = Lattice (Lattice::constant, 0);
+                else if (lhs.state == Lattice::top || rhs.state == Lattice::top)
+                    res = Lattice (Lattice::top);
+                else if (lhs.state == Lattice::constant && rhs.state == Lattice::constant &&
+                    evaluate (op->code, lhs.value, rhs.value, &value))
+                    res = Lattice (Lattice::constant, value);
+                break;
+            }
+
+            case 2: // opcode 'i2i', 'c2c', 'i2c', 'c2i'
+                if (op->code == OpCode::i2i_ || op->code == OpCode::c2c_)
+                    res = values[op->reg0];
+                break;
+
+            case 4: // opcode 'loadI'
+                res = Lattice (Lattice::constant, op->constant);
+                break;
+
+            case 9: // no register is written
+                return;
+
+            default: break;
+        }
+        lower (op->reg2, res);
+    };
+
+    cfgWork.push_back (make_pair (noBlock, 0));
+    while (cfgWork.size () || ssaWork.size ()) {
+        while (cfgWork.size ()) {
+            auto edge = cfgWork.back ();
+            cfgWork.pop_back ();
+
+            size_t b = edge.second;
+            if (edge.first != noBlock) {
+                size_t k = find (form.pred[b].begin (), form.pred[b].end (), edge.first) - form.pred[b].begin ();
+                if (edgeExec[b][k])
+                    continue;
+                edgeExec[b][k] = 1;
+            }
+
+            // a new edge only changes phi functions of a visited block
+            for (size_t j = 0; j < form.phis[b].size (); j++)
+                visitPhi (b, j);
+            if (executed[b])
+                continue;
+            executed[b] = 1;
+
+            for (size_t i = 0; i < form.blocks[b].size (); i++)
+                visitInst (b, i);
+
+            // the natural edge, i.e. no br/cbr at the end
+            OpCode code = form.blocks[b].back ()->op->code;
+            if (code != OpCode::br_ && code != OpCode::cbr_ && form.succ[b].size ())
+                cfgWork.push_back (make_pair (b, form.succ[b][0]));
+        }
+
+        while (ssaWork.size ()) {
+            size_t name = ssaWork.back ();
+            ssaWork.pop_back ();
+
+            for (const SSASite &site : form.useSites[name]) {
+                if (!executed[site.block])
+                    continue;
+                if (site.phi)
+                    visitPhi (site.block, site.index);
+                else visitInst (site.block, site.index);
+            }
+        }
+    }
+
+    auto isConstant = [&] (size_t name) {
+        return values[name].state == Lattice::constant && isEncodable (values[name].value);
+    };
+
+    // delete the blocks that never execute
+    vector <size_t> layout;
+    for (size_t b : form.layout) {
+        if (executed[b]) {
+            layout.push_back (b);
+            continue;
+        }
+        while (form.succ[b].size ())
+            form.removeEdge (b, form.succ[b].back ());
+    }
+    form.layout = std::move (layout);
+
+    for (size_t b : form.layout) {
+        auto &block = form.blocks[b];
+
+        // phi functions of constant value become 'loadI'
+        for (size_t j = form.phis[b].size (); j-- > 0; ) {
+            size_t dst = form.phis[b][j].dst;
+            if (!isConstant (dst))
+                continue;
+            insertAtTop (block, new Instruction (nullptr, new Operation (
+                OpCode::loadI_, 0, 0, dst, values[dst].value)));
+            form.phis[b].erase (form.phis[b].begin () + j);
+        }
+
+        for (size_t i = 0; i < block.size (); i++) {
+            const Instruction *inst = block[i];
+            Operation *op = inst->op;
+
+            // conditional branch of constant condition becomes a jump
+            if (op->code == OpCode::cbr_ && values[op->reg0].state == Lattice::constant) {
+                const char *taken = values[op->reg0].value ? op->label1 : op->label2;
+                const char *other = values[op->reg0].value ? op->label2 : op->label1;
+
+                size_t keep = targetOf (form, b, taken), drop = targetOf (form, b, other);
+                if (keep != drop)
+                    form.removeEdge (b, drop);
+
+                block[i] = new Instruction (inst->label ? strdup (inst->label) : nullptr,
+                    new Operation (OpCode::br_, 0, 0, 0, 0, taken));
+                delete inst;
+                continue;
+            }
+
+            size_t name;
+            if (!definedReg (op, &name))
+                continue;
+
+            // the value is known, so compute it with 'loadI'
+            if (isConstant (name) && op->code != OpCode::loadI_) {
+                block[i] = new Instruction (inst->label ? strdup (inst->label) : nullptr,
+                    new Operation (OpCode::loadI_, 0, 0, name, values[name].value));
+                delete inst;
+                continue;
+            }
+
+            // use the immediate form when one operand is constant
+            bool immediate = (op->code >= OpCode::add_ && op->code <= OpCode::orI_ &&
+                opcodeMap[op->code - OpCode::nop_] == 0);
+            if (!immediate)
+                continue;
+
+            if (isCommutative (op->code) && isConstant (op->reg0) && !isConstant (op->reg1))
+                swap (op->reg0, op->reg1);
+            if (isConstant (op->reg1)) {
+                op->constant = values[op->reg1].value;
+                op->code = static_cast <OpCode> (op->code + 1);
+                op->reg1 = 0;
+            }
+        }
+    }
+
+    // the constants folded above may be left without any use
+    form.buildDefUse ();
+    for (size_t b : form.layout) {
+        auto &block = form.blocks[b];
+        for (size_t i = 0; i < block.size (); i++) {
+            size_t name;
+            if (!definedReg (block[i]->op, &name) || !isConstant (name) ||
+                form.useSites[name].size ())
+                continue;
+
+            const Instruction *inst = block[i];
+            block[i] = new Instruction (inst->label ? strdup (inst->label) : nullptr, new Operation ());
+            delete inst;
+        }
+
+        // drop the 'nop' left without label
+        block.erase (remove_if (block.begin (), block.end (), [] (const Instruction *inst) {
+            if (inst->op->code != OpCode::nop_ || inst->label != nullptr)
+                return false;
+            delete inst;
+            return true;
+        }), block.end ());
+
+        if (block.empty ())
+            block.push_back (new Instruction (nullptr, new Operation ()));
+    }
+
+    destroySSA (form, toMe);
+}
+
+void deadCodeElimination (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+
+    size_t numBlocks = form.blocks.size ();
+    auto &blocks = form.blocks;
+
+    // reverse graph with a virtual exit, the last block falls into 'halt'
+    size_t exitNode = numBlocks, lastBlock = form.layout.back ();
+    vector <vector <size_t>> revSucc (numBlocks + 1), revPred (numBlocks + 1);
+    for (size_t b = 0; b < numBlocks; b++) {
+        revSucc[b] = form.pred[b];
+        revPred[b] = form.succ[b];
+    }
+
+    OpCode lastCode = blocks[lastBlock].back ()->op->code;
+    if (lastCode != OpCode::br_ && lastCode != OpCode::cbr_) {
+        revSucc[exitNode].push_back (lastBlock);
+        revPred[lastBlock].push_back (exitNode);
+    }
+
+    // post-dominance frontier of block is where it is control dependent on
+    DominatorTree postDom (revSucc, revPred, exitNode);
+
+    vector <vector <char>> marked (numBlocks), phiMarked (numBlocks);
+    vector <char> live (numBlocks, 0), depsDone (numBlocks, 0);
+    for (size_t b = 0; b < numBlocks; b++) {
+        marked[b].assign (blocks[b].size (), 0);
+        phiMarked[b].assign (form.phis[b].size (), 0);
+    }
+
+    vector <SSASite> workList;
+    auto mark = [&] (size_t b, size_t i, bool phi) {
+        auto &flag = phi ? phiMarked[b][i] : marked[b][i];
+        if (flag)
+            return;
+        flag = 1;
+        live[b] = 1;
+        workList.push_back (SSASite {b, i, phi});
+    };
+
+    auto markBranch = [&] (size_t b) {
+        OpCode code = blocks[b].back ()->op->code;
+        if (code == OpCode::br_ || code == OpCode::cbr_)
+            mark (b, blocks[b].size () - 1, false);
+    };
+
+    // the useful operations change memory, do input or output
+    for (size_t b : form.layout) {
+        for (size_t i = 0; i < blocks[b].size (); i++) {
+            OpCode code = blocks[b][i]->op->code;
+            if ((code >= OpCode::store_ && code <= OpCode::cstoreAO_) ||
+                code >= OpCode::read_)
+                mark (b, i, false);
+        }
+
+        // keep the branches of blocks never reaching the exit, e.g. in infinite loop
+        if (!postDom.reachable (b))
+            markBranch (b);
+    }
+
+    auto propagate = [&] () {
+        while (workList.size ()) {
+            SSASite site = workList.back ();
+            workList.pop_back ();
+            size_t b = site.block;
+
+            vector <size_t> uses;
+            if (site.phi) {
+                uses = form.phis[b][site.index].args;
+
+                // the value of phi function depends on the edge taken
+                for (size_t p : form.pred[b]) {
+                    live[p] = 1;
+                    markBranch (p);
+                    if (!depsDone[p]) {
+                        depsDone[p] = 1;
+                        for (size_t c : postDom.frontier[p])
+                            markBranch (c);
+                    }
+                }
+            }
+            else usedRegs (blocks[b][site.index]->op, &uses);
+
+            for (size_t name : uses) {
+                const SSASite &def = form.defSite[name];
+                if (def.block != noBlock)
+                    mark (def.block, def.index, def.phi);
+            }
+
+            if (!depsDone[b]) {
+                depsDone[b] = 1;
+                for (size_t c : postDom.frontier[b])
+                    markBranch (c);
+            }
+        }
+    };
+    propagate ();
+
+    // a useless conditional branch jumps to the nearest useful post-dominator
+    // the last block is the target when nothing useful follows
+    auto nearestLive = [&] (size_t b) {
+        size_t t = postDom.idom[b];
+        while (t != exitNode && !live[t])
+            t = postDom.idom[t];
+        return (t == exitNode) ? lastBlock : t;
+    };
+
+    // such a target has no useful phi function, otherwise the branch is useful;
+    // keep the branch anyway if that does not hold
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b : form.layout) {
+            size_t i = blocks[b].size () - 1;
+            if (blocks[b][i]->op->code != OpCode::cbr_ || marked[b][i])
+                continue;
+
+            size_t t = nearestLive (b);
+            for (char flag : phiMarked[t]) {
+                if (flag) {
+                    mark (b, i, false);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+        propagate ();
+    }
+
+    // drop the useless phi functions
+    for (size_t b : form.layout) {
+        for (size_t j = form.phis[b].size (); j-- > 0; ) {
+            if (!phiMarked[b][j])
+                form.phis[b].erase (form.phis[b].begin () + j);
+        }
+    }
+
+    // sweep the useless operations
+    for (size_t b : form.layout) {
+        auto &block = blocks[b];
+        vector <const Instruction*> newBlock;
+
+        for (size_t i = 0; i < block.size (); i++) {
+            const Instruction *inst = block[i];
+            OpCode code = inst->op->code;
+
+            if (marked[b][i] || code == OpCode::br_ || code == OpCode::nop_) {
+                newBlock.push_back (inst);
+                continue;
+            }
+
+            if (code == OpCode::cbr_) {
+                // the target has a label, as it is not the entry
+                size_t t = nearestLive (b);
+                while (form.succ[b].size ())
+                    form.removeEdge (b, form.succ[b].back ());
+                form.succ[b].push_back (t);
+                form.pred[t].push_back (b);
+
+                newBlock.push_back (new Instruction (inst->label ? strdup (inst->label) : nullptr,
+                    new Operation (OpCode::br_, 0, 0, 0, 0, form.label (t))));
+            }
+
+            // keep the label with a 'nop'
+            else if (inst->label != nullptr)
+                newBlock.push_back (new Instruction (inst->label));
+
+            delete inst;
+        }
+
+        if (newBlock.empty ())
+            newBlock.push_back (new Instruction (nullptr, new Operation ()));
+        block = std::move (newBlock);
+    }
+
+    // drop the blocks which cannot be reached any more
+    vector <char> reached (numBlocks, 0);
+    vector <size_t> stack {0};
+    reached[0] = 1;
+    while (stack.size ()) {
+        size_t b = stack.back ();
+        stack.pop_back ();
+        for (size_t s : form.succ[b]) {
+            if (!reached[s]) {
+                reached[s] = 1;
+                stack.push_back (s);
+            }
+        }
+    }
+
+    vector <size_t> layout;
+    for (size_t b : form.layout) {
+        if (reached[b]) {
+            layout.push_back (b);
+            continue;
+        }
+        while (form.succ[b].size ())
+            form.removeEdge (b, form.succ[b].back ());
+    }
+    form.layout = std::move (layout);
+
+    vector <const Instruction*> swept;
+    destroySSA (form, &swept);
+
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (swept, &newLead, &newLast, &newEdges);
+    cleanControlFlow (swept, toMe, newLead, newLast, newEdges);
+    freeMemory (swept);
+}
+
+// the base of memory accessed at an absolute address, e.g. by 'output'
+static const size_t absoluteBase = noBlock;
+
+// memory read or written by an operation, 'width' bytes at 'offset' from
+// the address held by name 'base', 'known' is false for an offset register
+// whose value is not a constant
+struct MemoryAccess {
+    bool known;
+    size_t base;
+    long long offset;
+    size_t width;
+};
+
+// help to get the constant name is loaded with
+static bool constantOf (const SSAForm &form, size_t name, long long *value) {
+    const SSASite &site = form.defSite[name];
+    if (site.block == noBlock || site.phi)
+        return false;
+    const Operation *def = form.blocks[site.block][site.index]->op;
+    if (def->code != OpCode::loadI_)
+        return false;
+    *value = (long long) def->constant;
+    return true;
+}
+
+// help to find what a load, store or output accesses, an address computed
+// by adding constants to a name is taken as an offset from that name
+static MemoryAccess accessOf (const SSAForm &form, const Operation *op) {
+    bool store = op->code >= OpCode::store_ && op->code <= OpCode::cstoreAO_;
+    bool load = op->code >= OpCode::load_ && op->code <= OpCode::cloadAO_;
+    if (!store && !load && op->code != OpCode::output_ && op->code != OpCode::coutput_)
+        return MemoryAccess {false, 0, 0, 0};
+    bool byte = (op->code >= OpCode::cload_ && op->code <= OpCode::cloadAO_) ||
+        (op->code >= OpCode::cstore_ && op->code <= OpCode::cstoreAO_) || op->code == OpCode::coutput_;
+    MemoryAccess access {true, store ? op->reg1 : op->reg0, 0, byte ? 1u : 4u};
+
+    long long value;
+    switch (op->code) {
+        case OpCode::output_: case OpCode::coutput_:
+            access.base = absoluteBase;
+            access.offset = (long long) op->constant;
+            return access;
+
+        case OpCode::loadAI_: case OpCode::cloadAI_: case OpCode::storeAI_: case OpCode::cstoreAI_:
+            access.offset = (long long) op->constant;
+            break;
+
+        case OpCode::loadAO_: case OpCode::cloadAO_: case OpCode::storeAO_: case OpCode::cstoreAO_: {
+            size_t reg = store ? op->reg2 : op->reg1;
+            if (constantOf (form, reg, &value))
+                access.offset = value;
+            else if (constantOf (form, access.base, &value)) {
+                access.offset = value;
+                access.base = reg;
+            }
+            else access.known = false;
+            break;
+        }
+
+        default: break;
+    }
+
+    // look through a few copies and additions of constants
+    for (size_t step = 0; access.known && step < 8; step++) {
+        if (access.base >= form.defSite.size ())
+            break;
+        const SSASite &site = form.defSite[access.base];
+        if (site.block == noBlock || site.phi)
+            break;
+        const Operation *def = form.blocks[site.block][site.index]->op;
+
+        if (def->code == OpCode::loadI_) {
+            access.offset += (long long) def->constant;
+            access.base = absoluteBase;
+            break;
+        }
+        if (def->code == OpCode::addI_ || def->code == OpCode::subI_)
+            access.offset += (def->code == OpCode::addI_ ? 1 : -1) * (long long) def->constant;
+        else if (def->code == OpCode::add_ && constantOf (form, def->reg1, &value))
+            access.offset += value;
+        else if (def->code == OpCode::add_ && constantOf (form, def->reg0, &value)) {
+            access.offset += value;
+            access.base = def->reg1;
+            continue;
+        }
+        else if (def->code != OpCode::i2i_)
+            break;
+        access.base = def->reg0;
+    }
+    return access;
+}
+
+void deadStoreElimination (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+    form.buildDefUse ();
+
+    auto isStore = [] (OpCode code) { return code >= OpCode::store_ && code <= OpCode::cstoreAO_; };
+    auto readsMemory = [] (OpCode code) {
+        return (code >= OpCode::load_ && code <= OpCode::cloadAO_) ||
+            code == OpCode::output_ || code == OpCode::coutput_;
+    };
+
+    // the access of each memory operation
+    size_t numBlocks = form.blocks.size ();
+    vector <vector <MemoryAccess>> accesses (numBlocks);
+    for (size_t b = 0; b < numBlocks; b++) {
+        for (const Instruction *inst : form.blocks[b]) {
+            OpCode code = inst->op->code;
+            accesses[b].push_back (isStore (code) || readsMemory (code) ?
+                accessOf (form, inst->op) : MemoryAccess {false, 0, 0, 0});
+        }
+    }
+
+    // each byte written by a store with known address is a cell, whose
+    // liveness is found backward over the flow graph
+    map <pair <size_t, long long>, size_t> cellOf;
+    for (size_t b = 0; b < numBlocks; b++) {
+        for (size_t i = 0; i < form.blocks[b].size (); i++) {
+            const MemoryAccess &access = accesses[b][i];
+            if (!isStore (form.blocks[b][i]->op->code) || !access.known)
+                continue;
+            for (size_t k = 0; k < access.width; k++)
+                cellOf.insert (make_pair (make_pair (access.base, access.offset + k), cellOf.size ()));
+        }
+    }
+
+    size_t numCells = cellOf.size ();
+    BitVector all (numCells);
+    all.fill ();
+
+    // the cells of each base
+    map <size_t, BitVector> cellsOf;
+    for (const auto &cell : cellOf) {
+        auto it = cellsOf.emplace (cell.first.first, BitVector (numCells)).first;
+        it->second.set (cell.second);
+    }
+
+    // help to mark the cells an access may read, which are those of other
+    // bases, as the names may hold the same address, and the bytes it
+    // overlaps of its own base
+    auto read = [&] (const MemoryAccess &access, BitVector &live) {
+        auto it = cellsOf.find (access.base);
+        if (!access.known || it == cellsOf.end ()) {
+            live = all;
+            return;
+        }
+        BitVector others = all;
+        others.subtract (it->second);
+        live |= others;
+        for (size_t k = 0; k < access.width; k++) {
+            auto cell = cellOf.find (make_pair (access.base, access.offset + (long long) k));
+            if (cell != cellOf.end ())
+                live.set (cell->second);
+        }
+    };
+
+    // help to walk block backward from the cells live at its end, where a
+    // store kills the bytes it writes, and a definition of a base makes its
+    // cells live, since above it the name held another address; 'dead'
+    // collects the stores that write no live byte
+    auto walk = [&] (size_t b, BitVector live, vector <size_t> *dead) {
+        const auto &block = form.blocks[b];
+        for (size_t i = block.size (); i-- > 0;) {
+            const Operation *op = block[i]->op;
+            const MemoryAccess &access = accesses[b][i];
+
+            size_t def;
+            if (definedReg (op, &def) && cellsOf.find (def) != cellsOf.end ())
+                live |= cellsOf[def];
+
+            if (isStore (op->code) && access.known) {
+                bool used = false;
+                for (size_t k = 0; k < access.width; k++) {
+                    size_t cell = cellOf[make_pair (access.base, access.offset + (long long) k)];
+                    used = used || live.test (cell);
+                    live.reset (cell);
+                }
+                if (!used && dead != nullptr)
+                    dead->push_back (i);
+            }
+
+            else if (readsMemory (op->code))
+                read (access, live);
+        }
+        for (const Phi &phi : form.phis[b]) {
+            if (cellsOf.find (phi.dst) != cellsOf.end ())
+                live |= cellsOf[phi.dst];
+        }
+        return live;
+    };
+
+    // the code halts after a block without successors, and nothing reads
+    // memory from then on
+    vector <BitVector> liveIn (numBlocks, BitVector (numCells)), liveOut (numBlocks, BitVector (numCells));
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t k = form.layout.size (); k-- > 0;) {
+            size_t b = form.layout[k];
+            BitVector out (numCells);
+            for (size_t s : form.succ[b])
+                out |= liveIn[s];
+            liveOut[b] = out;
+
+            BitVector in = walk (b, out, nullptr);
+            if (in != liveIn[b]) {
+                liveIn[b] = in;
+                changed = true;
+            }
+        }
+    }
+
+    size_t removed = 0;
+    for (size_t b = 0; b < numBlocks; b++) {
+        vector <size_t> dead;
+        walk (b, liveOut[b], &dead);
+
+        // the stores are found from the end of block backward
+        auto &block = form.blocks[b];
+        for (size_t i : dead) {
+            const Instruction *inst = block[i];
+            if (inst->label != nullptr)
+                block[i] = new Instruction (inst->label);
+            else block.erase (block.begin () + i);
+            delete inst;
+        }
+        if (block.empty ())
+            block.push_back (new Instruction (nullptr, new Operation ()));
+        removed += dead.size ();
+    }
+
+    destroySSA (form, toMe);
+    if (removed)
+        cerr << "dead stores: " << removed << " removed\n";
+}
+
+// help to copy instruction without its label
+static const Instruction* withoutLabel (const Instruction *inst) {
+    const Operation *op = inst->op;
+    return new Instruction (nullptr, new Operation (op->code, op->reg0, op->reg1,
+        op->reg2, op->constant, op->label1, op->label2));
+}
+
+// one round of 'Clean', return false if nothing changed
+static bool cleanOnce (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    FlowGraph graph (lead, last, edges);
+    DominatorTree reach (graph);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+
+    size_t num = blocks.size ();
+    vector <size_t> layout;
+    vector <char> touched (num, 0);
+    bool changed = false;
+
+    // unreachable blocks are dropped
+    for (size_t b = 0; b < num; b++) {
+        if (reach.reachable (b))
+            layout.push_back (b);
+        else changed = true;
+    }
+
+    auto label = [&] (size_t b) { return string (blocks[b][0]->label); };
+    auto code = [&] (size_t b) { return blocks[b].back ()->op->code; };
+
+    // whether block does nothing but jump
+    auto onlyJumps = [&] (size_t b, OpCode jump) {
+        for (size_t i = 0; i + 1 < blocks[b].size (); i++) {
+            if (blocks[b][i]->op->code != OpCode::nop_)
+                return false;
+        }
+        return code (b) == jump;
+    };
+
+    for (size_t pos = 0; pos < layout.size (); pos++) {
+        size_t i = layout[pos];
+        size_t next = (pos + 1 < layout.size ()) ? layout[pos + 1] : noBlock;
+        const Operation *op = blocks[i].back ()->op;
+
+        // fold a redundant conditional branch
+        if (op->code == OpCode::cbr_ && strcmp (op->label1, op->label2) == 0) {
+            const Instruction *inst = blocks[i].back ();
+            blocks[i].back () = new Instruction (inst->label ? strdup (inst->label) : nullptr,
+                new Operation (OpCode::br_, 0, 0, 0, 0, op->label1));
+            delete inst;
+            op = blocks[i].back ()->op;
+            changed = true;
+        }
+
+        if (op->code != OpCode::br_ || touched[i])
+            continue;
+
+        size_t j = graph.succ[i][0];
+
+        // a jump to the next block is not needed, and its label is dropped
+        // later once nothing branches there
+        if (j == next) {
+            const Instruction *inst = blocks[i].back ();
+            blocks[i].pop_back ();
+            if (inst->label != nullptr)
+                blocks[i].push_back (new Instruction (inst->label));
+            if (blocks[i].empty ())
+                blocks[i].push_back (new Instruction (nullptr, new Operation ()));
+            delete inst;
+            touched[i] = touched[j] = 1;
+            changed = true;
+            continue;
+        }
+
+        if (j == i || touched[j])
+            continue;
+
+        // remove an empty block, its predecessors jump to its target
+        if (i != 0 && onlyJumps (i, OpCode::br_) && next != noBlock) {
+            bool safe = true;
+            for (size_t p : graph.pred[i])
+                safe = safe && !touched[p] && p != j;
+            if (!safe)
+                continue;
+
+            for (size_t p : graph.pred[i]) {
+                OpCode pcode = code (p);
+                if (pcode == OpCode::br_ || pcode == OpCode::cbr_)
+                    retarget (blocks[p].back (), label (i), label (j));
+                else blocks[p].push_back (new Instruction (nullptr, new Operation (
+                    OpCode::br_, 0, 0, 0, 0, label (j).c_str ())));
+                touched[p] = 1;
+            }
+
+            // the block is not reached any more
+            layout.erase (layout.begin () + pos--);
+            touched[i] = touched[j] = 1;
+            changed = true;
+            continue;
+        }
+
+        // combine with the only successor, if it does not fall through
+        if (j != 0 && graph.pred[j].size () == 1 &&
+            (code (j) == OpCode::br_ || code (j) == OpCode::cbr_)) {
+            delete blocks[i].back ();
+            blocks[i].pop_back ();
+
+            for (const Instruction *inst : blocks[j]) {
+                if (inst->label != nullptr && inst->op->code == OpCode::nop_)
+                    delete inst;
+                else if (inst->label != nullptr) {
+                    blocks[i].push_back (withoutLabel (inst));
+                    delete inst;
+                }
+                else blocks[i].push_back (inst);
+            }
+            blocks[j].clear ();
+
+            size_t at = find (layout.begin (), layout.end (), j) - layout.begin ();
+            layout.erase (layout.begin () + at);
+            if (at < pos)
+                pos--;
+            touched[i] = touched[j] = 1;
+            changed = true;
+            continue;
+        }
+
+        // hoist a branch, jump directly to where the empty successor branches
+        if (onlyJumps (j, OpCode::cbr_)) {
+            const Instruction *inst = blocks[i].back ();
+            const Operation *cbr = blocks[j].back ()->op;
+            blocks[i].back () = new Instruction (inst->label ? strdup (inst->label) : nullptr,
+                new Operation (OpCode::cbr_, cbr->reg0, 0, 0, 0, cbr->label1, cbr->label2));
+            delete inst;
+            touched[i] = 1;
+            changed = true;
+        }
+    }
+
+    // labels nobody branches to, and 'nop' without label, are dropped
+    unordered_set <string> targets;
+    for (size_t b : layout) {
+        for (const Instruction *inst : blocks[b]) {
+            if (inst->op->label1 != nullptr)
+                targets.insert (string (inst->op->label1));
+            if (inst->op->label2 != nullptr)
+                targets.insert (string (inst->op->label2));
+        }
+    }
+
+    for (size_t b : layout) {
+        vector <const Instruction*> newBlock;
+        for (const Instruction *inst : blocks[b]) {
+            bool dead = inst->label != nullptr && targets.find (string (inst->label)) == targets.end ();
+            if (dead && inst->op->code != OpCode::nop_) {
+                newBlock.push_back (withoutLabel (inst));
+                delete inst;
+                changed = true;
+            }
+            else if (inst->op->code == OpCode::nop_ && (dead || inst->label == nullptr)) {
+                delete inst;
+                changed = changed || dead;
+            }
+            else newBlock.push_back (inst);
+        }
+        blocks[b] = std::move (newBlock);
+    }
+
+    joinBlocks (blocks, layout, toMe);
+    return changed;
+}
+
+void cleanControlFlow (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    vector <const Instruction*> src;
+    bool changed = cleanOnce (fromMe, &src, lead, last, edges);
+
+    while (changed) {
+        vector <size_t> newLead, newLast;
+        vector <pair <size_t, size_t>> newEdges;
+        buildCFG (src, &newLead, &newLast, &newEdges);
+
+        vector <const Instruction*> dst;
+        changed = cleanOnce (src, &dst, newLead, newLast, newEdges);
+        freeMemory (src);
+        src = std::move (dst);
+    }
+
+    // the procedure cannot be empty
+    if (src.empty ())
+        src.push_back (new Instruction (nullptr, new Operation ()));
+    toMe->insert (toMe->end (), src.begin (), src.end ());
+}
+
+// whether partial redundancy elimination moves the operation, which
+// computes an expression of registers, or of memory for loads
+static bool isExpression (const Operation *op) {
+    size_t key = opcodeMap[op->code - OpCode::nop_];
+    if (key == 0 || key == 1 || key == 5)
+        return true;
+    return key == 3 && op->code != OpCode::read_ && op->code != OpCode::cread_;
+}
+
+// help to name the expression, the fields not read by opcode are ignored
+static string expressionTag (const Operation *op) {
+    size_t key = opcodeMap[op->code - OpCode::nop_];
+    bool twoRegs = key == 0 || op->code == OpCode::loadAO_ || op->code == OpCode::cloadAO_;
+    bool constant = key == 1 || op->code == OpCode::loadAI_ || op->code == OpCode::cloadAI_;
+    return makeHashTag (op->code, op->reg0, twoRegs ? op->reg1 : 0, constant ? op->constant : 0);
+}
+
+// one round of lazy code motion, return false if nothing is moved,
+// the entry must not be a loop header, as nothing is inserted before it
+static bool lazyCodeMotion (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    FlowGraph graph (lead, last, edges);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+    size_t numBlocks = blocks.size ();
+
+    // a store writes the register 'memory', which every load reads
+    size_t memory = nextUnusedReg (fromMe), nextReg = memory + 1;
+
+    // opcode and operands of each expression
+    unordered_map <string, size_t> exprId;
+    vector <Operation> exprOp;
+    vector <vector <size_t>> readers (memory + 1);
+
+    for (const auto &block : blocks) {
+        for (const Instruction *inst : block) {
+            if (!isExpression (inst->op))
+                continue;
+
+            string tag = expressionTag (inst->op);
+            if (exprId.find (tag) != exprId.end ())
+                continue;
+
+            size_t e = exprOp.size ();
+            exprId[tag] = e;
+            exprOp.push_back (Operation (inst->op->code, inst->op->reg0,
+                inst->op->reg1, 0, inst->op->constant));
+
+            vector <size_t> regs;
+            usedRegs (inst->op, &regs);
+            if (opcodeMap[inst->op->code - OpCode::nop_] == 3)
+                regs.push_back (memory);
+            for (size_t reg : regs)
+                readers[reg].push_back (e);
+        }
+    }
+
+    size_t numExprs = exprOp.size ();
+
+    // local properties, and the position of the first upward exposed
+    // and the last downward exposed computation of each expression
+    vector <BitVector> antLoc (numBlocks, BitVector (numExprs));
+    vector <BitVector> comp (numBlocks, BitVector (numExprs));
+    vector <BitVector> transp (numBlocks, BitVector (numExprs));
+    vector <unordered_map <size_t, size_t>> firstAt (numBlocks), lastAt (numBlocks);
+
+    for (size_t b = 0; b < numBlocks; b++) {
+        BitVector killed (numExprs);
+
+        for (size_t i = 0; i < blocks[b].size (); i++) {
+            const Operation *op = blocks[b][i]->op;
+            if (isExpression (op)) {
+                size_t e = exprId[expressionTag (op)];
+                if (!killed.test (e) && !antLoc[b].test (e)) {
+                    antLoc[b].set (e);
+                    firstAt[b][e] = i;
+                }
+                comp[b].set (e);
+                lastAt[b][e] = i;
+            }
+
+            size_t reg;
+            bool defined = definedReg (op, &reg);
+            if (op->code >= OpCode::store_ && op->code <= OpCode::cstoreAO_) {
+                reg = memory;
+                defined = true;
+            }
+            if (!defined)
+                continue;
+
+            for (size_t e : readers[reg]) {
+                killed.set (e);
+                comp[b].reset (e);
+            }
+        }
+
+        transp[b].fill ();
+        transp[b].subtract (killed);
+    }
+
+    BitVector full (numExprs);
+    full.fill ();
+
+    // available expressions, forward
+    vector <BitVector> availOut (numBlocks, full);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = 0; b < numBlocks; b++) {
+            BitVector in = (b == 0) ? BitVector (numExprs) : full;
+            for (size_t p : graph.pred[b])
+                in &= availOut[p];
+
+            in &= transp[b];
+            in |= comp[b];
+            if (in != availOut[b]) {
+                availOut[b] = in;
+                changed = true;
+            }
+        }
+    }
+
+    // anticipable expressions, backward
+    vector <BitVector> antIn (numBlocks, full), antOut (numBlocks);
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = numBlocks; b-- > 0; ) {
+            BitVector out = graph.succ[b].empty () ? BitVector (numExprs) : full;
+            for (size_t s : graph.succ[b])
+                out &= antIn[s];
+            antOut[b] = out;
+
+            out &= transp[b];
+            out |= antLoc[b];
+            if (out != antIn[b]) {
+                antIn[b] = out;
+                changed = true;
+            }
+        }
+    }
+
+    // earliest placement on each edge, from the block into its k-th successor
+    vector <vector <BitVector>> earliest (numBlocks);
+    for (size_t i = 0; i < numBlocks; i++) {
+        BitVector keep = transp[i];
+        keep &= antOut[i];
+
+        for (size_t j : graph.succ[i]) {
+            BitVector res = antIn[j];
+            res.subtract (availOut[i]);
+            res.subtract (keep);
+            earliest[i].push_back (res);
+        }
+    }
+
+    // placement delayed as late as possible, the entry starts with
+    // what is anticipable there, as if there is an edge into it
+    vector <BitVector> laterIn (numBlocks, full);
+    vector <vector <BitVector>> later (earliest);
+    laterIn[0] = antIn[0];
+
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < numBlocks; i++) {
+            BitVector pass = laterIn[i];
+            pass.subtract (antLoc[i]);
+
+            for (size_t k = 0; k < graph.succ[i].size (); k++) {
+                BitVector res = earliest[i][k];
+                res |= pass;
+                later[i][k] = res;
+            }
+        }
+
+        for (size_t j = 1; j < numBlocks; j++) {
+            BitVector in = full;
+            for (size_t p : graph.pred[j]) {
+                size_t k = find (graph.succ[p].begin (), graph.succ[p].end (), j) - graph.succ[p].begin ();
+                in &= later[p][k];
+            }
+            if (in != laterIn[j]) {
+                laterIn[j] = in;
+                changed = true;
+            }
+        }
+    }
+
+    // only expressions with some computation deleted are touched
+    vector <BitVector> deleted (numBlocks);
+    BitVector moved (numExprs);
+    for (size_t b = 0; b < numBlocks; b++) {
+        deleted[b] = antLoc[b];
+        deleted[b].subtract (laterIn[b]);
+        moved |= deleted[b];
+    }
+
+    if (!moved.any ()) {
+        for (auto &block : blocks)
+            freeMemory (block);
+        return false;
+    }
+
+    vector <size_t> temp (numExprs);
+    moved.forEach ([&] (size_t e) { temp[e] = nextReg++; });
+
+    auto compute = [&] (size_t e) {
+        const Operation &op = exprOp[e];
+        return new Instruction (nullptr, new Operation (op.code, op.reg0, op.reg1,
+            temp[e], op.constant));
+    };
+
+    // a deleted computation copies from the temporary, and the last
+    // computation in block saves its value into the temporary
+    for (size_t b = 0; b < numBlocks; b++) {
+        vector <const Instruction*> newBlock;
+
+        for (size_t i = 0; i < blocks[b].size (); i++) {
+            const Instruction *inst = blocks[b][i];
+            const Operation *op = inst->op;
+
+            size_t e = isExpression (op) ? exprId[expressionTag (op)] : 0;
+            if (!isExpression (op) || !moved.test (e)) {
+                newBlock.push_back (inst);
+                continue;
+            }
+
+            bool remove = deleted[b].test (e) && firstAt[b][e] == i;
+            bool save = comp[b].test (e) && lastAt[b][e] == i;
+            if (!remove && !save) {
+                newBlock.push_back (inst);
+                continue;
+            }
+
+            char *label = inst->label ? strdup (inst->label) : nullptr;
+            if (!remove) {
+                Instruction *saved = compute (e);
+                saved->label = label;
+                label = nullptr;
+                newBlock.push_back (saved);
+            }
+            newBlock.push_back (new Instruction (label, new Operation (
+                OpCode::i2i_, temp[e], 0, op->reg2)));
+            delete inst;
+        }
+        blocks[b] = std::move (newBlock);
+    }
+
+    // insert on edges, at the end of the only predecessor or the top of
+    // the only successor, otherwise in a new block splitting the edge
+    LabelMaker maker (fromMe);
+    vector <size_t> layout;
+
+    for (size_t i = 0; i < numBlocks; i++) {
+        layout.push_back (i);
+
+        for (size_t k = 0; k < graph.succ[i].size (); k++) {
+            size_t j = graph.succ[i][k];
+
+            BitVector insert = later[i][k];
+            insert.subtract (laterIn[j]);
+            insert &= moved;
+            if (!insert.any ())
+                continue;
+
+            if (graph.succ[i].size () == 1) {
+                OpCode code = blocks[i].back ()->op->code;
+                size_t at = blocks[i].size ();
+                if (code == OpCode::br_ || code == OpCode::cbr_)
+                    at--;
+
+                vector <const Instruction*> insts;
+                insert.forEach ([&] (size_t e) { insts.push_back (compute (e)); });
+                blocks[i].insert (blocks[i].begin () + at, insts.begin (), insts.end ());
+            }
+
+            else if (graph.pred[j].size () == 1)
+                insert.forEach ([&] (size_t e) { insertAtTop (blocks[j], compute (e)); });
+
+            // a block with more than one successor ends with 'cbr', so
+            // the new block can be placed right after it
+            else {
+                string target (blocks[j][0]->label), label = maker.make ("PRE");
+                retarget (blocks[i].back (), target, label);
+
+                vector <const Instruction*> split {new Instruction (label.c_str ())};
+                insert.forEach ([&] (size_t e) { split.push_back (compute (e)); });
+                split.push_back (new Instruction (nullptr, new Operation (
+                    OpCode::br_, 0, 0, 0, 0, target.c_str ())));
+
+                blocks.push_back (std::move (split));
+                layout.push_back (blocks.size () - 1);
+            }
+        }
+    }
+
+    // a new block placed right before its target falls into it
+    for (size_t pos = 0; pos + 1 < layout.size (); pos++) {
+        auto &block = blocks[layout[pos]];
+        const char *next = blocks[layout[pos + 1]][0]->label;
+        if (layout[pos] >= numBlocks && next != nullptr && strcmp (block.back ()->op->label1, next) == 0) {
+            delete block.back ();
+            block.pop_back ();
+        }
+    }
+
+    vector <const Instruction*> code;
+    joinBlocks (blocks, layout, &code);
+
+    // the copies through temporaries are coalesced by going through SSA form
+    vector <size_t> newLead, newLast;
+    vector <pair <size_t, size_t>> newEdges;
+    buildCFG (code, &newLead, &newLast, &newEdges);
+
+    SSAForm form;
+    buildSSA (code, newLead, newLast, newEdges, &form);
+    destroySSA (form, toMe);
+    freeMemory (code);
+    return true;
+}
+
+void partialRedundancyElimination (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    vector <const Instruction*> src;
+
+    // put a 'nop' before the entry if it is a loop header
+    FlowGraph graph (lead, last, edges);
+    if (graph.pred[0].size ())
+        src.push_back (new Instruction (nullptr, new Operation ()));
+    for (const Instruction *inst : fromMe)
+        src.push_back (new Instruction (inst));
+
+    // an expression reading the register written by a moved one may be
+    // moved in the next round, e.g. address arithmetic out of a loop
+    for (size_t round = 0; round < 4; round++) {
+        vector <size_t> newLead, newLast;
+        vector <pair <size_t, size_t>> newEdges;
+        buildCFG (src, &newLead, &newLast, &newEdges);
+
+        vector <const Instruction*> dst;
+        if (!lazyCodeMotion (src, &dst, newLead, newLast, newEdges))
+            break;
+
+        freeMemory (src);
+        src = std::move (dst);
+    }
+
+    toMe->insert (toMe->end (), src.begin (), src.end ());
+}
+
+// the associative and commutative operations a chain is made of
+enum Family { noFamily, addFamily, multFamily, andFamily, orFamily };
+
+static Family familyOf (OpCode code) {
+    switch (code) {
+        case OpCode::add_: case OpCode::addI_: case OpCode::sub_: case OpCode::subI_:
+            return addFamily;
+        case OpCode::mult_: case OpCode::multI_: return multFamily;
+        case OpCode::and_: case OpCode::andI_: return andFamily;
+        case OpCode::or_: case OpCode::orI_: return orFamily;
+        default: return noFamily;
+    }
+}
+
+// a name read by a chain, 'negated' only when subtracted in a chain of additions
+struct Term {
+    pair <size_t, size_t> rank;
+    size_t name;
+    bool negated;
+
+    bool operator< (const Term &other) const {
+        return rank != other.rank ? rank < other.rank : name < other.name;
+    }
+};
+
+// a tree of operations of one family, flattened into terms and a constant
+struct Chain {
+    Family family;
+    vector <Term> terms;
+    long long constant;
+
+    // names whose operations fold into the chain, and names loaded with
+    // a constant that is folded in
+    vector <size_t> interior, folded;
+};
+
+// reassociation by Briggs and Cooper on SSA form, every name is ranked by
+// the loop depth and the order of the value it is computed from, then each
+// chain is rebuilt so that constants and low ranked terms are combined first
+struct Reassociation {
+    SSAForm &form;
+
+    // (loop depth, definition order) of each name, a value computed from
+    // others has the highest rank of them, constants rank lowest
+    vector <pair <size_t, size_t>> rank;
+
+    // whether the only use of name is in an operation of the same family in
+    // the same block, so that it is folded into the chain of that operation
+    vector <char> interior;
+
+    Reassociation (SSAForm &f);
+
+    const Operation* defOf (size_t name) const;
+    void collect (const Operation *op, bool negated, Chain *chain) const;
+    bool rebuild (const Instruction *root, Chain *chain, vector <Instruction*> *before);
+};
+
+Reassociation :: Reassociation (SSAForm &f) : form (f) {
+    form.buildDefUse ();
+    size_t num = form.numNames ();
+
+    // the loop forest only needs the shape of the graph
+    FlowGraph graph;
+    graph.lead.assign (form.blocks.size (), 0);
+    graph.last.assign (form.blocks.size (), 0);
+    graph.succ = form.succ;
+    graph.pred = form.pred;
+    LoopForest forest (graph);
+    DominatorTree dom (form.succ, form.pred, 0);
+
+    // definitions come before uses in reverse post order, but for phi functions
+    rank.assign (num, make_pair (0, 0));
+    size_t order = 0;
+    for (size_t b : dom.order) {
+        size_t depth = forest.depth (b);
+        for (const Phi &phi : form.phis[b])
+            rank[phi.dst] = make_pair (depth, ++order);
+
+        for (const Instruction *inst : form.blocks[b]) {
+            size_t def;
+            if (!definedReg (inst->op, &def))
+                continue;
+
+            // a load or read may give another value each time
+            if (opcodeMap[inst->op->code - OpCode::nop_] == 3) {
+                rank[def] = make_pair (depth, ++order);
+                continue;
+            }
+            vector <size_t> uses;
+            usedRegs (inst->op, &uses);
+            for (size_t name : uses)
+                rank[def] = max (rank[def], rank[name]);
+        }
+    }
+
+    interior.assign (num, 0);
+    for (size_t name = 0; name < num; name++) {
+        const Operation *op = defOf (name);
+        if (op == nullptr || familyOf (op->code) == noFamily || form.useSites[name].size () != 1)
+            continue;
+        const SSASite &use = form.useSites[name][0];
+        interior[name] = !use.phi && use.block == form.defSite[name].block &&
+            familyOf (form.blocks[use.block][use.index]->op->code) == familyOf (op->code);
+    }
+}
+
+// the operation defining name, nullptr for a phi function or a value the
+// procedure starts with
+const Operation* Reassociation :: defOf (size_t name) const {
+    const SSASite &site = form.defSite[name];
+    if (site.block == noBlock || site.phi)
+        return nullptr;
+    return form.blocks[site.block][site.index]->op;
+}
+
+// help to flatten the operands of op into chain
+void Reassociation :: collect (const Operation *op, bool negated, Chain *chain) const {
+    auto constant = [&] (long long value, bool neg) {
+        static const OpCode combine[] = {OpCode::nop_, OpCode::add_, OpCode::mult_, OpCode::and_, OpCode::or_};
+        evaluate (neg ? OpCode::sub_ : combine[chain->family], chain->constant, value, &chain->constant);
+    };
+    auto operand = [&] (size_t name, bool neg) {
+        const Operation *def = defOf (name);
+        if (interior[name]) {
+            chain->interior.push_back (name);
+            collect (def, neg, chain);
+        }
+        else if (def != nullptr && def->code == OpCode::loadI_) {
+            chain->folded.push_back (name);
+            constant ((long long) def->constant, neg);
+        }
+        else chain->terms.push_back (Term {rank[name], name, neg});
+    };
+
+    bool subtract = op->code == OpCode::sub_ || op->code == OpCode::subI_;
+    operand (op->reg0, negated);
+    if (opcodeMap[op->code - OpCode::nop_] == 1)
+        constant ((long long) op->constant, negated != subtract);
+    else operand (op->reg1, negated != subtract);
+}
+
+// help to rebuild the chain rooted at instruction, the operations it needs
+// first are put in 'before', return false when it is kept as it is
+bool Reassociation :: rebuild (const Instruction *root, Chain *chain, vector <Instruction*> *before) {
+    static const long long identity[] = {0, 0, 1, -1, 0};
+    static const OpCode opcode[] = {OpCode::nop_, OpCode::add_, OpCode::mult_, OpCode::and_, OpCode::or_};
+
+    Operation *op = root->op;
+    chain->family = familyOf (op->code);
+    chain->constant = identity[chain->family];
+    collect (op, false, chain);
+
+    vector <Term> &terms = chain->terms;
+    size_t count = terms.size ();
+    sort (terms.begin (), terms.end ());
+
+    // x - x is gone, x and x and x or x are x
+    vector <Term> kept;
+    for (const Term &term : terms) {
+        if (kept.size () && kept.back ().name == term.name) {
+            if (chain->family == andFamily || chain->family == orFamily)
+                continue;
+            if (kept.back ().negated != term.negated) {
+                kept.pop_back ();
+                continue;
+            }
+        }
+        kept.push_back (term);
+    }
+    terms = std::move (kept);
+
+    if (chain->interior.empty () && chain->folded.empty () && terms.size () == count)
+        return false;
+
+    long long c = chain->constant;
+    bool absorb = (chain->family == multFamily || chain->family == andFamily) && c == 0;
+
+    // the terms start from the lowest ranked one which is not subtracted
+    size_t first = 0;
+    while (first < terms.size () && terms[first].negated)
+        first++;
+
+    size_t dst = op->reg2;
+    if (absorb || terms.empty ()) {
+        if (!isEncodable (c))
+            return false;
+        *op = Operation (OpCode::loadI_, 0, 0, dst, c);
+        return true;
+    }
+    if (first == terms.size ())
+        return false;
+
+    // the constant comes right after the first term
+    bool withConstant = c != identity[chain->family];
+    OpCode immediate = static_cast <OpCode> (opcode[chain->family] + 1);
+    if (withConstant && chain->family == addFamily && c < 0) {
+        immediate = OpCode::subI_;
+        c = -c;
+    }
+    if (withConstant && !isEncodable (c))
+        return false;
+
+    vector <Operation> steps;
+    size_t acc = terms[first].name;
+    auto step = [&] (OpCode code, size_t rhs, long long constant) {
+        size_t name = form.origReg.size ();
+        form.origReg.push_back (form.nextReg++);
+        steps.push_back (Operation (code, acc, rhs, name, constant));
+        acc = name;
+    };
+    if (withConstant)
+        step (immediate, 0, c);
+    for (size_t t = 0; t < terms.size (); t++) {
+        if (t != first)
+            step (terms[t].negated ? OpCode::sub_ : opcode[chain->family], terms[t].name, 0);
+    }
+
+    // the last step writes the root
+    if (steps.empty ()) {
+        *op = Operation (OpCode::i2i_, acc, 0, dst);
+        return true;
+    }
+    steps.back ().reg2 = dst;
+    for (size_t s = 0; s + 1 < steps.size (); s++) {
+        const Operation &o = steps[s];
+        before->push_back (new Instruction (nullptr, new Operation (o.code, o.reg0, o.reg1, o.reg2, o.constant)));
+    }
+    const Operation &o = steps.back ();
+    *op = Operation (o.code, o.reg0, o.reg1, o.reg2, o.constant);
+    return true;
+}
+
+void reassociation (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+    Reassociation pass (form);
+
+    size_t num = form.numNames (), chains = 0, before = 0, after = 0;
+    vector <char> removed (num, 0), constants (num, 0);
+    for (size_t b : form.layout) {
+        vector <const Instruction*> newBlock;
+        for (const Instruction *inst : form.blocks[b]) {
+            size_t def;
+            bool root = definedReg (inst->op, &def) && def < num && !pass.interior[def] &&
+                familyOf (inst->op->code) != noFamily;
+
+            vector <Instruction*> steps;
+            Chain chain;
+            if (root && pass.rebuild (inst, &chain, &steps)) {
+                chains++;
+                before += chain.interior.size () + 1;
+                after += steps.size () + 1;
+                for (size_t name : chain.interior)
+                    removed[name] = 1;
+                for (size_t name : chain.folded)
+                    constants[name] = 1;
+            }
+            newBlock.insert (newBlock.end (), steps.begin (), steps.end ());
+            newBlock.push_back (inst);
+        }
+        form.blocks[b] = std::move (newBlock);
+    }
+
+    // the constants folded into chains may no longer be read
+    vector <size_t> uses (form.numNames (), 0);
+    for (size_t b : form.layout) {
+        for (const Phi &phi : form.phis[b]) {
+            for (size_t name : phi.args)
+                uses[name]++;
+        }
+        for (const Instruction *inst : form.blocks[b]) {
+            size_t def;
+            if (definedReg (inst->op, &def) && def < num && removed[def])
+                continue;
+            vector <size_t> names;
+            usedRegs (inst->op, &names);
+            for (size_t name : names)
+                uses[name]++;
+        }
+    }
+
+    for (size_t b : form.layout) {
+        vector <const Instruction*> newBlock;
+        for (const Instruction *inst : form.blocks[b]) {
+            size_t def;
+            if (!definedReg (inst->op, &def) || def >= num ||
+                !(removed[def] || (constants[def] && uses[def] == 0)))
+                newBlock.push_back (inst);
+            else if (inst->label != nullptr) {
+                newBlock.push_back (new Instruction (inst->label));
+                delete inst;
+            }
+            else delete inst;
+        }
+        if (newBlock.empty ())
+            newBlock.push_back (new Instruction (nullptr, new Operation ()));
+        form.blocks[b] = std::move (newBlock);
+    }
+
+    destroySSA (form, toMe);
+    if (chains)
+        cerr << "reassociate: " << chains << " chains, " << before << " -> " << after << " operations\n";
+}
+
+// names whose value is known to be a multiple of four, found as the greatest
+// fixed point, so that a pointer stepped by four in a loop from an aligned
+// start is aligned too
+static vector <char> alignedNames (const SSAForm &form) {
+    size_t num = form.numNames ();
+    vector <char> aligned (num, 0);
+    for (size_t name = 0; name < num; name++)
+        aligned[name] = form.defSite[name].block != noBlock;
+
+    auto alignedOp = [&] (const Operation *op) -> bool {
+        long long c = (long long) op->constant;
+        switch (op->code) {
+            case OpCode::loadI_: return c % 4 == 0;
+            case OpCode::addI_: case OpCode::subI_: return c % 4 == 0 && aligned[op->reg0];
+            case OpCode::add_: case OpCode::sub_: return aligned[op->reg0] && aligned[op->reg1];
+            case OpCode::mult_: case OpCode::and_: return aligned[op->reg0] || aligned[op->reg1];
+            case OpCode::multI_: case OpCode::andI_: return c % 4 == 0 || aligned[op->reg0];
+            case OpCode::lshiftI_: return c >= 2 || aligned[op->reg0];
+            case OpCode::i2i_: return aligned[op->reg0];
+            default: return false;
+        }
+    };
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t b : form.layout) {
+            for (const Phi &phi : form.phis[b]) {
+                bool all = all_of (phi.args.begin (), phi.args.end (),
+                    [&] (size_t arg) { return aligned[arg]; });
+                if (aligned[phi.dst] && !all) {
+                    aligned[phi.dst] = 0;
+                    changed = true;
+                }
+            }
+            for (const Instruction *inst : form.blocks[b]) {
+                size_t def;
+                if (definedReg (inst->op, &def) && aligned[def] && !alignedOp (inst->op)) {
+                    aligned[def] = 0;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return aligned;
+}
+
+// whether name is known to hold a value from 0 to 255
+static bool isByte (const SSAForm &form, size_t name) {
+    const SSASite &site = form.defSite[name];
+    if (site.block == noBlock || site.phi)
+        return false;
+    const Operation *def = form.blocks[site.block][site.index]->op;
+    switch (def->code) {
+        case OpCode::cload_: case OpCode::cloadAI_: case OpCode::cloadAO_: case OpCode::i2c_:
+            return true;
+        case OpCode::loadI_: case OpCode::andI_:
+            return def->constant <= 255;
+        default: return false;
+    }
+}
+
+void byteWidening (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    SSAForm form;
+    buildSSA (fromMe, lead, last, edges, &form);
+    form.buildDefUse ();
+    vector <char> aligned = alignedNames (form);
+
+    size_t loads = 0, loadWords = 0, stores = 0, storeWords = 0;
+    for (size_t b : form.layout) {
+        auto &block = form.blocks[b];
+        vector <MemoryAccess> accesses;
+        for (const Instruction *inst : block) {
+            OpCode code = inst->op->code;
+            bool memory = (code >= OpCode::load_ && code <= OpCode::cstoreAO_) ||
+                code == OpCode::output_ || code == OpCode::coutput_;
+            accesses.push_back (memory ? accessOf (form, inst->op) : MemoryAccess {false, 0, 0, 0});
+        }
+
+        // what replaces each instruction rewritten
+        map <size_t, vector <Instruction*>> edits;
+        auto emit = [&] (vector <Instruction*> &out, OpCode code, size_t reg0, size_t reg1,
+            long long constant, size_t dst=noBlock) {
+            if (dst == noBlock) {
+                dst = form.origReg.size ();
+                form.origReg.push_back (form.nextReg++);
+            }
+            out.push_back (new Instruction (nullptr, new Operation (code, reg0, reg1, dst, constant)));
+            return dst;
+        };
+
+        // the byte accesses of one aligned word not rewritten yet, keyed by
+        // the base and the offset of the word, in the order they come
+        typedef pair <size_t, long long> Word;
+        map <Word, vector <size_t>> loadGroups, storeGroups;
+
+        // help to find the offset from the base register of instruction to
+        // the word, which must be written as a constant
+        auto wordOffset = [&] (size_t i, const Word &word, long long *offset) {
+            const Operation *op = block[i]->op;
+            bool immediate = op->code == OpCode::cloadAI_ || op->code == OpCode::cstoreAI_;
+            *offset = (immediate ? (long long) op->constant : 0) - (accesses[i].offset - word.second);
+            return isEncodable (*offset);
+        };
+
+        // a word is loaded at the first load, and each load takes its byte out
+        auto rewriteLoads = [&] (const Word &word, const vector <size_t> &group) {
+            long long offset;
+            if (group.size () < 2 || !wordOffset (group[0], word, &offset))
+                return;
+            size_t value = noBlock;
+            for (size_t i : group) {
+                const Operation *op = block[i]->op;
+                vector <Instruction*> &out = edits[i];
+                if (value == noBlock)
+                    value = emit (out, OpCode::loadAI_, op->reg0, 0, offset);
+                long long shift = 8 * (accesses[i].offset - word.second);
+                size_t byte = shift ? emit (out, OpCode::rshiftI_, value, 0, shift) : value;
+                emit (out, OpCode::andI_, byte, 0, 255, op->reg2);
+            }
+            loads += group.size ();
+            loadWords++;
+        };
+
+        // the bytes are put together and stored as a word at the last store
+        auto rewriteStores = [&] (const Word &word, const vector <size_t> &group) {
+            long long offset;
+            if (!wordOffset (group.back (), word, &offset))
+                return false;
+            size_t bytes[4];
+            for (size_t i : group)
+                bytes[accesses[i].offset - word.second] = block[i]->op->reg0;
+
+            vector <Instruction*> &out = edits[group.back ()];
+            size_t value = noBlock;
+            for (size_t k = 0; k < 4; k++) {
+                size_t part = bytes[k];
+                if (k < 3 && !isByte (form, part))
+                    part = emit (out, OpCode::andI_, part, 0, 255);
+                if (k > 0)
+                    part = emit (out, OpCode::lshiftI_, part, 0, 8 * k);
+                value = value == noBlock ? part : emit (out, OpCode::or_, value, part, 0);
+            }
+            out.push_back (new Instruction (nullptr, new Operation (OpCode::storeAI_, value,
+                block[group.back ()]->op->reg1, 0, offset)));
+            for (size_t i : group) {
+                if (i != group.back ())
+                    edits[i];
+            }
+            stores += group.size ();
+            storeWords++;
+            return true;
+        };
+
+        // help to close the groups which access may overlap, a load group is
+        // rewritten as it is, while a store group is given up
+        auto mayOverlap = [&] (const MemoryAccess &access, const Word &word) {
+            return !access.known || access.base != word.first ||
+                (access.offset < word.second + 4 && word.second < access.offset + (long long) access.width);
+        };
+        auto closeLoads = [&] (const MemoryAccess &access) {
+            for (auto it = loadGroups.begin (); it != loadGroups.end ();) {
+                if (!mayOverlap (access, it->first)) {
+                    it++;
+                    continue;
+                }
+                rewriteLoads (it->first, it->second);
+                it = loadGroups.erase (it);
+            }
+        };
+        auto closeStores = [&] (const MemoryAccess &access, const Word *except) {
+            for (auto it = storeGroups.begin (); it != storeGroups.end ();) {
+                if ((except != nullptr && it->first == *except) || !mayOverlap (access, it->first))
+                    it++;
+                else it = storeGroups.erase (it);
+            }
+        };
+
+        for (size_t i = 0; i < block.size (); i++) {
+            OpCode code = block[i]->op->code;
+            const MemoryAccess &access = accesses[i];
+            bool load = (code >= OpCode::load_ && code <= OpCode::cloadAO_) ||
+                code == OpCode::output_ || code == OpCode::coutput_;
+            bool store = code >= OpCode::store_ && code <= OpCode::cstoreAO_;
+            if (!load && !store)
+                continue;
+
+            // a byte of a word at an aligned address
+            bool byte = code == OpCode::cload_ || code == OpCode::cloadAI_ ||
+                code == OpCode::cstore_ || code == OpCode::cstoreAI_;
+            bool wordAligned = access.known && (access.base == absoluteBase || aligned[access.base]);
+            Word word (access.base, access.offset - ((access.offset % 4) + 4) % 4);
+
+            // a store cannot be delayed past a load of its bytes, and a load
+            // cannot be moved before a store to them
+            if (load) {
+                closeStores (access, nullptr);
+                if (byte && wordAligned)
+                    loadGroups[word].push_back (i);
+                continue;
+            }
+
+            closeLoads (access);
+            closeStores (access, byte && wordAligned ? &word : nullptr);
+            if (!byte || !wordAligned)
+                continue;
+
+            vector <size_t> &group = storeGroups[word];
+            group.push_back (i);
+
+            // every byte of the word is written
+            unsigned covered = 0;
+            for (size_t j : group)
+                covered |= 1u << (accesses[j].offset - word.second);
+            if (covered == 15) {
+                rewriteStores (word, group);
+                storeGroups.erase (word);
+            }
+        }
+        for (const auto &group : loadGroups)
+            rewriteLoads (group.first, group.second);
+
+        if (edits.empty ())
+            continue;
+        vector <const Instruction*> newBlock;
+        for (size_t i = 0; i < block.size (); i++) {
+            auto it = edits.find (i);
+            if (it == edits.end ()) {
+                newBlock.push_back (block[i]);
+                continue;
+            }
+            if (block[i]->label != nullptr)
+                newBlock.push_back (new Instruction (block[i]->label));
+            newBlock.insert (newBlock.end (), it->second.begin (), it->second.end ());
+            delete block[i];
+        }
+        if (newBlock.empty ())
+            newBlock.push_back (new Instruction (nullptr, new Operation ()));
+        block = std::move (newBlock);
+    }
+
+    destroySSA (form, toMe);
+    if (loads || stores)
+        cerr << "widen: " << loads << " byte loads into " << loadWords << " words, " <<
+            stores << " byte stores into " << storeWords << " words\n";
+}
@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+#include "../headers/analysis.h"
+#include "../headers/optim.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+// an edge of the dependence graph, the operation 'to' may not issue
+// until 'delay' cycles after the one it comes from has
+struct Edge {
+    size_t to, delay;
+};
+
+// help to tell whether operation reads memory, output prints a word of it
+static bool readsMemory (OpCode code) {
+    return (code >= OpCode::load_ && code <= OpCode::cloadAO_) ||
+        code == OpCode::output_ || code == OpCode::coutput_;
+}
+
+static bool writesMemory (OpCode code) {
+    return code >= OpCode::store_ && code <= OpCode::cstoreAO_;
+}
+
+static bool isInputOutput (OpCode code) {
+    return code >= OpCode::read_;
+}
+
+static bool endsBlock (OpCode code) {
+    return code == OpCode::br_ || code == OpCode::cbr_ || code == OpCode::halt_;
+}
+
+// help to find the bytes an access touches from its base register,
+// false if they are not known
+static bool accessRange (const Operation *op, size_t *base, long long *offset, long long *width) {
+    switch (op->code) {
+        case OpCode::load_: case OpCode::cload_:
+            *base = op->reg0;
+            *offset = 0;
+            break;
+        case OpCode::loadAI_: case OpCode::cloadAI_:
+            *base = op->reg0;
+            *offset = (long long) op->constant;
+            break;
+        case OpCode::store_: case OpCode::cstore_:
+            *base = op->reg1;
+            *offset = 0;
+            break;
+        case OpCode::storeAI_: case OpCode::cstoreAI_:
+            *base = op->reg1;
+            *offset = (long long) op->constant;
+            break;
+        default:
+            return false;
+    }
+    bool byte = op->code == OpCode::cload_ || op->code == OpCode::cloadAI_ ||
+        op->code == OpCode::cstore_ || op->code == OpCode::cstoreAI_;
+    *width = byte ? 1 : 4;
+    return true;
+}
+
+// help to build the dependences among operations in order, through
+// registers, and through memory where a store stays ordered with every
+// access that may touch the same bytes, accesses off one base register with
+// the same value are told apart by their offsets, input and output stay in order
+static void buildDependences (const vector <const Operation*> &ops, vector <vector <Edge>> *succ) {
+    size_t n = ops.size ();
+    succ->assign (n, vector <Edge> ());
+
+    unordered_map <size_t, size_t> lastDef, defCount;
+    unordered_map <size_t, vector <size_t>> readers;
+
+    // the number of writes of the base register before each access
+    vector <size_t> version (n, 0);
+    vector <size_t> loads, stores;
+    size_t lastInputOutput = n;
+
+    auto disjoint = [&] (size_t i, size_t j) {
+        size_t bi, bj;
+        long long oi, oj, wi, wj;
+        if (!accessRange (ops[i], &bi, &oi, &wi) || !accessRange (ops[j], &bj, &oj, &wj))
+            return false;
+        return bi == bj && version[i] == version[j] && (oi + wi <= oj || oj + wj <= oi);
+    };
+
+    for (size_t j = 0; j < n; j++) {
+        const Operation *op = ops[j];
+
+        size_t base;
+        long long offset, width;
+        if (accessRange (op, &base, &offset, &width))
+            version[j] = defCount[base];
+
+        vector <size_t> uses;
+        usedRegs (op, &uses);
+        for (size_t reg : uses) {
+            auto it = lastDef.find (reg);
+            if (it != lastDef.end ())
+                (*succ)[it->second].push_back (Edge {j, latency (ops[it->second]->code)});
+            readers[reg].push_back (j);
+        }
+
+        size_t def;
+        if (definedReg (op, &def)) {
+            for (size_t i : readers[def]) {
+                if (i != j)
+                    (*succ)[i].push_back (Edge {j, 0});
+            }
+            auto it = lastDef.find (def);
+            if (it != lastDef.end ())
+                (*succ)[it->second].push_back (Edge {j, 1});
+            readers[def].clear ();
+            lastDef[def] = j;
+            defCount[def]++;
+        }
+
+        if (readsMemory (op->code)) {
+            for (size_t i : stores) {
+                if (!disjoint (i, j))
+                    (*succ)[i].push_back (Edge {j, latency (ops[i]->code)});
+            }
+            loads.push_back (j);
+        }
+        if (writesMemory (op->code)) {
+            for (size_t i : loads) {
+                if (!disjoint (i, j))
+                    (*succ)[i].push_back (Edge {j, 0});
+            }
+            for (size_t i : stores) {
+                if (!disjoint (i, j))
+                    (*succ)[i].push_back (Edge {j, 1});
+            }
+            stores.push_back (j);
+        }
+        if (isInputOutput (op->code)) {
+            if (lastInputOutput < n)
+                (*succ)[lastInputOutput].push_back (Edge {j, 1});
+            lastInputOutput = j;
+        }
+    }
+}
+
+// the issue slots and units taken in each cycle
+struct Reservations {
+    Machine machine;
+    vector <size_t> issued, memory, multiply;
+
+    bool fits (size_t cycle, OpCode code) {
+        if (cycle >= issued.size ()) {
+            issued.resize (cycle + 1, 0);
+            memory.resize (cycle + 1, 0);
+            multiply.resize (cycle + 1, 0);
+        }
+        return issued[cycle] < machine.width &&
+            (!usesMemory (code) || memory[cycle] < machine.memory) &&
+            (!usesMultiplier (code) || multiply[cycle] < machine.multiply);
+    }
+
+    void take (size_t cycle, OpCode code) {
+        issued[cycle]++;
+        if (usesMemory (code))
+            memory[cycle]++;
+        if (usesMultiplier (code))
+            multiply[cycle]++;
+    }
+};
+
+// help to estimate the cycles operations take when issued in 'order' by an
+// in-order machine which waits for operands, and for a free slot or unit
+static size_t estimateCycles (const vector <const Operation*> &ops,
+    const vector <vector <Edge>> &succ, const vector <size_t> &order) {
+
+    size_t n = ops.size ();
+    vector <size_t> ready (n, 0);
+    Reservations busy;
+    size_t now = 0, finish = 0;
+    for (size_t i : order) {
+        size_t cycle = max (now, ready[i]);
+        while (!busy.fits (cycle, ops[i]->code))
+            cycle++;
+        busy.take (cycle, ops[i]->code);
+        now = cycle;
+        finish = max (finish, cycle + latency (ops[i]->code));
+        for (const Edge &edge : succ[i])
+            ready[edge.to] = max (ready[edge.to], cycle + edge.delay);
+    }
+    return finish;
+}
+
+// help to schedule the operations cycle by cycle, among the operations whose
+// operands are ready the one with the longest path of latencies to the end
+// goes first, returns the operations in the order they issue, and the
+// cycle of each in 'cycleOf' if given
+static void listSchedule (const vector <const Operation*> &ops,
+    const vector <vector <Edge>> &succ, vector <size_t> *order,
+    vector <size_t> *cycles=nullptr) {
+
+    size_t n = ops.size ();
+    vector <size_t> height (n, 0), preds (n, 0), ready (n, 0), cycleOf (n, 0);
+    for (size_t i = n; i-- > 0;) {
+        height[i] = latency (ops[i]->code);
+        for (const Edge &edge : succ[i]) {
+            height[i] = max (height[i], edge.delay + height[edge.to]);
+            preds[edge.to]++;
+        }
+    }
+
+    Reservations busy;
+    vector <bool> done (n, false);
+    size_t left = n;
+    for (size_t cycle = 0; left; cycle++) {
+        while (true) {
+            size_t pick = n;
+            for (size_t i = 0; i < n; i++) {
+                if (done[i] || preds[i] || ready[i] > cycle || !busy.fits (cycle, ops[i]->code))
+                    continue;
+                if (pick == n || height[i] > height[pick])
+                    pick = i;
+            }
+            if (pick == n)
+                break;
+
+            done[pick] = true;
+            left--;
+            cycleOf[pick] = cycle;
+            busy.take (cycle, ops[pick]->code);
+            for (const Edge &edge : succ[pick]) {
+                preds[edge.to]--;
+                ready[edge.to] = max (ready[edge.to], cycle + edge.delay);
+            }
+        }
+    }
+
+    // operations in one cycle keep their order, so edges without delay hold
+    order->clear ();
+    for (size_t i = 0; i < n; i++)
+        order->push_back (i);
+    stable_sort (order->begin (), order->end (), [&] (size_t a, size_t b) {
+        return cycleOf[a] < cycleOf[b];
+    });
+    if (cycles != nullptr)
+        *cycles = std::move (cycleOf);
+}
+
+// help to schedule the blocks 'region', each falling into the next along a
+// conditional branch, an operation moves above such a branch only when it
+// cannot fault or have effects, and writes no register live on the other
+// path, nothing moves below a branch, returns the estimated cycles saved
+static size_t scheduleRegion (vector <vector <const Instruction*>> &blocks,
+    const vector <size_t> &region, const Liveness &live,
+    const unordered_map <string, size_t> &blockOf, vector <const Instruction*> *toMe,
+    size_t *before, size_t *after) {
+
+    // the operations to reorder, without the nops
+    vector <const Instruction*> insts;
+    vector <const Operation*> ops;
+    for (size_t b : region) {
+        for (const Instruction *inst : blocks[b]) {
+            if (inst->op->code == OpCode::nop_)
+                continue;
+            insts.push_back (inst);
+            ops.push_back (inst->op);
+        }
+    }
+
+    size_t n = ops.size ();
+    vector <vector <Edge>> succ;
+    buildDependences (ops, &succ);
+
+    for (size_t t = 0; t < n; t++) {
+        const Operation *branch = ops[t];
+        if (!endsBlock (branch->code))
+            continue;
+        for (size_t i = 0; i < t; i++)
+            succ[i].push_back (Edge {t, 0});
+
+        // the path leaving the region, if any
+        const BitVector *other = nullptr;
+        if (branch->code == OpCode::cbr_ && t + 1 < n) {
+            for (const char *label : {branch->label1, branch->label2}) {
+                size_t target = blockOf.at (string (label));
+                if (find (region.begin (), region.end (), target) == region.end ())
+                    other = &live.liveIn[target];
+            }
+        }
+        for (size_t j = t + 1; j < n; j++) {
+            OpCode code = ops[j]->code;
+            size_t def;
+            bool safe = other != nullptr && !readsMemory (code) && !writesMemory (code) &&
+                !isInputOutput (code) && !endsBlock (code) &&
+                code != OpCode::div_ && code != OpCode::divI_ &&
+                !(definedReg (ops[j], &def) && other->test (def));
+            if (!safe)
+                succ[t].push_back (Edge {j, 0});
+        }
+    }
+
+    vector <size_t> order, original;
+    for (size_t i = 0; i < n; i++)
+        original.push_back (i);
+    listSchedule (ops, succ, &order);
+
+    *before = estimateCycles (ops, succ, original);
+    *after = estimateCycles (ops, succ, order);
+    if (*after >= *before) {
+        *after = *before;
+        for (size_t b : region) {
+            for (const Instruction *inst : blocks[b])
+                toMe->push_back (inst);
+        }
+        return 0;
+    }
+
+    // each block's label goes on the first operation after the branch
+    // into it, or on a nop if there is none
+    vector <char*> labels;
+    for (size_t b : region) {
+        labels.push_back (blocks[b][0]->label);
+        const_cast <Instruction*> (blocks[b][0])->label = nullptr;
+        for (const Instruction *inst : blocks[b]) {
+            if (inst->op->code == OpCode::nop_)
+                delete inst;
+        }
+    }
+
+    size_t segment = 0;
+    char *pending = labels[0];
+    for (size_t i : order) {
+        Instruction *inst = const_cast <Instruction*> (insts[i]);
+        inst->label = pending;
+        pending = nullptr;
+        toMe->push_back (inst);
+        if (endsBlock (inst->op->code) && segment + 1 < labels.size ())
+            pending = labels[++segment];
+    }
+    if (pending != nullptr)
+        toMe->push_back (new Instruction (pending, new Operation ()));
+
+    return *before - *after;
+}
+
+void listScheduling (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, bool superblocks) {
+
+    FlowGraph graph (lead, last, edges);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+    Liveness live (blocks, graph.succ, nextUnusedReg (fromMe));
+
+    unordered_map <string, size_t> blockOf;
+    for (size_t b = 0; b < blocks.size (); b++) {
+        if (blocks[b][0]->label != nullptr)
+            blockOf[string (blocks[b][0]->label)] = b;
+    }
+
+    // a superblock goes on from a block into the next one along a conditional
+    // branch, as long as that block is reached from nowhere else
+    size_t total = 0, improved = 0;
+    for (size_t b = 0; b < blocks.size ();) {
+        vector <size_t> region {b};
+        while (superblocks) {
+            size_t cur = region.back (), next = cur + 1;
+            const Operation *op = blocks[cur].back ()->op;
+            if (next >= blocks.size () || op->code != OpCode::cbr_ ||
+                blocks[next][0]->label == nullptr || graph.pred[next].size () != 1)
+                break;
+            string label (blocks[next][0]->label);
+            if ((label == op->label1) == (label == op->label2))
+                break;
+            region.push_back (next);
+        }
+        b = region.back () + 1;
+
+        string name;
+        for (size_t r : region) {
+            const char *label = blocks[r][0]->label;
+            name += (name.empty () ? "" : "+") + string (label != nullptr ? label : "entry");
+        }
+
+        size_t before, after;
+        size_t saved = scheduleRegion (blocks, region, live, blockOf, toMe, &before, &after);
+        if (saved == 0)
+            continue;
+        cerr << "schedule " << name << ": " << before << " -> " << after << " cycles\n";
+        total += saved;
+        improved++;
+    }
+
+    cerr << "schedule: " << total << " cycles saved in " << improved << " blocks\n";
+}
+
+void bundlePacking (const vector <const Instruction*> &fromMe,
+    vector <const Instruction*> *toMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges) {
+
+    FlowGraph graph (lead, last, edges);
+
+    vector <vector <const Instruction*>> blocks;
+    splitBlocks (fromMe, graph, &blocks);
+
+    size_t numOps = 0, numBundles = 0;
+    for (auto &block : blocks) {
+        char *label = block[0]->label;
+        const_cast <Instruction*> (block[0])->label = nullptr;
+
+        vector <const Instruction*> insts;
+        vector <const Operation*> ops;
+        for (const Instruction *inst : block) {
+            if (inst->op->code == OpCode::nop_) {
+                delete inst;
+                continue;
+            }
+            insts.push_back (inst);
+            ops.push_back (inst->op);
+        }
+        if (insts.empty ()) {
+            toMe->push_back (new Instruction (label, new Operation ()));
+            continue;
+        }
+
+        // the branch ending the block goes in the last group
+        size_t n = ops.size ();
+        vector <vector <Edge>> succ;
+        buildDependences (ops, &succ);
+        if (endsBlock (ops[n - 1]->code)) {
+            for (size_t i = 0; i + 1 < n; i++)
+                succ[i].push_back (Edge {n - 1, 0});
+        }
+
+        // the operations issued in one cycle make a group, in which an
+        // operation only reads what others write in later cycles
+        vector <size_t> order, cycleOf (n, 0);
+        listSchedule (ops, succ, &order, &cycleOf);
+        for (size_t k = 0; k < n; k++) {
+            Instruction *inst = const_cast <Instruction*> (insts[order[k]]);
+            inst->bundled = k > 0 && cycleOf[order[k]] == cycleOf[order[k - 1]];
+            if (!inst->bundled)
+                numBundles++;
+            if (k == 0)
+                inst->label = label;
+            toMe->push_back (inst);
+        }
+        numOps += n;
+    }
+
+    cerr << "pack: " << numOps << " operations in " << numBundles << " groups\n";
+}
@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "../headers/optim.h"
+#include "../headers/ssa.h"
+#include "../headers/util.h"
+
+using namespace std;
+
+SSAForm :: ~SSAForm () {
+    for (auto &block : blocks)
+        freeMemory (block);
+}
+
+void SSAForm :: buildDefUse () {
+    defSite.assign (numNames (), SSASite {noBlock, 0, false});
+    useSites.assign (numNames (), vector <SSASite> ());
+
+    for (size_t b : layout) {
+        for (size_t j = 0; j < phis[b].size (); j++) {
+            defSite[phis[b][j].dst] = SSASite {b, j, true};
+            for (size_t arg : phis[b][j].args)
+                useSites[arg].push_back (SSASite {b, j, true});
+        }
+
+        for (size_t i = 0; i < blocks[b].size (); i++) {
+            const Operation *op = blocks[b][i]->op;
+
+            vector <size_t> uses;
+            usedRegs (op, &uses);
+            for (size_t name : uses)
+                useSites[name].push_back (SSASite {b, i, false});
+
+            size_t name;
+            if (definedReg (op, &name))
+                defSite[name] = SSASite {b, i, false};
+        }
+    }
+}
+
+void SSAForm :: removeEdge (size_t from, size_t to) {
+    auto it = find (pred[to].begin (), pred[to].end (), from);
+    if (it == pred[to].end ())
+        return;
+
+    size_t k = it - pred[to].begin ();
+    pred[to].erase (it);
+    for (Phi &phi : phis[to])
+        phi.args.erase (phi.args.begin () + k);
+
+    succ[from].erase (find (succ[from].begin (), succ[from].end (), to));
+}
+
+void buildSSA (const vector <const Instruction*> &fromMe,
+    const vector <size_t> &lead, const vector <size_t> &last,
+    const vector <pair <size_t, size_t>> &edges, SSAForm *toMe) {
+
+    FlowGraph graph (lead, last, edges);
+
+    // the entry block must not be a branch target, otherwise the values
+    // from before the procedure would need a phi function there
+    if (graph.pred[0].size ()) {
+        vector <const Instruction*> insts {new Instruction (nullptr, new Operation ())};
+        insts.insert (insts.end (), fromMe.begin (), fromMe.end ());
+
+        vector <size_t> newLead, newLast;
+        vector <pair <size_t, size_t>> newEdges;
+        buildCFG (insts, &newLead, &newLast, &newEdges);
+        buildSSA (insts, newLead, newLast, newEdges, toMe);
+
+        delete insts[0];
+        return;
+    }
+
+    DominatorTree reach (graph);
+
+    // keep only reachable blocks, in the original order
+    vector <size_t> index (graph.size (), noBlock);
+    vector <vector <const Instruction*>> &blocks = toMe->blocks;
+
+    for (size_t b = 0; b < graph.size (); b++) {
+        if (!reach.reachable (b))
+            continue;
+        index[b] = blocks.size ();
+        blocks.push_back (vector <const Instruction*> ());
+        for (size_t i = lead[b]; i <= last[b]; i++)
+            blocks.back ().push_back (new Instruction (fromMe[i]));
+    }
+
+    size_t num = blocks.size ();
+    toMe->succ.assign (num, vector <size_t> ());
+    toMe->pred.assign (num, vector <size_t> ());
+    toMe->phis.assign (num, vector <Phi> ());
+
+    for (size_t b = 0; b < graph.size (); b++) {
+        if (index[b] == noBlock)
+            continue;
+        toMe->layout.push_back (index[b]);
+        for (size_t s : graph.succ[b]) {
+            toMe->succ[index[b]].push_back (index[s]);
+            toMe->pred[index[s]].push_back (index[b]);
+        }
+    }
+
+    DominatorTree domTree (toMe->succ, toMe->pred, 0);
+
+    size_t numRegs = nextUnusedReg (fromMe);
+    toMe->nextReg = numRegs;
+    Liveness liveness (blocks, toMe->succ, numRegs);
+
+    // blocks where each register is written
+    vector <vector <size_t>> defBlocks (numRegs);
+    for (size_t b = 0; b < num; b++) {
+        for (const Instruction *inst : blocks[b]) {
+            size_t reg;
+            if (definedReg (inst->op, &reg) &&
+                (defBlocks[reg].empty () || defBlocks[reg].back () != b))
+                defBlocks[reg].push_back (b);
+        }
+    }
+
+    // place phi functions on the iterated dominance frontier
+    // the arguments hold the original register until renamed
+    vector <size_t> hasPhi (num, noBlock), inWork (num, noBlock);
+    for (size_t reg = 0; reg < numRegs; reg++) {
+        vector <size_t> workList = defBlocks[reg];
+        for (size_t b : workList)
+            inWork[b] = reg;
+
+        while (workList.size ()) {
+            size_t x = workList.back ();
+            workList.pop_back ();
+
+            for (size_t y : domTree.frontier[x]) {
+                if (hasPhi[y] == reg || !liveness.liveIn[y].test (reg))
+                    continue;
+
+                hasPhi[y] = reg;
+                toMe->phis[y].push_back (Phi {reg, vector <size_t> (toMe->pred[y].size (), reg)});
+
+                if (inWork[y] != reg) {
+                    inWork[y] = reg;
+                    workList.push_back (y);
+                }
+            }
+        }
+    }
+
+    // stack of current names of each register
+    vector <vector <size_t>> stacks (numRegs);
+    vector <size_t> entryName (numRegs, noBlock);
+
+    auto newName = [&] (size_t reg) {
+        toMe->origReg.push_back (reg);
+        stacks[reg].push_back (toMe->origReg.size () - 1);
+        return toMe->origReg.size () - 1;
+    };
+
+    auto current = [&] (size_t reg) {
+        if (stacks[reg].size ())
+            return stacks[reg].back ();
+
+        // the register is read before written on some path
+        if (entryName[reg] == noBlock) {
+            toMe->origReg.push_back (reg);
+            entryName[reg] = toMe->origReg.size () - 1;
+            toMe->entryNames.push_back (entryName[reg]);
+        }
+        return entryName[reg];
+    };
+
+    // rename along the dominator tree, remembering what each block pushed
+    vector <vector <size_t>> pushed (num);
+    auto rename = [&] (size_t b) {
+        for (Phi &phi : toMe->phis[b]) {
+            pushed[b].push_back (phi.dst);
+            phi.dst = newName (phi.dst);
+        }
+
+        for (const Instruction *inst : blocks[b]) {
+            vector <size_t*> fields;
+            useFields (inst->op, &fields);
+            for (size_t *field : fields)
+                *field = current (*field);
+
+            size_t reg;
+            if (definedReg (inst->op, &reg)) {
+                pushed[b].push_back (reg);
+                inst->op->reg2 = newName (reg);
+            }
+        }
+
+        for (size_t s : toMe->succ[b]) {
+            size_t k = find (toMe->pred[s].begin (), toMe->pred[s].end (), b) - toMe->pred[s].begin ();
+            for (Phi &phi : toMe->phis[s])
+                phi.args[k] = current (phi.args[k]);
+        }
+    };
+
+    vector <pair <size_t, size_t>> stack {make_pair (0, 0)};
+    rename (0);
+    while (stack.size ()) {
+        auto &top = stack.back ();
+        const auto &children = domTree.children[top.first];
+        if (top.second < children.size ()) {
+            size_t next = children[top.second++];
+            rename (next);
+            stack.push_back (make_pair (next, 0));
+        }
+        else {
+            for (size_t reg : pushed[top.first])
+                stacks[reg].pop_back ();
+            stack.pop_back ();
+        }
+    }
+
+    toMe->buildDefUse ();
+}
+
+// emit the copies of a parallel copy one by one, using 'temp' to
+// break cycles, as in Boissinot et al. 'Revisiting Out-of-SSA Translation'
+static void sequentialize (const vector <pair <size_t, size_t>> &copies, size_t temp,
+    vector <const Instruction*> *toMe) {
+
+    // 'loc' is where the value of a register can be found now
+    // 'from' is the register that each destination copies from
+    unordered_map <size_t, size_t> loc, from;
+    unordered_set <size_t> done;
+    vector <size_t> ready, todo;
+
+    for (const auto &copy : copies) {
+        loc[copy.second] = copy.second;
+        from[copy.first] = copy.second;
+        todo.push_back (copy.first);
+    }
+
+    // the destinations which are not needed as source can be written now
+    for (const auto &copy : copies) {
+        if (loc.find (copy.first) == loc.end ())
+            ready.push_back (copy.first);
+    }
+
+    auto emit = [&] (size_t src, size_t dst) {
+        toMe->push_back (new Instruction (nullptr, new Operation (OpCode::i2i_, src, 0, dst, 0)));
+    };
+
+    while (todo.size ()) {
+        while (ready.size ()) {
+            size_t dst = ready.back ();
+            ready.pop_back ();
+
+            size_t src = from[dst], cur = loc[src];
+            emit (cur, dst);
+            loc[src] = dst;
+            done.insert (dst);
+
+            // the source is saved, so it can be overwritten
+            if (src == cur && from.find (src) != from.end ())
+                ready.push_back (src);
+        }
+
+        size_t dst = todo.back ();
+        todo.pop_back ();
+
+        // the copy is part of a cycle, save the destination first
+        if (done.find (dst) == done.end ()) {
+            emit (dst, temp);
+            loc[dst] = temp;
+            ready.push_back (dst);
+        }
+    }
+}
+
+void destroySSA (SSAForm &fromMe, vector <const Instruction*> *toMe) {
+    auto &blocks = fromMe.blocks;
+    auto &succ = fromMe.succ;
+    auto &pred = fromMe.pred;
+    auto &phis = fromMe.phis;
+
+    LabelMaker maker (vector <const Instruction*> {});
+    for (size_t b : fromMe.layout) {
+        for (const Instruction *inst : blocks[b]) {
+            if (inst->label != nullptr)
+                maker.used.insert (string (inst->label));
+        }
+    }
+
+    vector <size_t> layout = fromMe.layout;
+    size_t num = blocks.size (), numNames = fromMe.numNames ();
+
+    // liveness of names, a phi argument is live at the end of its predecessor
+    vector <BitVector> upward (num, BitVector (numNames)), killed (num, BitVector (numNames));
+    vector <BitVector> phiUses (num, BitVector (numNames));
+    for (size_t b : layout) {
+        for (const Phi &phi : phis[b]) {
+            killed[b].set (phi.dst);
+            for (size_t k = 0; k < pred[b].size (); k++)
+                phiUses[pred[b][k]].set (phi.args[k]);
+        }
+
+        for (const Instruction *inst : blocks[b]) {
+            vector <size_t> uses;
+            usedRegs (inst->op, &uses);
+            for (size_t name : uses) {
+                if (!killed[b].test (name))
+                    upward[b].set (name);
+            }
+            size_t name;
+            if (definedReg (inst->op, &name))
+                killed[b].set (name);
+        }
+    }
+
+    vector <BitVector> liveIn (num, BitVector (numNames)), liveOut (num, BitVector (numNames));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = layout.size (); i-- > 0; ) {
+            size_t b = layout[i];
+            BitVector out = phiUses[b];
+            for (size_t s : succ[b])
+                out |= liveIn[s];
+
+            BitVector in = out;
+            in.subtract (killed[b]);
+            in |= upward[b];
+
+            if (in != liveIn[b] || out != liveOut[b]) {
+                liveIn[b] = std::move (in);
+                liveOut[b] = std::move (out);
+                changed = true;
+            }
+        }
+    }
+
+    // interference graph, a name interferes with everything live where it
+    // is defined, except the source of a copy which holds the same value
+    vector <unordered_set <size_t>> adj (numNames);
+    auto interfere = [&] (size_t a, size_t b) {
+        if (a == b)
+            return;
+        adj[a].insert (b);
+        adj[b].insert (a);
+    };
+
+    for (size_t b : layout) {
+        BitVector live = liveOut[b];
+        for (size_t i = blocks[b].size (); i-- > 0; ) {
+            const Operation *op = blocks[b][i]->op;
+
+            size_t name;
+            if (definedReg (op, &name)) {
+                bool copy = (op->code == OpCode::i2i_);
+                live.forEach ([&] (size_t other) {
+                    if (!copy || other != op->reg0)
+                        interfere (name, other);
+                });
+                live.reset (name);
+            }
+
+            vector <size_t> uses;
+            usedRegs (op, &uses);
+            for (size_t use : uses)
+                live.set (use);
+        }
+
+        // phi functions are defined at once at the top of block
+        for (const Phi &phi : phis[b]) {
+            live.forEach ([&] (size_t other) { interfere (phi.dst, other); });
+            for (const Phi &other : phis[b])
+                interfere (phi.dst, other.dst);
+        }
+
+        // so are the values from before the procedure starts
+        if (b == 0) {
+            vector <size_t> names;
+            live.forEach ([&] (size_t name) { names.push_back (name); });
+            for (size_t x : names) {
+                for (size_t y : names)
+                    interfere (x, y);
+            }
+        }
+    }
+
+    // coalesce names into classes by union find
+    vector <size_t> unionFind (numNames);
+    vector <vector <size_t>> members (numNames);
+    for (size_t i = 0; i < numNames; i++) {
+        unionFind[i] = i;
+        members[i].push_back (i);
+    }
+
+    auto findSet = [&] (size_t x) {
+        while (unionFind[x] != x) {
+            unionFind[x] = unionFind[unionFind[x]];
+            x = unionFind[x];
+        }
+        return x;
+    };
+
+    auto coalesce = [&] (size_t a, size_t b) {
+        a = findSet (a);
+        b = findSet (b);
+        if (a == b)
+            return;
+        if (members[a].size () < members[b].size ())
+            swap (a, b);
+
+        for (size_t m : members[b]) {
+            for (size_t n : adj[m]) {
+                if (findSet (n) == a)
+                    return;
+            }
+        }
+
+        unionFind[b] = a;
+        members[a].insert (members[a].end (), members[b].begin (), members[b].end ());
+        members[b].clear ();
+    };
+
+    for (size_t b : layout) {
+        for (const Phi &phi : phis[b]) {
+            for (size_t arg : phi.args)
+                coalesce (phi.dst, arg);
+        }
+    }
+
+    for (size_t b : layout) {
+        for (const Instruction *inst : blocks[b]) {
+            if (inst->op->code == OpCode::i2i_)
+                coalesce (inst->op->reg0, inst->op->reg2);
+        }
+    }
+
+    // assign a register to each class, the original register if possible
+    // classes holding values from before the procedure go first
+    vector <size_t> classReg (numNames, noBlock);
+    unordered_map <size_t, unordered_set <size_t>> takenBy;
+    size_t nextReg = fromMe.nextReg;
+
+    auto assign = [&] (size_t rep, size_t prefer) {
+        unordered_set <size_t> taken;
+        for (size_t m : members[rep]) {
+            for (size_t n : adj[m]) {
+                size_t reg = classReg[findSet (n)];
+                if (reg != noBlock)
+                    taken.insert (reg);
+            }
+        }
+
+        if (prefer != noBlock && taken.find (prefer) == taken.end ()) {
+            classReg[rep] = prefer;
+            return;
+        }
+        for (size_t m : members[rep]) {
+            if (taken.find (fromMe.origReg[m]) == taken.end ()) {
+                classReg[rep] = fromMe.origReg[m];
+                return;
+            }
+        }
+        classReg[rep] = nextReg++;
+    };
+
+    for (size_t name : fromMe.entryNames)
+        assign (findSet (name), fromMe.origReg[name]);
+
+    for (size_t name = 0; name < numNames; name++) {
+        if (findSet (name) == name && classReg[name] == noBlock)
+            assign (name, noBlock);
+    }
+
+    auto regOf = [&] (size_t name) { return classReg[findSet (name)]; };
+
+    // rewrite instructions, dropping the copies that have been coalesced,
+    // the label of a copy dropped moves to the next instruction
+    for (size_t b : layout) {
+        vector <const Instruction*> newBlock;
+        char *label = nullptr;
+        for (const Instruction *inst : blocks[b]) {
+            vector <size_t*> fields;
+            useFields (inst->op, &fields);
+            for (size_t *field : fields)
+                *field = regOf (*field);
+
+            size_t name;
+            if (definedReg (inst->op, &name))
+                inst->op->reg2 = regOf (name);
+
+            if (inst->op->code == OpCode::i2i_ && inst->op->reg0 == inst->op->reg2) {
+                if (inst->label != nullptr && label == nullptr)
+                    label = strdup (inst->label);
+                delete inst;
+                continue;
+            }
+            newBlock.push_back (withLabel (inst, label));
+            label = nullptr;
+        }
+        if (label != nullptr)
+            newBlock.push_back (withLabel (new Instruction (nullptr, new Operation ()), label));
+        blocks[b] = std::move (newBlock);
+    }
+
+    // the remaining phi functions become copies at the end of predecessors
+    size_t temp = noBlock;
+    for (size_t b : fromMe.layout) {
+        if (phis[b].empty ())
+            continue;
+
+        for (size_t k = 0; k < pred[b].size (); k++) {
+            vector <pair <size_t, size_t>> copies;
+            for (const Phi &phi : phis[b]) {
+                size_t dst = regOf (phi.dst), src = regOf (phi.args[k]);
+                if (dst != src)
+                    copies.push_back (make_pair (dst, src));
+            }
+            if (copies.empty ())
+                continue;
+
+            if (temp == noBlock)
+                temp = nextReg++;
+
+            vector <const Instruction*> sequence;
+            sequentialize (copies, temp, &sequence);
+
+            // split the edge when the copies cannot go to the end of predecessor
+            size_t p = pred[b][k];
+            if (succ[p].size () > 1 || blocks[p].back ()->op->code == OpCode::cbr_) {
+                string label = maker.make ("SSA");
+                size_t n = blocks.size ();
+                blocks.push_back (vector <const Instruction*> {new Instruction (label.c_str ())});
+                blocks[n].push_back (new Instruction (nullptr, new Operation (
+                    OpCode::br_, 0, 0, 0, 0, fromMe.label (b))));
+
+                retarget (blocks[p].back (), string (fromMe.label (b)), label);
+                *find (succ[p].begin (), succ[p].end (), b) = n;
+                succ.push_back (vector <size_t> {b});
+                pred.push_back (vector <size_t> {p});
+                pred[b][k] = n;
+
+                // the predecessor ends with a branch, so nothing falls into the new block
+                layout.insert (find (layout.begin (), layout.end (), p) + 1, n);
+            }
+
+            auto &block = blocks[pred[b][k]];
+            auto pos = block.end ();
+            if (block.back ()->op->code == OpCode::br_)
+                pos--;
+            block.insert (pos, sequence.begin (), sequence.end ());
+        }
+        phis[b].clear ();
+    }
+
+    joinBlocks (blocks, layout, toMe);
+    fromMe.layout.clear ();
+}
@@ -22,6 +22,97 @@ const vector <string> dict {
     "coutput", "write", "cwrite"
 };
 
+// help to hold the latency of each opcode
+static vector <size_t> &latencyTable () {
+    static vector <size_t> table;
+    if (table.empty ()) {
+        table.assign (dict.size (), 1);
+        for (size_t code = OpCode::load_; code <= OpCode::cstoreAO_; code++)
+            table[code] = 3;
+        table[OpCode::mult_] = table[OpCode::multI_] = 2;
+        table[OpCode::div_] = table[OpCode::divI_] = 4;
+    }
+    return table;
+}
+
+size_t latency (OpCode code) {
+    return latencyTable ()[code - OpCode::nop_];
+}
+
+bool setLatency (const string &name, size_t cycles) {
+    auto it = find (dict.begin (), dict.end (), name);
+    if (it == dict.end () || cycles == 0)
+        return false;
+    latencyTable ()[it - dict.begin ()] = cycles;
+    return true;
+}
+
+// the units of the machine, as set with setMachine
+static Machine target;
+static bool targetSet = false;
+
+Machine :: Machine () : width (2), memory (1), multiply (1) {
+    if (targetSet)
+        *this = target;
+}
+
+bool setMachine (const string &unit, size_t count) {
+    size_t *field = unit == "width" ? &target.width : unit == "memory" ? &target.memory :
+        unit == "multiply" ? &target.multiply : nullptr;
+    if (field == nullptr || count == 0)
+        return false;
+    *field = count;
+    targetSet = true;
+    return true;
+}
+
+bool definedReg (const Operation *op, size_t *reg) {
+    if (opcodeMap[op->code - OpCode::nop_] == 9)
+        return false;
+    *reg = op->reg2;
+    return true;
+}
+
+void usedRegs (const Operation *op, vector <size_t> *regs) {
+    vector <size_t*> fields;
+    useFields (const_cast <Operation*> (op), &fields);
+    for (size_t *field : fields)
+        regs->push_back (*field);
+}
+
+void useFields (Operation *op, vector <size_t*> *fields) {
+    switch (op->code) {
+        // operations reading two registers
+        case OpCode::add_: case OpCode::sub_: case OpCode::mult_: case OpCode::div_: 
+        case OpCode::lshift_: case OpCode::rshift_: case OpCode::and_: case OpCode::or_: 
+        case OpCode::cmp_LT_: case OpCode::cmp_LE_: case OpCode::cmp_GT_: 
+        case OpCode::cmp_GE_: case OpCode::cmp_EQ_: case OpCode::cmp_NE_: 
+        case OpCode::loadAO_: case OpCode::cloadAO_: 
+        case OpCode::store_: case OpCode::storeAI_: 
+        case OpCode::cstore_: case OpCode::cstoreAI_: 
+            fields->push_back (&op->reg0);
+            fields->push_back (&op->reg1);
+            break;
+
+        // operations reading three registers
+        case OpCode::storeAO_: case OpCode::cstoreAO_: 
+            fields->push_back (&op->reg0);
+            fields->push_back (&op->reg1);
+            fields->push_back (&op->reg2);
+            break;
+
+        // operations reading no register
+        case OpCode::nop_: case OpCode::loadI_: case OpCode::br_: case OpCode::halt_: 
+        case OpCode::read_: case OpCode::cread_: case OpCode::output_: case OpCode::coutput_: 
+            break;
+
+        // the others read exactly one register
+        default: 
+            fields->push_back (&op->reg0);
+            break;
+    }
+}
+
 void buildLabelMap (const vector <const Instruction*> &fromMe, 
     unordered_map <string, size_t> &toMe) {
     
@@ -35,6 +126,85 @@ void buildLabelMap (const vector <const Instruction*> &fromMe,
     }
 }
 
+bool evaluate (OpCode code, long long lhs, long long rhs, long long *res) {
+    long long value;
+    switch (code) {
+        case OpCode::add_: case OpCode::addI_: value = lhs + rhs; break;
+        case OpCode::sub_: case OpCode::subI_: value = lhs - rhs; break;
+        case OpCode::mult_: case OpCode::multI_: value = lhs * rhs; break;
+
+        case OpCode::div_: case OpCode::divI_: 
+            // division by zero and the only overflowing division
+            if (rhs == 0 || (lhs == std::numeric_limits<int>::min() && rhs == -1))
+                return false;
+            value = lhs / rhs;
+            break;
+
+        case OpCode::lshift_: case OpCode::lshiftI_: 
+            if (rhs < 0 || rhs > 31)
+                return false;
+            value = (long long) ((unsigned long long) lhs << rhs);
+            break;
+
+        case OpCode::rshift_: case OpCode::rshiftI_: 
+            if (rhs < 0 || rhs > 31)
+                return false;
+            value = lhs >> rhs;
+            break;
+
+        case OpCode::and_: case OpCode::andI_: value = lhs & rhs; break;
+        case OpCode::or_: case OpCode::orI_: value = lhs | rhs; break;
+        case OpCode::not_: value = ~lhs; break;
+
+        case OpCode::cmp_LT_: value = lhs < rhs; break;
+        case OpCode::cmp_LE_: value = lhs <= rhs; break;
+        case OpCode::cmp_GT_: value = lhs > rhs; break;
+        case OpCode::cmp_GE_: value = lhs >= rhs; break;
+        case OpCode::cmp_EQ_: value = lhs == rhs; break;
+        case OpCode::cmp_NE_: value = lhs != rhs; break;
+
+        default: return false;
+    }
+
+    // wrap around into 32 bits
+    *res = (int) (unsigned int) (unsigned long long) value;
+    return true;
+}
+
+void retarget (const Instruction *inst, const string &oldLabel, const string &newLabel) {
+    Operation *op = inst->op;
+    if (op->label1 != nullptr && oldLabel == op->label1) {
+        delete [] op->label1;
+        op->label1 = strdup (newLabel.c_str ());
+    }
+    if (op->label2 != nullptr && oldLabel == op->label2) {
+        delete [] op->label2;
+        op->label2 = strdup (newLabel.c_str ());
+    }
+}
+
+const Instruction* withLabel (const Instruction *inst, char *label) {
+    if (label != nullptr)
+        const_cast <Instruction*> (inst)->label = label;
+    return inst;
+}
+
+LabelMaker :: LabelMaker (const vector <const Instruction*> &insts) : next (0) {
+    for (const Instruction *inst : insts) {
+        if (inst->label != nullptr)
+            used.insert (string (inst->label));
+    }
+}
+
+string LabelMaker :: make (const string &prefix) {
+    string label;
+    do {
+        label = prefix + to_string (next++);
+    } while (used.find (label) != used.end ());
+    used.insert (label);
+    return label;
+}
+
 Graph :: Graph (const vector <const Instruction*> &insts, const vector <size_t> &lead, 
     const vector <size_t> &last, const vector <pair <size_t, size_t>> &edgesIn) {
 
@@ -60,57 +230,6 @@ Graph :: Graph (const vector <const Instruction*> &insts, const vector <size_t>
         edges[tailMap[e.first]].insert (headMap[e.second]);
 }
 
-void Graph :: dfs (const string &idx, unordered_map <string, int> &onStack, 
-    unordered_map <string, unordered_set <string>> *body) const {
-
-    // when there is no edge coming out of 'idx'
-    if (edges.find (idx) == edges.end ())
-        return;
-    
-    // mark vertex idx as on stack
-    onStack[idx] = 1;
-
-    // exam each subsequent vertex
-    for (const string &dstIdx : edges.at(idx)) {
-        // when vertex dstIdx is on stack, means there is a loop
-        if (onStack[dstIdx])
-            (*body)[dstIdx].insert (idx);
-        else dfs (dstIdx, onStack, body);
-    }
-
-    // recover stack in the end
-    onStack[idx] = 0;
-}
-
-void Graph :: findLoop (vector <Loop> *loops) const {
-    // initialize onStack such that no vertex is no stack
-    unordered_map <string, int> onStack;
-    for (const string &v : vertices)
-        onStack[v] = 0;
-
-    // perform depth first search from beginning node (vertex 0)
-    unordered_map <string, unordered_set <string>> body;
-    dfs ("START", onStack, &body);
-
-    for (const auto &e : edges) {
-        for (const string &v : e.second) {
-            // find the vertex, s.t. its child 'v' is the loop entry
-            if (body.find (v) != body.end ()) {
-
-                // but the parent of head can not be the tail of loop
-                auto &tails = body[v];
-                if (tails.find (e.first) != tails.end ())
-                    continue;
-                
-                for (const string &tail : body[v])
-                    loops->push_back (Loop (e.first, v, tail));
-                // a block cannot be the parent of more than one loops
-                break;
-            }
-        }
-    }
-}
-
 void Graph :: reverseGraph (Graph *toMe) const {
     toMe->vertices = vertices;
     for (const auto &e : edges) {
@@ -155,93 +274,6 @@ void sortVertexEBB (const Graph &graph, const Graph &revGraph,
     }
 }
 
-void copyInstructions (const vector <const Instruction*> &fromMe, 
-    vector <const Instruction*> *toMe, size_t fromLine, size_t numLines) {
-
-    for (size_t i = 0; i < numLines; i++)
-        toMe->push_back (new Instruction (fromMe[fromLine + i]));
-}
-
-void modifyBranch (const vector <const Instruction*> fromMe, 
-    vector <const Instruction*> *toMe, Graph *graph, 
-    unordered_map <string, string> *dependency, 
-    const unordered_set <string> &involved, const string &oldLabel, 
-    const string &newLabel, const string &suffix) {
-
-    // maintain the graph
-    graph->vertices.push_back (newLabel);
-
-    // when the edge is a natural one, i.e. no cr/cbr in the end
-    OpCode brType = fromMe.back ()->op->code;
-    if (brType != OpCode::br_ && brType != OpCode::cbr_) {
-        toMe->push_back (new Instruction (fromMe.back ()));
-
-        // since it is a natural edge, target block must be involved
-        string tarLabel = *(graph->edges)[oldLabel].begin () + suffix;
-
-        // add the branch instruction to jump to target
-        (*dependency)[oldLabel + suffix] = tarLabel;
-        toMe->push_back (new Instruction (nullptr, new Operation (
-            OpCode::br_, 0, 0, 0, 0, tarLabel.c_str ())));
-
-        // maintain the graph
-        (graph->edges)[newLabel].insert (tarLabel);
-        return;
-    }
-
-    // when the label is involved in loop, mangle them
-    string label1 = string (fromMe.back ()->op->label1);
-    if (involved.find (label1) != involved.end ())
-        label1 += suffix;
-
-    // maintain the graph
-    (graph->edges)[newLabel].insert (label1);
-
-    // this is a conditional branch in this case
-    if (brType == OpCode::cbr_) {
-        // we need another label in conditional branch
-        string label2 = string (fromMe.back ()->op->label2);
-        if (involved.find (label2) != involved.end ())
-            label2 += suffix;
-
-        // build the conditional branch instruction
-        toMe->push_back (new Instruction (nullptr, new Operation (
-            OpCode::cbr_, fromMe[fromMe.size () - 2]->op->reg2, 0, 0, 0, 
-            label1.c_str (), label2.c_str ())));
-
-        // add second edge into graph
-        (graph->edges)[newLabel].insert (label2);
-    }
-
-    else { // this is a jump in this case
-        toMe->push_back (new Instruction (nullptr, new Operation (
-            OpCode::br_, 0, 0, 0, 0, label1.c_str ())));
-    }
-}
-
-void finalizeTail (const vector <const Instruction*> &block, 
-    vector <const Instruction*> *newBlock, size_t reg, size_t step, 
-    const string &label1, const string &label2) {
-    
-    size_t size = block.size ();
-    
-    const Instruction* icrInst = block[size - 3];
-    const Instruction* cmpInst = block[size - 2];
-
-    // build the increment instruction
-    newBlock->push_back (new Instruction (nullptr, new Operation (
-        icrInst->op->code, icrInst->op->reg0, 0, reg, step)));
-
-    // build the comparison instruction
-    newBlock->push_back (new Instruction (nullptr, new Operation (
-        cmpInst->op->code, reg, cmpInst->op->reg1, cmpInst->op->reg2)));
-
-    // the last instruction of the tail block must be a conditional branch
-    newBlock->push_back (new Instruction (nullptr, new Operation (
-        OpCode::cbr_, cmpInst->op->reg2, 0, 0, 0, 
-        label1.c_str (), label2.c_str ())));
-}
-
 bool isPowerOfTwo (size_t num) {
     if (num == 0)
         return false;
@@ -260,21 +292,26 @@ size_t getPower (size_t num) {
 }
 
 bool shiftOptimizable (const Instruction *inst) {
+    // note that division rounds toward zero, so dividing a negative number
+    // by a power of two is not a right shift
     if (inst->op->code == OpCode::multI_) {
         // when multiply zero or power of two
         if (inst->op->constant == 0 || isPowerOfTwo (inst->op->constant))
             return true;
         return false;
     }
-    // divide power of two
-    if (inst->op->code == OpCode::divI_ && isPowerOfTwo (inst->op->constant))
-        return true;
     return false;
 }
 
+// help to copy the label of instruction, if any
+static char* labelOf (const Instruction *inst) {
+    return inst->label != nullptr ? strdup (inst->label) : nullptr;
+}
+
 void writeInstsBack (const vector <const Instruction*> &fromMe, 
     vector <const Instruction*> *toMe, const unordered_set <size_t> &removal, 
-    const unordered_map <size_t, RewriteInfo> &rewrite, size_t tempReg) {
+    const unordered_map <size_t, RewriteInfo> &rewrite, 
+    const unordered_map <size_t, FoldInfo> &folded, size_t tempReg) {
 
     // maps the #line that needed to be re-written to the copy target 
     // variable that holds the value of pre-computed variable
@@ -287,13 +324,23 @@ void writeInstsBack (const vector <const Instruction*> &fromMe,
     // finish probing, start re-write
     for (size_t i = 0; i < fromMe.size (); i++) {
 
-        // when the instruction is redundant, skip it
-        if (removal.find (i) != removal.end ())
-            continue;
+        // when the instruction is redundant, skip it but keep its label
+        if (removal.find (i) != removal.end ()) {
+            if (fromMe[i]->label != nullptr)
+                toMe->push_back (new Instruction (fromMe[i]->label));
+        }
+
+        // when the value is known to be a constant or held in a register
+        else if (folded.find (i) != folded.end ()) {
+            const FoldInfo &fold = folded.at (i);
+            toMe->push_back (new Instruction (labelOf (fromMe[i]), fold.first == OpCode::loadI_ ?
+                new Operation (OpCode::loadI_, 0, 0, fromMe[i]->op->reg2, fold.second) :
+                new Operation (OpCode::i2i_, fold.second, 0, fromMe[i]->op->reg2, 0)));
+        }
 
         // when the result is needed in subsequent instructions
         // and cannot be optimized by shift
-        if (rewrite.find (i) != rewrite.end () && !shiftOptimizable (fromMe[i])) {
+        else if (rewrite.find (i) != rewrite.end () && !shiftOptimizable (fromMe[i])) {
 
             // the source variable used to assign other variables
             size_t srcReg = fromMe[i]->op->reg2;
@@ -319,6 +366,7 @@ void writeInstsBack (const vector <const Instruction*> &fromMe,
         // when the line need to be re-written
         else if (copyMap.find (i) != copyMap.end ()) {
             Instruction* inst = new Instruction ();
+            inst->label = labelOf (fromMe[i]);
             inst->op = new Operation (OpCode::i2i_, copyMap[i], 0, fromMe[i]->op->reg2, 0);
 
             toMe->push_back (inst);
@@ -326,78 +374,30 @@ void writeInstsBack (const vector <const Instruction*> &fromMe,
 
         // when shift optimization is possible
         else if (shiftOptimizable (fromMe[i])) {
-            if (fromMe[i]->op->code == OpCode::multI_) {
 
-                // optimize multiplication with zero
-                if (fromMe[i]->op->constant == 0)
-                    toMe->push_back (new Instruction (nullptr, new Operation (
-                        OpCode::loadI_, 0, 0, 0, 0)));
-                
-                // optimize multiplication with power of two
-                else {
-                    toMe->push_back (new Instruction (nullptr, new Operation (
-                        OpCode::lshiftI_, fromMe[i]->op->reg0, 0, 
-                        fromMe[i]->op->reg2, getPower (fromMe[i]->op->constant))));
-                }
-            }
-
-            // optimize divide power of two
+            // optimize multiplication with zero
+            if (fromMe[i]->op->constant == 0)
+                toMe->push_back (new Instruction (labelOf (fromMe[i]), new Operation (
+                    OpCode::loadI_, 0, 0, fromMe[i]->op->reg2, 0)));
+            
+            // optimize multiplication with power of two
             else {
-                toMe->push_back (new Instruction (nullptr, new Operation (
-                    OpCode::rshiftI_, fromMe[i]->op->reg0, 0, 
+                toMe->push_back (new Instruction (labelOf (fromMe[i]), new Operation (
+                    OpCode::lshiftI_, fromMe[i]->op->reg0, 0, 
                     fromMe[i]->op->reg2, getPower (fromMe[i]->op->constant))));
             }
         }
 
         else toMe->push_back (new Instruction (fromMe[i]));
 
-        // finally, check the reminder if there is any pending instruction
-        // if yes, insert that instruction to target 'toMe'
+        // finally, check the reminder if there is any pending instruction,
+        // even after a line removed or folded, and if yes, insert that
+        // instruction to target 'toMe'
         if (reminder.find (i) != reminder.end ())
             toMe->push_back (reminder[i]);
     }
 }
 
-void writeInstsBack (const unordered_map <string, vector <const Instruction*>> &instMap, 
-    vector <const Instruction*> *toMe, const vector <string> &order, 
-    const unordered_map <string, string> &dependency) {
-
-    unordered_set <string> beenWritten {order.back ()};
-
-    // first append all the original blocks in order
-    for (size_t i = 0; i < order.size () - 1; i++) {
-        for (const Instruction *inst : instMap.at (order[i]))
-            toMe->push_back (inst);
-        beenWritten.insert (order[i]);
-    }
-
-    // regard all the latter label in dependency as been written
-    for (const auto &fstSnd : dependency)
-        beenWritten.insert (fstSnd.second);
-
-    // append all the remaining instructions
-    for (const auto &block : instMap) {
-        // when the block has been written, then skip it
-        if (beenWritten.find (block.first) != beenWritten.end ())
-            continue;
-
-        for (const Instruction *inst : block.second)
-            toMe->push_back (inst);
-
-        // deal with dependency, when there is a dependency
-        if (dependency.find (block.first) != dependency.end ()) {
-            const string &nextLabel = dependency.at (block.first);
-            for (const Instruction *inst : instMap.at (nextLabel))
-                toMe->push_back (inst);
-            beenWritten.insert (nextLabel);
-        }
-    }
-
-    // append the last block in the end
-    for (const Instruction *inst : instMap.at (order.back ()))
-        toMe->push_back (inst);
-}
-
 size_t nextUnusedReg (const vector <const Instruction*> &fromMe) {
     size_t nextReg = 0;
     for (const Instruction* inst : fromMe) {
@@ -408,15 +408,9 @@ size_t nextUnusedReg (const vector <const Instruction*> &fromMe) {
     return nextReg;
 }
 
-string translate (const Instruction* me) {
+// help to translate an operation without label
+static string translateOperation (const Operation* op) {
     string ins;
-    
-    // append label if any
-    if (me->label != nullptr)
-        ins += string (me->label) + ":\t";
-    else ins += "\t";
-
-    Operation* op = me->op;
 
     // append opcode
     ins += dict[op->code - OpCode::nop_];
@@ -502,7 +496,36 @@ string translate (const Instruction* me) {
         default: break;
     }
 
+    return ins;
+}
+
+string translate (const Instruction* me) {
+    string ins;
+    
+    // append label if any
+    if (me->label != nullptr)
+        ins += string (me->label) + ":\t";
+    else ins += "\t";
+
+    ins += translateOperation (me->op);
+
     // end the instruction with '\n'
     ins += "\n";
     return ins;
 }
+
+string translate (const vector <const Instruction*> &group) {
+    if (group.size () == 1)
+        return translate (group[0]);
+
+    string ins;
+    if (group[0]->label != nullptr)
+        ins += string (group[0]->label) + ":\t";
+    else ins += "\t";
+
+    ins += "[ ";
+    for (size_t i = 0; i < group.size (); i++)
+        ins += (i ? " ; " : "") + translateOperation (group[i]->op);
+    ins += " ]\n";
+    return ins;
+}
@@ -0,0 +1,4 @@
+// flags: -D
+// code without a register to look up
+    nop
+    halt
@@ -0,0 +1,23 @@
+// flags: -v
+// a load of a stored value whose register is written again right after a
+// line that is folded, then right after a store that is removed, must still
+// read the value memorized before that write
+    read => r1
+    read => r2
+    loadI 1024 => r0
+    add r1, r2 => r3
+    storeAI r3 => r0, 0
+    addI r1, 0 => r6
+    sub r1, r2 => r3
+    loadAI r0, 0 => r7
+    write r7
+    write r6
+    write r3
+    mult r1, r2 => r4
+    storeAI r4 => r0, 4
+    storeAI r4 => r0, 4
+    sub r2, r1 => r4
+    loadAI r0, 4 => r8
+    write r8
+    write r4
+    halt
@@ -0,0 +1,40 @@
+// flags: -j
+// a matrix times vector nest with the arrays at constant bases set before
+// the first loop and 16 rows, the copies of the outer loop are jammed
+    loadI 1024 => r10
+    loadI 2048 => r11
+    loadI 3072 => r12
+    loadI 16 => r2
+    loadI 0 => r1
+    loadI 5 => r20
+L0: store r20 => r1
+    multI r20, 3 => r20
+    andI r20, 255 => r20
+    addI r1, 4 => r1
+    cmp_LT r1, r12 => r21
+    cbr r21 -> L0, L5
+L5: loadI 0 => r1
+L1: loadI 0 => r3
+    loadI 0 => r4
+    multI r1, 64 => r5
+    add r10, r5 => r7
+L2: multI r3, 4 => r6
+    add r7, r6 => r8
+    load r8 => r9
+    add r11, r6 => r13
+    load r13 => r14
+    mult r9, r14 => r15
+    add r4, r15 => r4
+    addI r3, 1 => r3
+    cmp_LT r3, r2 => r16
+    cbr r16 -> L2, L3
+L3: multI r1, 4 => r17
+    add r12, r17 => r18
+    store r4 => r18
+    addI r1, 1 => r1
+    cmp_LT r1, r2 => r19
+    cbr r19 -> L1, L4
+L4: output 3072
+    output 3076
+    output 3132
+    halt
@@ -0,0 +1,15 @@
+// flags: -o
+// four times the induction variable wraps around before the bound, so the
+// loop test cannot compare the multiples
+    loadI 536870900 => r1
+    loadI 536870920 => r2
+    loadI 0 => r5
+L1: multI r1, 4 => r3
+    addI r5, 1 => r5
+    addI r1, 1 => r1
+    cmp_LT r1, r2 => r4
+    cbr r4 -> L1, L2
+L2: write r1
+    write r3
+    write r5
+    halt
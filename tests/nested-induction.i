@@ -0,0 +1,29 @@
+// flags: -o
+// an induction variable stepped in both an inner and an outer loop forms one
+// strongly connected component through the phi functions of both headers,
+// the inner header holding more phi functions than the outer one
+    read => r1
+    loadI 0 => r20
+L1: loadI 0 => r5
+    loadI 0 => r10
+    loadI 0 => r11
+    loadI 0 => r12
+L2: addI r10, 2 => r10
+    addI r11, 3 => r11
+    addI r12, 5 => r12
+    addI r20, 1 => r20
+    multI r20, 4 => r6
+    addI r5, 1 => r5
+    cmp_LT r5, r1 => r7
+    cbr r7 -> L2, L3
+L3: addI r20, 1 => r20
+    multI r20, 8 => r8
+    cmp_LT r20, r1 => r9
+    cbr r9 -> L1, L4
+L4: write r20
+    write r10
+    write r11
+    write r12
+    write r6
+    write r8
+    halt
@@ -0,0 +1,19 @@
+// flags: -o
+// the address multiply at the labeled loop head becomes a step by a constant,
+// and the label moves to the next operation kept
+    loadI 0 => r1
+    loadI 100 => r2
+    loadI 1024 => r10
+    loadI 2048 => r11
+L1: multI r1, 4 => r3
+    add r10, r3 => r4
+    add r11, r3 => r5
+    load r4 => r6
+    multI r6, 3 => r7
+    store r7 => r5
+    addI r1, 1 => r1
+    cmp_LT r1, r2 => r8
+    cbr r8 -> L1, L2
+L2: output 2048
+    output 2052
+    halt
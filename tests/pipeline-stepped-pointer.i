@@ -0,0 +1,22 @@
+// flags: -m
+// the loads and stores through the pointer stepped in the loop follow the
+// step by their offsets, so iterations overlap in two stages
+    loadI 1024 => r1
+    loadI 1104 => r9
+    loadI 7 => r20
+L0: store r20 => r1
+    addI r20, 5 => r20
+    addI r1, 4 => r1
+    cmp_LT r1, r9 => r5
+    cbr r5 -> L0, L1
+L1: loadI 1024 => r1
+L2: load r1 => r2
+    multI r2, 3 => r3
+    store r3 => r1
+    addI r1, 4 => r1
+    cmp_LT r1, r9 => r5
+    cbr r5 -> L2, L3
+L3: output 1024
+    output 1028
+    output 1100
+    halt
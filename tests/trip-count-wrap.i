@@ -0,0 +1,14 @@
+// flags: -u 2
+// read 1000000000 and -2000000000: the distance from the value first
+// compared to the bound wraps around to a positive number, while the loop
+// runs once
+    read => r1
+    read => r2
+    loadI 0 => r3
+L1: addI r3, 1 => r3
+    addI r1, 1000000000 => r1
+    cmp_LT r1, r2 => r4
+    cbr r4 -> L1, L2
+L2: write r3
+    write r1
+    halt
@@ -0,0 +1,4 @@
+// flags: -g
+// code without a register to look up
+    nop
+    halt